@@ -663,6 +663,12 @@ __SYSCALL(__NR_rt_tgsigqueueinfo, sys_rt_tgsigqueueinfo)
 __SYSCALL(__NR_perf_event_open, sys_perf_event_open)
 #define __NR_recvmmsg				299
 __SYSCALL(__NR_recvmmsg, sys_recvmmsg)
+#define __NR_io_ring_setup			300
+__SYSCALL(__NR_io_ring_setup, sys_io_ring_setup)
+#define __NR_io_ring_enter			301
+__SYSCALL(__NR_io_ring_enter, sys_io_ring_enter)
+#define __NR_io_ring_register			302
+__SYSCALL(__NR_io_ring_register, sys_io_ring_register)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
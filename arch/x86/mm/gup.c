@@ -8,6 +8,7 @@
 #include <linux/mm.h>
 #include <linux/vmstat.h>
 #include <linux/highmem.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgtable.h>
 
@@ -124,6 +125,15 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 
 	refs = 0;
 	head = pte_page(pte);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/*
+	 * A transparent huge page is split for get_user_pages(): leave it
+	 * to the slow path.  The pmd can't be split from under us, as that
+	 * flushes the TLB with an IPI first.
+	 */
+	if (!PageHuge(head))
+		return 0;
+#endif
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
 	do {
 		VM_BUG_ON(compound_head(page) != head);
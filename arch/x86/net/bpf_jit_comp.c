@@ -0,0 +1,680 @@
+/* bpf_jit_comp.c : BPF JIT compiler
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <asm/cacheflush.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/workqueue.h>
+
+/*
+ * Conventions :
+ *  EAX : BPF A accumulator
+ *  EBX : BPF X register
+ *  RDI : pointer to skb   (first argument given to JIT function)
+ *  RBP : frame pointer (even if CONFIG_FRAME_POINTER=n)
+ *  r9d : skb->len - skb->data_len (headlen)
+ *  r8  : skb->data
+ *
+ * Stack frame, below the saved %rbp :
+ *  -8(%rbp)		saved %rbx
+ *  -12(%rbp)		temporary buffer for the load helpers slow path
+ *  -16-4*k(%rbp)	mem[k]
+ */
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+/*
+ * assembly code in arch/x86/net/bpf_jit.S
+ */
+extern u8 sk_load_word[], sk_load_half[], sk_load_byte[], sk_load_byte_msh[];
+
+static inline u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len)	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)   EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+#define EMIT1_off32(b1, off)	do { EMIT1(b1); EMIT(off, 4); } while (0)
+
+#define CLEAR_A() EMIT2(0x31, 0xc0) /* xor %eax,%eax */
+#define CLEAR_X() EMIT2(0x31, 0xdb) /* xor %ebx,%ebx */
+
+static inline bool is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+static inline bool is_near(int offset)
+{
+	return offset <= 127 && offset >= -128;
+}
+
+#define EMIT_JMP(offset)						\
+do {									\
+	if (offset) {							\
+		if (is_near(offset))					\
+			EMIT2(0xeb, offset); /* jmp .+off8 */		\
+		else							\
+			EMIT1_off32(0xe9, offset); /* jmp .+off32 */	\
+	}								\
+} while (0)
+
+/* list of x86 cond jumps opcodes (. + s8)
+ * Add 0x10 (and an extra 0x0f) to generate far jumps (. + s32)
+ */
+#define X86_JB  0x72
+#define X86_JAE 0x73
+#define X86_JE  0x74
+#define X86_JNE 0x75
+#define X86_JBE 0x76
+#define X86_JA  0x77
+
+#define EMIT_COND_JMP(op, offset)				\
+do {								\
+	if (is_near(offset))					\
+		EMIT2(op, offset); /* jxx .+off8 */		\
+	else {							\
+		EMIT2(0x0f, op + 0x10);				\
+		EMIT(offset, 4); /* jxx .+off32 */		\
+	}							\
+} while (0)
+
+#define COND_SEL(CODE, TOP, FOP)	\
+	case CODE:			\
+		t_op = TOP;		\
+		f_op = FOP;		\
+		goto cond_branch
+
+/* mov off(%rdi),reg, with a disp8 form when the offset allows it */
+#define EMIT_SKB_LOAD(prefix, modrm8, field)				\
+do {									\
+	if (prefix)							\
+		EMIT1(prefix);						\
+	if (is_imm8(offsetof(struct sk_buff, field))) {			\
+		EMIT3(0x8b, modrm8, offsetof(struct sk_buff, field));	\
+	} else {							\
+		EMIT2(0x8b, (modrm8) + 0x40);				\
+		EMIT(offsetof(struct sk_buff, field), 4);		\
+	}								\
+} while (0)
+
+#define SEEN_DATAREF 1 /* might call external helpers */
+#define SEEN_XREG    2 /* ebx is used */
+#define SEEN_MEM     4 /* use mem[] for temporary storage */
+#define SEEN_RET0    8 /* jumps to the "return 0" stub */
+#define SEEN_BAIL   16 /* may hand the packet back to the interpreter */
+
+static void bpf_jit_dump(unsigned int flen, unsigned int proglen,
+			 u32 pass, void *image)
+{
+	pr_err("flen=%d proglen=%u pass=%d image=%p\n",
+	       flen, proglen, pass, image);
+	if (image)
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 1, image, proglen, false);
+}
+
+/**
+ * bpf_jit_compile - translate a socket filter into native code
+ * @fp: checked filter
+ *
+ * On success fp->bpf_func points to the generated code. Filters using
+ * instructions the compiler does not handle are left alone and keep
+ * running in sk_run_filter().
+ */
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[128];
+	u8 *prog;
+	unsigned int proglen, oldproglen = 0;
+	int ilen, i;
+	int t_offset, f_offset;
+	u8 t_op, f_op, seen = 0, pass;
+	u8 seen_or_pass0;
+	u8 *image = NULL;
+	u8 *func;
+	unsigned int cleanup_addr;	/* epilogue code offset */
+	unsigned int ret0_addr;		/* "return 0" stub offset */
+	unsigned int bail_addr;		/* interpreter fallback stub offset */
+	unsigned int *addrs;
+	const struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than 64 bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += 64;
+		addrs[i] = proglen;
+	}
+	cleanup_addr = proglen; /* epilogue address */
+	ret0_addr = cleanup_addr + 64;
+	bail_addr = ret0_addr + 64;
+
+	for (pass = 0; pass < 10; pass++) {
+		/*
+		 * The first pass does not know yet what the filter uses,
+		 * assume the worst so that the code only shrinks from one
+		 * pass to the next.
+		 */
+		seen_or_pass0 = (pass == 0) ? (SEEN_XREG | SEEN_DATAREF |
+					       SEEN_MEM | SEEN_RET0 |
+					       SEEN_BAIL) : seen;
+		/* no prologue/epilogue for trivial filters (RET something) */
+		proglen = 0;
+		prog = temp;
+
+		if (seen_or_pass0) {
+			EMIT4(0x55, 0x48, 0x89, 0xe5); /* push %rbp; mov %rsp,%rbp */
+			EMIT4(0x48, 0x83, 0xec, 96);	/* subq  $96,%rsp	*/
+			/* note : must save %rbx in case bpf_error is hit */
+			if (seen_or_pass0 & (SEEN_XREG | SEEN_DATAREF))
+				EMIT4(0x48, 0x89, 0x5d, 0xf8); /* mov %rbx, -8(%rbp) */
+			if (seen_or_pass0 & SEEN_XREG)
+				CLEAR_X(); /* make sure we dont leek kernel memory */
+
+			/*
+			 * If this filter needs to access skb data,
+			 * loads r9 and r8 with :
+			 *  r9 = skb->len - skb->data_len
+			 *  r8 = skb->data
+			 */
+			if (seen_or_pass0 & SEEN_DATAREF) {
+				/* mov off(%rdi),%r9d */
+				EMIT_SKB_LOAD(0x44, 0x4f, len);
+				/* sub off(%rdi),%r9d */
+				if (is_imm8(offsetof(struct sk_buff, data_len)))
+					EMIT4(0x44, 0x2b, 0x4f,
+					      offsetof(struct sk_buff, data_len));
+				else {
+					EMIT3(0x44, 0x2b, 0x8f);
+					EMIT(offsetof(struct sk_buff, data_len), 4);
+				}
+				/* mov off(%rdi),%r8 */
+				EMIT_SKB_LOAD(0x4c, 0x47, data);
+			}
+		}
+
+		switch (filter[0].code) {
+		case BPF_RET | BPF_K:
+		case BPF_LD | BPF_IMM:
+		case BPF_LD | BPF_W | BPF_LEN:
+			/* first instruction sets A register (or is RET 'constant') */
+			break;
+		default:
+			/* make sure we dont leak kernel information to user */
+			CLEAR_A(); /* A = 0 */
+		}
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+
+			switch (filter[i].code) {
+			case BPF_ALU | BPF_ADD | BPF_X: /* A += X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+				break;
+			case BPF_ALU | BPF_ADD | BPF_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc0, K);	/* add imm8,%eax */
+				else
+					EMIT1_off32(0x05, K);	/* add imm32,%eax */
+				break;
+			case BPF_ALU | BPF_SUB | BPF_X: /* A -= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x29, 0xd8);		/* sub    %ebx,%eax */
+				break;
+			case BPF_ALU | BPF_SUB | BPF_K: /* A -= K */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe8, K); /* sub imm8,%eax */
+				else
+					EMIT1_off32(0x2d, K); /* sub imm32,%eax */
+				break;
+			case BPF_ALU | BPF_MUL | BPF_X: /* A *= X; */
+				seen |= SEEN_XREG;
+				EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+				break;
+			case BPF_ALU | BPF_MUL | BPF_K: /* A *= K */
+				if (is_imm8(K))
+					EMIT3(0x6b, 0xc0, K); /* imul imm8,%eax,%eax */
+				else {
+					EMIT2(0x69, 0xc0);		/* imul imm32,%eax */
+					EMIT(K, 4);
+				}
+				break;
+			case BPF_ALU | BPF_DIV | BPF_X: /* A /= X; */
+				seen |= SEEN_XREG | SEEN_RET0;
+				EMIT2(0x85, 0xdb);	/* test %ebx,%ebx */
+				/* (addrs[i] - 4) is the address following this jmp
+				 * ("xor %edx,%edx; div %ebx" being 4 bytes long)
+				 */
+				EMIT_COND_JMP(X86_JE, ret0_addr - (addrs[i] - 4));
+				EMIT4(0x31, 0xd2, 0xf7, 0xf3); /* xor %edx,%edx; div %ebx */
+				break;
+			case BPF_ALU | BPF_DIV | BPF_K: /* A /= K; */
+				EMIT1_off32(0xb9, K);	/* mov imm32,%ecx */
+				EMIT4(0x31, 0xd2, 0xf7, 0xf1); /* xor %edx,%edx; div %ecx */
+				break;
+			case BPF_ALU | BPF_AND | BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+				break;
+			case BPF_ALU | BPF_AND | BPF_K:
+				if (K >= 0xFFFFFF00) {
+					EMIT2(0x24, K & 0xFF); /* and imm8,%al */
+				} else if (K >= 0xFFFF0000) {
+					EMIT2(0x66, 0x25);	/* and imm16,%ax */
+					EMIT(K, 2);
+				} else {
+					EMIT1_off32(0x25, K);	/* and imm32,%eax */
+				}
+				break;
+			case BPF_ALU | BPF_OR | BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+				break;
+			case BPF_ALU | BPF_OR | BPF_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc8, K); /* or imm8,%eax */
+				else
+					EMIT1_off32(0x0d, K);	/* or imm32,%eax */
+				break;
+			case BPF_ALU | BPF_LSH | BPF_X: /* A <<= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe0);	/* mov %ebx,%ecx; shl %cl,%eax */
+				break;
+			case BPF_ALU | BPF_LSH | BPF_K:
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe0); /* shl %eax */
+				else
+					EMIT3(0xc1, 0xe0, K);
+				break;
+			case BPF_ALU | BPF_RSH | BPF_X: /* A >>= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe8);	/* mov %ebx,%ecx; shr %cl,%eax */
+				break;
+			case BPF_ALU | BPF_RSH | BPF_K: /* A >>= K; */
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe8); /* shr %eax */
+				else
+					EMIT3(0xc1, 0xe8, K);
+				break;
+			case BPF_ALU | BPF_NEG:
+				EMIT2(0xf7, 0xd8);		/* neg %eax */
+				break;
+			case BPF_RET | BPF_K:
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				/* fallinto */
+			case BPF_RET | BPF_A:
+				if (seen_or_pass0) {
+					EMIT_JMP(cleanup_addr - addrs[i]);
+					break;
+				}
+				EMIT1(0xc3);		/* ret */
+				break;
+			case BPF_MISC | BPF_TAX: /* X = A */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xc3);	/* mov    %eax,%ebx */
+				break;
+			case BPF_MISC | BPF_TXA: /* A = X */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xd8);	/* mov    %ebx,%eax */
+				break;
+			case BPF_LD | BPF_IMM: /* A = K */
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K); /* mov $imm32,%eax */
+				break;
+			case BPF_LDX | BPF_IMM: /* X = K */
+				seen |= SEEN_XREG;
+				if (!K)
+					CLEAR_X();
+				else
+					EMIT1_off32(0xbb, K); /* mov $imm32,%ebx */
+				break;
+			case BPF_LD | BPF_MEM: /* A = mem[K] : mov off8(%rbp),%eax */
+				seen |= SEEN_MEM;
+				EMIT3(0x8b, 0x45, 0xf0 - K*4);
+				break;
+			case BPF_LDX | BPF_MEM: /* X = mem[K] : mov off8(%rbp),%ebx */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x8b, 0x5d, 0xf0 - K*4);
+				break;
+			case BPF_ST: /* mem[K] = A : mov %eax,off8(%rbp) */
+				seen |= SEEN_MEM;
+				EMIT3(0x89, 0x45, 0xf0 - K*4);
+				break;
+			case BPF_STX: /* mem[K] = X : mov %ebx,off8(%rbp) */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x89, 0x5d, 0xf0 - K*4);
+				break;
+			case BPF_LD | BPF_W | BPF_LEN: /*	A = skb->len; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+				EMIT_SKB_LOAD(0, 0x47, len); /* mov off(%rdi),%eax */
+				break;
+			case BPF_LDX | BPF_W | BPF_LEN: /* X = skb->len; */
+				seen |= SEEN_XREG;
+				EMIT_SKB_LOAD(0, 0x5f, len); /* mov off(%rdi),%ebx */
+				break;
+			case BPF_LD | BPF_W | BPF_ABS:
+				func = sk_load_word;
+common_load:
+				if ((int)K >= SKF_AD_OFF && (int)K < 0)
+					goto ancillary;
+				seen |= SEEN_DATAREF;
+				t_offset = func - (image + addrs[i]);
+				EMIT1_off32(0xbe, K); /* mov imm32,%esi */
+				EMIT1_off32(0xe8, t_offset); /* call */
+				break;
+			case BPF_LD | BPF_H | BPF_ABS:
+				func = sk_load_half;
+				goto common_load;
+			case BPF_LD | BPF_B | BPF_ABS:
+				func = sk_load_byte;
+				goto common_load;
+			case BPF_LDX | BPF_B | BPF_MSH:
+				seen |= SEEN_DATAREF | SEEN_XREG;
+				t_offset = sk_load_byte_msh - (image + addrs[i]);
+				EMIT1_off32(0xbe, K);	/* mov imm32,%esi */
+				EMIT1_off32(0xe8, t_offset); /* call sk_load_byte_msh */
+				break;
+			case BPF_LD | BPF_W | BPF_IND:
+				func = sk_load_word;
+common_load_ind:		seen |= SEEN_DATAREF | SEEN_XREG | SEEN_BAIL;
+				t_offset = func - (image + addrs[i]);
+				if (is_imm8(K)) {
+					EMIT3(0x8d, 0x73, K); /* lea imm8(%rbx), %esi */
+				} else {
+					EMIT2(0x8d, 0xb3); /* lea imm32(%rbx),%esi */
+					EMIT(K, 4);
+				}
+				/*
+				 * An offset computed into the ancillary area
+				 * gets ancillary data from the interpreter,
+				 * let it deal with this packet.
+				 */
+				EMIT2(0x8d, 0x8e);	/* lea 0x1000(%rsi),%ecx */
+				EMIT(-SKF_AD_OFF, 4);
+				EMIT2(0x81, 0xf9);	/* cmp $0x1000,%ecx */
+				EMIT(-SKF_AD_OFF, 4);
+				/* the call (5 bytes) follows this jump */
+				EMIT_COND_JMP(X86_JB, bail_addr - (addrs[i] - 5));
+				EMIT1_off32(0xe8, t_offset);	/* call sk_load_xxx */
+				break;
+			case BPF_LD | BPF_H | BPF_IND:
+				func = sk_load_half;
+				goto common_load_ind;
+			case BPF_LD | BPF_B | BPF_IND:
+				func = sk_load_byte;
+				goto common_load_ind;
+			case BPF_JMP | BPF_JA:
+				t_offset = addrs[i + K] - addrs[i];
+				EMIT_JMP(t_offset);
+				break;
+			COND_SEL(BPF_JMP | BPF_JGT | BPF_K, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP | BPF_JGE | BPF_K, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP | BPF_JEQ | BPF_K, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP | BPF_JSET | BPF_K, X86_JNE, X86_JE);
+			COND_SEL(BPF_JMP | BPF_JGT | BPF_X, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP | BPF_JGE | BPF_X, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP | BPF_JEQ | BPF_X, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP | BPF_JSET | BPF_X, X86_JNE, X86_JE);
+
+cond_branch:			f_offset = addrs[i + filter[i].jf] - addrs[i];
+				t_offset = addrs[i + filter[i].jt] - addrs[i];
+
+				/* same targets, can avoid doing the test :) */
+				if (filter[i].jt == filter[i].jf) {
+					EMIT_JMP(t_offset);
+					break;
+				}
+
+				switch (filter[i].code) {
+				case BPF_JMP | BPF_JGT | BPF_X:
+				case BPF_JMP | BPF_JGE | BPF_X:
+				case BPF_JMP | BPF_JEQ | BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x39, 0xd8); /* cmp %ebx,%eax */
+					break;
+				case BPF_JMP | BPF_JSET | BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x85, 0xd8); /* test %ebx,%eax */
+					break;
+				case BPF_JMP | BPF_JEQ | BPF_K:
+					if (K == 0) {
+						EMIT2(0x85, 0xc0); /* test   %eax,%eax */
+						break;
+					}
+					/* fallinto */
+				case BPF_JMP | BPF_JGT | BPF_K:
+				case BPF_JMP | BPF_JGE | BPF_K:
+					if (K <= 127)
+						EMIT3(0x83, 0xf8, K); /* cmp imm8,%eax */
+					else
+						EMIT1_off32(0x3d, K); /* cmp imm32,%eax */
+					break;
+				case BPF_JMP | BPF_JSET | BPF_K:
+					if (K <= 0xFF)
+						EMIT2(0xa8, K); /* test imm8,%al */
+					else if (!(K & 0xFFFF00FF))
+						EMIT3(0xf6, 0xc4, K >> 8); /* test imm8,%ah */
+					else if (K <= 0xFFFF) {
+						EMIT2(0x66, 0xa9); /* test imm16,%ax */
+						EMIT(K, 2);
+					} else {
+						EMIT1_off32(0xa9, K); /* test imm32,%eax */
+					}
+					break;
+				}
+				if (filter[i].jt != 0) {
+					if (filter[i].jf && f_offset)
+						t_offset += is_near(f_offset) ? 2 : 5;
+					EMIT_COND_JMP(t_op, t_offset);
+					if (filter[i].jf)
+						EMIT_JMP(f_offset);
+					break;
+				}
+				EMIT_COND_JMP(f_op, f_offset);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+			goto next;
+
+ancillary:
+			switch (K - SKF_AD_OFF) {
+			case SKF_AD_PROTOCOL: /* A = ntohs(skb->protocol); */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, protocol) != 2);
+				if (is_imm8(offsetof(struct sk_buff, protocol))) {
+					/* movzwl off8(%rdi),%eax */
+					EMIT4(0x0f, 0xb7, 0x47, offsetof(struct sk_buff, protocol));
+				} else {
+					EMIT3(0x0f, 0xb7, 0x87); /* movzwl off32(%rdi),%eax */
+					EMIT(offsetof(struct sk_buff, protocol), 4);
+				}
+				EMIT2(0x86, 0xc4); /* ntohs() : xchg   %al,%ah */
+				break;
+			case SKF_AD_IFINDEX: /* A = skb->dev->ifindex; */
+				seen |= SEEN_RET0;
+				if (is_imm8(offsetof(struct sk_buff, dev))) {
+					/* movq off8(%rdi),%rax */
+					EMIT4(0x48, 0x8b, 0x47, offsetof(struct sk_buff, dev));
+				} else {
+					EMIT3(0x48, 0x8b, 0x87); /* movq off32(%rdi),%rax */
+					EMIT(offsetof(struct sk_buff, dev), 4);
+				}
+				EMIT3(0x48, 0x85, 0xc0);	/* test %rax,%rax */
+				/* the mov (6 bytes) follows this jump */
+				EMIT_COND_JMP(X86_JE, ret0_addr - (addrs[i] - 6));
+				BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+				EMIT2(0x8b, 0x80);	/* mov off32(%rax),%eax */
+				EMIT(offsetof(struct net_device, ifindex), 4);
+				break;
+			case SKF_AD_MARK: /* A = skb->mark; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+				EMIT_SKB_LOAD(0, 0x47, mark); /* mov off(%rdi),%eax */
+				break;
+			case SKF_AD_PKTTYPE:
+			case SKF_AD_QUEUE:
+			case SKF_AD_NLATTR:
+			case SKF_AD_NLATTR_NEST:
+				/* bitfields and netlink parsing : leave
+				 * these to the interpreter
+				 */
+				goto out;
+			default:
+				/* unknown ancillary data : return 0 */
+				seen |= SEEN_RET0;
+				EMIT_JMP(ret0_addr - addrs[i]);
+				break;
+			}
+next:
+			ilen = prog - temp;
+			if (image) {
+				if (unlikely(proglen + ilen > oldproglen)) {
+					pr_err("bpb_jit_compile fatal error\n");
+					kfree(addrs);
+					module_free(NULL, image);
+					return;
+				}
+				memcpy(image + proglen, temp, ilen);
+			}
+			proglen += ilen;
+			addrs[i] = proglen;
+			prog = temp;
+		}
+
+		/*
+		 * Epilogue, followed by the "return 0" stub and the
+		 * interpreter fallback when the filter needs them.
+		 * The last bpf instruction is always a RET, which
+		 * falls through into the epilogue.
+		 */
+		cleanup_addr = proglen;
+		if (seen_or_pass0) {
+			if (seen_or_pass0 & (SEEN_XREG | SEEN_DATAREF))
+				EMIT4(0x48, 0x8b, 0x5d, 0xf8);  /* mov  -8(%rbp),%rbx */
+			EMIT1(0xc9);		/* leaveq */
+		}
+		EMIT1(0xc3);			/* ret */
+		ret0_addr = proglen + (prog - temp);
+		if (seen_or_pass0 & SEEN_RET0) {
+			CLEAR_A();
+			EMIT_JMP(cleanup_addr - (proglen + (prog - temp) + 2));
+		}
+		bail_addr = proglen + (prog - temp);
+		if (seen_or_pass0 & SEEN_BAIL) {
+			EMIT4(0x48, 0x8b, 0x5d, 0xf8);  /* mov  -8(%rbp),%rbx */
+			EMIT1(0xc9);		/* leaveq */
+			/* movabs $insns,%rsi */
+			EMIT2(0x48, 0xbe);
+			EMIT((unsigned long)filter, 4);
+			EMIT((unsigned long)filter >> 32, 4);
+			EMIT1_off32(0xba, flen);	/* mov $flen,%edx */
+			t_offset = (u8 *)sk_run_filter -
+				   (image + proglen + (prog - temp) + 5);
+			EMIT1_off32(0xe9, t_offset);	/* jmp sk_run_filter */
+		}
+		ilen = prog - temp;
+		if (image) {
+			if (unlikely(proglen + ilen > oldproglen)) {
+				pr_err("bpb_jit_compile fatal error\n");
+				kfree(addrs);
+				module_free(NULL, image);
+				return;
+			}
+			memcpy(image + proglen, temp, ilen);
+		}
+		proglen += ilen;
+
+		if (image) {
+			if (WARN_ON(proglen != oldproglen)) {
+				module_free(NULL, image);
+				goto out;
+			}
+			break;
+		}
+		if (proglen == oldproglen) {
+			image = module_alloc(max_t(unsigned int,
+						   proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+	}
+	if (bpf_jit_enable > 1)
+		bpf_jit_dump(flen, proglen, pass, image);
+
+	if (image) {
+		flush_icache_range((unsigned long)image,
+				   (unsigned long)(image + proglen));
+		fp->bpf_func = (void *)image;
+	}
+out:
+	kfree(addrs);
+	return;
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/**
+ * bpf_jit_free - release the code generated for a filter
+ * @fp: filter being freed
+ *
+ * Filters are released from RCU callbacks, where module_free() cannot be
+ * called. The image is no longer used by then, so its first bytes serve
+ * as the work_struct that frees it from process context.
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
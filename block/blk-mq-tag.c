@@ -0,0 +1,142 @@
+/*
+ * Tag allocation for multiqueue hardware contexts
+ *
+ * Unlike the generic blk-tag code, this does not need the queue lock. A
+ * tag is claimed with an atomic test-and-set on the busy bitmap, and each
+ * cpu starts its search from where it last succeeded, so that cpus
+ * allocating at the same time tend to work on different words of the map.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/blkdev.h>
+
+#include "blk-mq.h"
+
+struct blk_mq_tags {
+	unsigned int nr_tags;
+	unsigned long *busy_map;
+	unsigned int __percpu *hint;
+	wait_queue_head_t wait;
+};
+
+static unsigned int __blk_mq_find_tag(unsigned long *map, unsigned int from,
+				      unsigned int to)
+{
+	unsigned int tag = from;
+
+	while ((tag = find_next_zero_bit(map, to, tag)) < to) {
+		if (!test_and_set_bit_lock(tag, map))
+			return tag;
+		tag++;
+	}
+
+	return BLK_MQ_TAG_FAIL;
+}
+
+static unsigned int __blk_mq_get_tag(struct blk_mq_tags *tags)
+{
+	unsigned int *hint, start, tag;
+
+	hint = per_cpu_ptr(tags->hint, raw_smp_processor_id());
+	start = *hint;
+	if (start >= tags->nr_tags)
+		start = 0;
+
+	tag = __blk_mq_find_tag(tags->busy_map, start, tags->nr_tags);
+	if (tag == BLK_MQ_TAG_FAIL && start)
+		tag = __blk_mq_find_tag(tags->busy_map, 0, start);
+
+	if (tag != BLK_MQ_TAG_FAIL)
+		*hint = tag + 1;
+	return tag;
+}
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	the tag map to allocate from
+ * @gfp:	allocation mask, we sleep for a free tag if it has __GFP_WAIT
+ *
+ * Returns a tag in the range [0, nr_tags) or %BLK_MQ_TAG_FAIL if none
+ * was free and the caller did not want to wait.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp)
+{
+	unsigned int tag;
+
+	tag = __blk_mq_get_tag(tags);
+	if (tag != BLK_MQ_TAG_FAIL || !(gfp & __GFP_WAIT))
+		return tag;
+
+	wait_event(tags->wait, (tag = __blk_mq_get_tag(tags)) != BLK_MQ_TAG_FAIL);
+	return tag;
+}
+
+/**
+ * blk_mq_put_tag - release a tag
+ * @tags:	the tag map the tag was allocated from
+ * @tag:	the tag
+ */
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit_unlock(tag, tags->busy_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return bitmap_weight(tags->busy_map, tags->nr_tags);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int cpu;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->busy_map = kzalloc_node(BITS_TO_LONGS(nr_tags) * sizeof(long),
+				      GFP_KERNEL, node);
+	if (!tags->busy_map)
+		goto err_free;
+
+	tags->hint = alloc_percpu(unsigned int);
+	if (!tags->hint)
+		goto err_map;
+
+	/*
+	 * Spread the starting points so that cpus don't all begin by
+	 * fighting over the first word of the map.
+	 */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tags->hint, cpu) =
+			(cpu * BITS_PER_LONG) % nr_tags;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+	return tags;
+
+err_map:
+	kfree(tags->busy_map);
+err_free:
+	kfree(tags);
+	return NULL;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	WARN_ON(find_first_bit(tags->busy_map, tags->nr_tags) < tags->nr_tags);
+
+	free_percpu(tags->hint);
+	kfree(tags->busy_map);
+	kfree(tags);
+}
@@ -0,0 +1,747 @@
+/*
+ * Block multiqueue core code
+ *
+ * Instead of funneling every request through q->queue_lock and the
+ * elevator, a multiqueue request_queue stages requests on per-cpu software
+ * queues and dispatches them to a set of hardware contexts that each own a
+ * private tag space and request pool. Submitting cpus only share state
+ * with the other cpus mapped to the same hardware context.
+ *
+ * Queues set up this way bypass the I/O scheduler and the block layer
+ * request timeout handling, drivers that need a timeout must keep track of
+ * it themselves. Barriers are only supported for devices that order by tag.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/backing-dev.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+/*
+ * Don't search further back than this for a request to merge a new bio
+ * into, the software queues are supposed to be short.
+ */
+#define BLK_MQ_MERGE_MAX	8
+
+/**
+ * blk_mq_free_request - release a multiqueue request
+ * @rq:		the request
+ *
+ * Returns the tag of @rq to the hardware context it was allocated from.
+ * Normally reached through __blk_put_request() once the last reference
+ * is dropped.
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	rq->mq_ctx = NULL;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx,
+					      int rw_flags, gfp_t gfp)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, gfp);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request from a multiqueue queue
+ * @q:		the queue
+ * @rw:		READ or WRITE
+ * @gfp:	allocation mask, may sleep for a free tag if it has __GFP_WAIT
+ *
+ * The request is taken from the hardware context the calling cpu maps to.
+ * This is what blk_get_request() hands out for multiqueue queues.
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+
+	ctx = __blk_mq_get_ctx(q, get_cpu());
+	put_cpu();
+
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	return __blk_mq_alloc_request(hctx, ctx, rw, gfp);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_end_io - complete a multiqueue request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Ends I/O on all of @rq and releases it. Unlike blk_end_request() this
+ * does not touch the queue lock and may be called from any context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		__blk_put_request(rq->q, rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_issue(q, rq);
+
+	rq->cmd_flags |= REQ_STARTED;
+	rq->resid_len = blk_rq_bytes(rq);
+}
+
+static void blk_mq_requeue_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_requeue(q, rq);
+
+	rq->cmd_flags &= ~REQ_STARTED;
+}
+
+/*
+ * Pull everything off the software queues mapped to @hctx and feed it to
+ * the driver. Whatever the driver can't take right now is parked on
+ * hctx->dispatch and goes out first on the next run.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock_irq(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irq(&ctx->lock);
+	}
+
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock_irq(&hctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			blk_mq_requeue_request(rq);
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		default:
+			printk(KERN_ERR "blk-mq: bad return on queue: %d\n",
+			       ret);
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			rq->errors = -EIO;
+			blk_mq_end_io(rq, -EIO);
+			continue;
+		}
+
+		break;
+	}
+
+	if (!list_empty(&rq_list)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irq(&hctx->lock);
+	}
+}
+
+static inline int blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx ||
+		!list_empty_careful(&hctx->dispatch);
+}
+
+/*
+ * Only one cpu runs a given hardware context at a time. Anyone finding it
+ * busy has already flagged its software queue in ctx_map, and the owner
+ * checks for pending work again after letting go, so no request is left
+ * behind. This relies on ->queue_rq() stopping the hardware context when
+ * it returns BLK_MQ_RQ_QUEUE_BUSY, or we would keep retrying right away.
+ */
+static void blk_mq_process_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	while (!test_bit(BLK_MQ_S_STOPPED, &hctx->state) &&
+	       !test_and_set_bit_lock(BLK_MQ_S_RUNNING, &hctx->state)) {
+		__blk_mq_run_hw_queue(hctx);
+
+		clear_bit_unlock(BLK_MQ_S_RUNNING, &hctx->state);
+		smp_mb__after_clear_bit();
+
+		if (!blk_mq_hctx_has_pending(hctx))
+			break;
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	blk_mq_process_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware context
+ * @hctx:	the hardware context
+ * @async:	punt the dispatch to kblockd instead of doing it inline
+ *
+ * Dispatch is also punted if the calling cpu does not map to @hctx, so
+ * that the driver sees submissions from the cpus it was set up for.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, int async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask))
+		blk_mq_process_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, int async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (blk_mq_hctx_has_pending(hctx))
+			blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware context
+ * @hctx:	the hardware context
+ *
+ * The multiqueue counterpart of blk_stop_queue(), typically called from
+ * ->queue_rq() when the device is out of resources.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart stopped hardware contexts
+ * @q:		the queue
+ * @async:	must be set when called from interrupt context
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, int async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, int at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	unsigned long flags;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	/*
+	 * Pairs with the barrier in blk_mq_process_hw_queue(), the running
+	 * cpu must see our bit once we fail to grab the hardware context.
+	 */
+	set_bit(ctx->index_hw, hctx->ctx_map);
+	smp_mb();
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request for execution
+ * @q:		the queue
+ * @rq:		request allocated with blk_mq_alloc_request()
+ * @at_head:	insert at the head of the software queue
+ * @run_queue:	kick the hardware context afterwards
+ */
+void blk_mq_insert_request(struct request_queue *q, struct request *rq,
+			   int at_head, int run_queue)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	__blk_mq_insert_request(hctx, rq, at_head);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, 0);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to merge @bio into one of the requests still waiting on the
+ * software queue of this cpu. These have not been handed to the driver
+ * yet, so the ctx lock is all that is needed.
+ */
+static int blk_mq_attempt_merge(struct request_queue *q,
+				struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = BLK_MQ_MERGE_MAX;
+	int merged = 0;
+
+	spin_lock_irq(&ctx->lock);
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+
+		if (!elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector) {
+			if (!ll_back_merge_fn(q, rq, bio))
+				break;
+			blk_rq_bio_merge_back(rq, bio);
+			merged = 1;
+			break;
+		} else if (blk_rq_pos(rq) - bio_sectors(bio) == bio->bi_sector) {
+			if (!ll_front_merge_fn(q, rq, bio))
+				break;
+			blk_rq_bio_merge_front(rq, bio);
+			merged = 1;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->lock);
+
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool sync = bio_rw_flagged(bio, BIO_RW_SYNCIO);
+	const bool unplug = bio_rw_flagged(bio, BIO_RW_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	if (bio_rw_flagged(bio, BIO_RW_BARRIER) &&
+	    !(q->next_ordered & QUEUE_ORDERED_BY_TAG)) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	ctx = __blk_mq_get_ctx(q, get_cpu());
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    !bio_rw_flagged(bio, BIO_RW_BARRIER) &&
+	    blk_mq_attempt_merge(q, ctx, bio)) {
+		put_cpu();
+		return 0;
+	}
+	put_cpu();
+
+	rw_flags = bio_data_dir(bio);
+	if (sync)
+		rw_flags |= REQ_RW_SYNC;
+
+	trace_block_getrq(q, bio, bio_data_dir(bio));
+
+	/*
+	 * May sleep for a tag, but can not fail. The request stays tied to
+	 * the software queue it was allocated on even if we move cpus.
+	 */
+	rq = __blk_mq_alloc_request(hctx, ctx, rw_flags, GFP_NOIO);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	__blk_mq_insert_request(hctx, rq, 0);
+
+	/*
+	 * There's no plugging here, async I/O is left for kblockd to pick up
+	 * which gives it a chance to merge on the software queue.
+	 */
+	blk_mq_run_hw_queue(hctx, !sync && !unplug);
+	return 0;
+}
+
+/*
+ * Spread the possible cpus evenly over the hardware queues, keeping
+ * neighbouring cpu numbers on the same queue.
+ */
+static void blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		map[cpu] = (cpu * nr_queues) / nr_cpu_ids;
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware context mapping
+ * @q:		the queue
+ * @cpu:	the cpu whose software queue is being mapped
+ *
+ * Drivers without special requirements can use this as ->map_queue().
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, &hctx->page_list, lru) {
+		list_del(&page->lru);
+		__free_pages(page, page->private);
+	}
+
+	kfree(hctx->rqs);
+	hctx->rqs = NULL;
+
+	if (hctx->tags)
+		blk_mq_free_tags(hctx->tags);
+	hctx->tags = NULL;
+}
+
+static size_t order_to_size(unsigned int order)
+{
+	return (size_t) PAGE_SIZE << order;
+}
+
+/*
+ * Requests are carved out of a few high order allocations rather than
+ * one big one, falling back to smaller chunks if memory is fragmented.
+ */
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      unsigned int depth, int node)
+{
+	const unsigned int max_order = 4;
+	unsigned int i, j, rq_size, entries;
+	size_t left;
+
+	INIT_LIST_HEAD(&hctx->page_list);
+
+	hctx->rqs = kmalloc_node(depth * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	rq_size = round_up(sizeof(struct request) + hctx->cmd_size,
+			   cache_line_size());
+	left = rq_size * depth;
+
+	for (i = 0; i < depth; ) {
+		unsigned int this_order = max_order;
+		struct page *page;
+		void *p;
+
+		while (this_order && left < order_to_size(this_order - 1))
+			this_order--;
+
+		for (;;) {
+			page = alloc_pages_node(node, GFP_KERNEL, this_order);
+			if (page || !this_order)
+				break;
+			this_order--;
+			if (order_to_size(this_order) < rq_size)
+				break;
+		}
+
+		if (!page)
+			goto fail;
+
+		page->private = this_order;
+		list_add_tail(&page->lru, &hctx->page_list);
+
+		p = page_address(page);
+		entries = min_t(unsigned int,
+				order_to_size(this_order) / rq_size,
+				depth - i);
+		left -= entries * rq_size;
+
+		for (j = 0; j < entries; j++, i++) {
+			hctx->rqs[i] = p;
+			blk_rq_init(hctx->queue, hctx->rqs[i]);
+			p += rq_size;
+		}
+	}
+
+	hctx->tags = blk_mq_init_tags(depth, node);
+	if (!hctx->tags)
+		goto fail;
+
+	hctx->queue_depth = depth;
+	return 0;
+
+fail:
+	blk_mq_free_rq_map(hctx);
+	return -ENOMEM;
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q,
+				  unsigned int nr_queues)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; i < nr_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!hctx)
+			continue;
+		if (hctx->tags)
+			blk_mq_free_rq_map(hctx);
+		kfree(hctx->ctx_map);
+		kfree(hctx->ctxs);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+		q->queue_hw_ctx[i] = NULL;
+	}
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i, j;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			goto err;
+		q->queue_hw_ctx[i] = hctx;
+
+		if (!zalloc_cpumask_var(&hctx->cpumask, GFP_KERNEL))
+			goto err;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+		hctx->cmd_size = reg->cmd_size;
+		hctx->numa_node = reg->numa_node;
+		hctx->driver_data = driver_data;
+
+		hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, reg->numa_node);
+		if (!hctx->ctxs)
+			goto err;
+
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, reg->numa_node);
+		if (!hctx->ctx_map)
+			goto err;
+
+		if (blk_mq_init_rq_map(hctx, reg->queue_depth, reg->numa_node))
+			goto err;
+	}
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		if (!reg->ops->init_hctx)
+			break;
+		if (reg->ops->init_hctx(q->queue_hw_ctx[i], driver_data, i))
+			goto err_exit;
+	}
+
+	q->nr_hw_queues = reg->nr_hw_queues;
+	return 0;
+
+err_exit:
+	for (j = 0; j < i; j++)
+		if (reg->ops->exit_hctx)
+			reg->ops->exit_hctx(q->queue_hw_ctx[j], j);
+err:
+	blk_mq_free_hw_queues(q, reg->nr_hw_queues);
+	return -ENOMEM;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = __blk_mq_get_ctx(q, cpu);
+
+		memset(ctx, 0, sizeof(*ctx));
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, cpu);
+		cpumask_set_cpu(cpu, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - allocate a multiqueue request queue
+ * @reg:	description of the hardware queues and driver callbacks
+ * @driver_data: passed to ->init_hctx() and stored in each hctx
+ *
+ * Description:
+ *    The multiqueue counterpart of blk_init_queue(). Requests are handed
+ *    to ->queue_rq() without going through q->queue_lock, and are
+ *    completed with blk_mq_end_io(). As with blk_init_queue(), the queue
+ *    is released with blk_cleanup_queue().
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth)
+		return ERR_PTR(-EINVAL);
+
+	if (reg->queue_depth > BLK_MQ_MAX_DEPTH) {
+		printk(KERN_ERR "blk-mq: queue depth too large (%u), "
+				"reduced to %u\n", reg->queue_depth,
+				BLK_MQ_MAX_DEPTH);
+		reg->queue_depth = BLK_MQ_MAX_DEPTH;
+	}
+
+	if (reg->nr_hw_queues > nr_cpu_ids)
+		reg->nr_hw_queues = nr_cpu_ids;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	q->node = reg->numa_node;
+	q->mq_ops = reg->ops;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	blk_mq_update_queue_map(q->mq_map, reg->nr_hw_queues);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err;
+
+	blk_mq_init_cpu_queues(q);
+
+	q->queue_flags = QUEUE_FLAG_DEFAULT;
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth;
+	q->sg_reserved_size = INT_MAX;
+
+	return q;
+
+err:
+	blk_mq_free_queue(q);
+	blk_put_queue(q);
+	return ERR_PTR(-ENOMEM);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called when the last reference to the queue is dropped.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_work_sync(&hctx->run_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+
+	blk_mq_free_hw_queues(q, q->nr_hw_queues);
+
+	free_percpu(q->queue_ctx);
+	kfree(q->queue_hw_ctx);
+	kfree(q->mq_map);
+
+	q->queue_ctx = NULL;
+	q->queue_hw_ctx = NULL;
+	q->mq_map = NULL;
+	q->nr_hw_queues = 0;
+	q->mq_ops = NULL;
+}
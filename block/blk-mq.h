@@ -0,0 +1,36 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software submission queue. Requests are staged here by the
+ * submitting cpu and pulled off in batches when the hardware context
+ * they map to is run.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock ____cacheline_aligned_in_smp;
+	struct list_head	rq_list;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+
+	struct request_queue	*queue;
+};
+
+static inline struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+						  unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Tag allocation, see blk-mq-tag.c
+ */
+#define BLK_MQ_TAG_FAIL		((unsigned int) -1)
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags);
+
+#endif
@@ -16,6 +16,10 @@ void blk_rq_bio_prep(struct request_queue *q, struct request *rq,
 int blk_rq_append_bio(struct request_queue *q, struct request *rq,
 		      struct bio *bio);
 void blk_dequeue_request(struct request *rq);
+void blk_rq_bio_merge_back(struct request *req, struct bio *bio);
+void blk_rq_bio_merge_front(struct request *req, struct bio *bio);
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
 void __blk_queue_free_tags(struct request_queue *q);
 
 void blk_unplug_work(struct work_struct *work);
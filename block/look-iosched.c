@@ -1,121 +1,474 @@
 /*
- * elevator noop
+ *  LOOK / C-LOOK i/o scheduler.
+ *
+ *  Requests are kept in a single sector sorted tree and served in the
+ *  order the disk head sweeps across them, either back and forth (LOOK)
+ *  or always upwards, jumping back to the lowest pending sector at the end
+ *  of each sweep (C-LOOK). A per direction FIFO guards against starvation
+ *  of requests far away from the head.
+ *
+ *  See Documentation/block/look-iosched.txt
  */
+#include <linux/kernel.h>
+#include <linux/fs.h>
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
 
-struct noop_data {
-	struct list_head queue;
+static const int read_expire = HZ / 2;	/* max time before a read is submitted */
+static const int write_expire = 5 * HZ;	/* ditto for writes, SOFT limits */
+static const int fifo_batch = 16;	/* requests served in sweep order
+					   before the fifos are looked at */
+static const int dispatch_batch = 4;	/* requests moved per dispatch */
+
+enum {
+	LOOK_SWEEP_UP,
+	LOOK_SWEEP_DOWN,
 };
 
-static void noop_merged_requests(struct request_queue *q, struct request *rq,
-				 struct request *next)
+struct look_data {
+	/*
+	 * run time data
+	 */
+
+	/*
+	 * requests are present on both sort_list and fifo_list
+	 */
+	struct rb_root sort_list;
+	struct list_head fifo_list[2];
+
+	sector_t head_sector;		/* where the last dispatch ended */
+	int direction;			/* LOOK_SWEEP_* */
+	unsigned int batching;		/* requests served since fifo check */
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[2];
+	int fifo_batch;
+	int dispatch_batch;
+	int circular;
+	int front_merges;
+};
+
+static void look_move_request(struct look_data *, struct request *);
+
+static void look_add_rq_rb(struct look_data *ld, struct request *rq)
+{
+	struct request *__alias;
+
+	while (unlikely(__alias = elv_rb_add(&ld->sort_list, rq)))
+		look_move_request(ld, __alias);
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void look_add_request(struct request_queue *q, struct request *rq)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+
+	look_add_rq_rb(ld, rq);
+
+	rq_set_fifo_time(rq, jiffies + ld->fifo_expire[data_dir]);
+	list_add_tail(&rq->queuelist, &ld->fifo_list[data_dir]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void look_remove_request(struct look_data *ld, struct request *rq)
+{
+	rq_fifo_clear(rq);
+	elv_rb_del(&ld->sort_list, rq);
+}
+
+static int
+look_merge(struct request_queue *q, struct request **req, struct bio *bio)
 {
-	list_del_init(&next->queuelist);
+	struct look_data *ld = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * back merges are found through the elevator hash, we only
+	 * need to look for front merges here
+	 */
+	if (ld->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&ld->sort_list, sector);
+		if (__rq && elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
 }
 
-static int noop_dispatch(struct request_queue *q, int force)
+static void look_merged_request(struct request_queue *q,
+				struct request *req, int type)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct look_data *ld = q->elevator->elevator_data;
 
-	if (!list_empty(&nd->queue)) {
-		struct request *rq;
-		rq = list_entry(nd->queue.next, struct request, queuelist);
-		list_del_init(&rq->queuelist);
-		elv_dispatch_sort(q, rq);
-		return 1;
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(&ld->sort_list, req);
+		look_add_rq_rb(ld, req);
 	}
-	return 0;
 }
 
-static void noop_add_request(struct request_queue *q, struct request *rq)
+static void
+look_merged_requests(struct request_queue *q, struct request *req,
+		     struct request *next)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct look_data *ld = q->elevator->elevator_data;
 
-	list_add_tail(&rq->queuelist, &nd->queue);
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	look_remove_request(ld, next);
 }
 
-static int noop_queue_empty(struct request_queue *q)
+/*
+ * take rq off the sort and fifo lists, move it to the dispatch queue and
+ * advance the head past it
+ */
+static void look_move_request(struct look_data *ld, struct request *rq)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct request_queue *q = rq->q;
 
-	return list_empty(&nd->queue);
+	ld->head_sector = rq_end_sector(rq);
+
+	look_remove_request(ld, rq);
+	elv_dispatch_add_tail(q, rq);
 }
 
-static struct request *
-noop_former_request(struct request_queue *q, struct request *rq)
+/*
+ * first request at or above @sector, NULL if there is none
+ */
+static struct request *look_find_ceiling(struct look_data *ld, sector_t sector)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct rb_node *n = ld->sort_list.rb_node;
+	struct request *rq, *best = NULL;
 
-	if (rq->queuelist.prev == &nd->queue)
-		return NULL;
-	return list_entry(rq->queuelist.prev, struct request, queuelist);
+	while (n) {
+		rq = rb_entry_rq(n);
+
+		if (blk_rq_pos(rq) >= sector) {
+			best = rq;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	return best;
 }
 
-static struct request *
-noop_latter_request(struct request_queue *q, struct request *rq)
+/*
+ * last request below @sector, NULL if there is none
+ */
+static struct request *look_find_floor(struct look_data *ld, sector_t sector)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct rb_node *n = ld->sort_list.rb_node;
+	struct request *rq, *best = NULL;
 
-	if (rq->queuelist.next == &nd->queue)
-		return NULL;
-	return list_entry(rq->queuelist.next, struct request, queuelist);
+	while (n) {
+		rq = rb_entry_rq(n);
+
+		if (blk_rq_pos(rq) < sector) {
+			best = rq;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+
+	return best;
 }
 
-static void *noop_init_queue(struct request_queue *q)
+/*
+ * the request the sweep reaches next from the current head position,
+ * turning around (LOOK) or wrapping to the lowest sector (C-LOOK) when
+ * nothing is left in the direction we are going
+ */
+static struct request *look_next_request(struct look_data *ld)
 {
-	struct noop_data *nd;
+	struct request *rq;
+
+	if (ld->direction == LOOK_SWEEP_UP) {
+		rq = look_find_ceiling(ld, ld->head_sector);
+		if (rq)
+			return rq;
+
+		if (ld->circular)
+			return rb_entry_rq(rb_first(&ld->sort_list));
 
-	nd = kmalloc_node(sizeof(*nd), GFP_KERNEL, q->node);
-	if (!nd)
+		ld->direction = LOOK_SWEEP_DOWN;
+		return rb_entry_rq(rb_last(&ld->sort_list));
+	}
+
+	rq = look_find_floor(ld, ld->head_sector);
+	if (rq)
+		return rq;
+
+	ld->direction = LOOK_SWEEP_UP;
+	return rb_entry_rq(rb_first(&ld->sort_list));
+}
+
+/*
+ * the neighbour of @rq in the current sweep direction, without turning
+ */
+static struct request *look_sweep_neighbour(struct look_data *ld,
+					    struct request *rq)
+{
+	struct rb_node *n;
+
+	if (ld->direction == LOOK_SWEEP_UP)
+		n = rb_next(&rq->rb_node);
+	else
+		n = rb_prev(&rq->rb_node);
+
+	return n ? rb_entry_rq(n) : NULL;
+}
+
+/*
+ * return the request that has waited longest past its expiry time, if
+ * any request has expired at all
+ */
+static struct request *look_expired_request(struct look_data *ld)
+{
+	struct request *rq, *oldest = NULL;
+	int data_dir;
+
+	for (data_dir = READ; data_dir <= WRITE; data_dir++) {
+		if (list_empty(&ld->fifo_list[data_dir]))
+			continue;
+
+		rq = rq_entry_fifo(ld->fifo_list[data_dir].next);
+		if (!time_after(jiffies, rq_fifo_time(rq)))
+			continue;
+
+		if (!oldest || time_before(rq_fifo_time(rq),
+					   rq_fifo_time(oldest)))
+			oldest = rq;
+	}
+
+	return oldest;
+}
+
+static int look_dispatch_requests(struct request_queue *q, int force)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+	struct request *rq, *next;
+	int dispatched = 0;
+
+	if (RB_EMPTY_ROOT(&ld->sort_list))
+		return 0;
+
+	if (unlikely(force)) {
+		while (!RB_EMPTY_ROOT(&ld->sort_list)) {
+			look_move_request(ld, look_next_request(ld));
+			dispatched++;
+		}
+		ld->batching = 0;
+		return dispatched;
+	}
+
+	rq = NULL;
+	if (ld->batching >= ld->fifo_batch) {
+		/*
+		 * A request has waited too long, go and serve it and carry
+		 * on sweeping upwards from there.
+		 */
+		rq = look_expired_request(ld);
+		if (rq)
+			ld->direction = LOOK_SWEEP_UP;
+		ld->batching = 0;
+	}
+
+	if (!rq)
+		rq = look_next_request(ld);
+
+	/*
+	 * Move a batch of requests that follow each other in the current
+	 * sweep. A batch never turns around or wraps, so the dispatch queue
+	 * always holds a single pass over one region of the disk.
+	 */
+	do {
+		next = look_sweep_neighbour(ld, rq);
+		look_move_request(ld, rq);
+		ld->batching++;
+		dispatched++;
+		rq = next;
+	} while (rq && dispatched < ld->dispatch_batch);
+
+	return dispatched;
+}
+
+static int look_queue_empty(struct request_queue *q)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+
+	return RB_EMPTY_ROOT(&ld->sort_list);
+}
+
+static void look_exit_queue(struct elevator_queue *e)
+{
+	struct look_data *ld = e->elevator_data;
+
+	BUG_ON(!list_empty(&ld->fifo_list[READ]));
+	BUG_ON(!list_empty(&ld->fifo_list[WRITE]));
+
+	kfree(ld);
+}
+
+/*
+ * initialize elevator private data (look_data).
+ */
+static void *look_init_queue(struct request_queue *q)
+{
+	struct look_data *ld;
+
+	ld = kmalloc_node(sizeof(*ld), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!ld)
 		return NULL;
-	INIT_LIST_HEAD(&nd->queue);
-	return nd;
+
+	INIT_LIST_HEAD(&ld->fifo_list[READ]);
+	INIT_LIST_HEAD(&ld->fifo_list[WRITE]);
+	ld->sort_list = RB_ROOT;
+	ld->direction = LOOK_SWEEP_UP;
+	ld->fifo_expire[READ] = read_expire;
+	ld->fifo_expire[WRITE] = write_expire;
+	ld->fifo_batch = fifo_batch;
+	ld->dispatch_batch = dispatch_batch;
+	ld->circular = 1;
+	ld->front_merges = 1;
+	return ld;
 }
 
-static void noop_exit_queue(struct elevator_queue *e)
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+look_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+look_var_store(int *var, const char *page, size_t count)
 {
-	struct noop_data *nd = e->elevator_data;
+	char *p = (char *) page;
 
-	BUG_ON(!list_empty(&nd->queue));
-	kfree(nd);
+	*var = simple_strtol(p, &p, 10);
+	return count;
 }
 
-static struct elevator_type elevator_noop = {
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct look_data *ld = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return look_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(look_read_expire_show, ld->fifo_expire[READ], 1);
+SHOW_FUNCTION(look_write_expire_show, ld->fifo_expire[WRITE], 1);
+SHOW_FUNCTION(look_fifo_batch_show, ld->fifo_batch, 0);
+SHOW_FUNCTION(look_dispatch_batch_show, ld->dispatch_batch, 0);
+SHOW_FUNCTION(look_circular_show, ld->circular, 0);
+SHOW_FUNCTION(look_front_merges_show, ld->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct look_data *ld = e->elevator_data;			\
+	int __data;							\
+	int ret = look_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(look_read_expire_store, &ld->fifo_expire[READ], 0, INT_MAX, 1);
+STORE_FUNCTION(look_write_expire_store, &ld->fifo_expire[WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(look_fifo_batch_store, &ld->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(look_dispatch_batch_store, &ld->dispatch_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(look_circular_store, &ld->circular, 0, 1, 0);
+STORE_FUNCTION(look_front_merges_store, &ld->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+#define LOOK_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, look_##name##_show, \
+				      look_##name##_store)
+
+static struct elv_fs_entry look_attrs[] = {
+	LOOK_ATTR(read_expire),
+	LOOK_ATTR(write_expire),
+	LOOK_ATTR(fifo_batch),
+	LOOK_ATTR(dispatch_batch),
+	LOOK_ATTR(circular),
+	LOOK_ATTR(front_merges),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_look = {
 	.ops = {
-		.elevator_merge_req_fn		= noop_merged_requests,
-		.elevator_dispatch_fn		= noop_dispatch,
-		.elevator_add_req_fn		= noop_add_request,
-		.elevator_queue_empty_fn	= noop_queue_empty,
-		.elevator_former_req_fn		= noop_former_request,
-		.elevator_latter_req_fn		= noop_latter_request,
-		.elevator_init_fn		= noop_init_queue,
-		.elevator_exit_fn		= noop_exit_queue,
+		.elevator_merge_fn = 		look_merge,
+		.elevator_merged_fn =		look_merged_request,
+		.elevator_merge_req_fn =	look_merged_requests,
+		.elevator_dispatch_fn =		look_dispatch_requests,
+		.elevator_add_req_fn =		look_add_request,
+		.elevator_queue_empty_fn =	look_queue_empty,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		look_init_queue,
+		.elevator_exit_fn =		look_exit_queue,
 	},
-	.elevator_name = "noop",
+
+	.elevator_attrs = look_attrs,
+	.elevator_name = "look",
 	.elevator_owner = THIS_MODULE,
 };
 
-static int __init noop_init(void)
+static int __init look_init(void)
 {
-	elv_register(&elevator_noop);
+	elv_register(&iosched_look);
 
 	return 0;
 }
 
-static void __exit noop_exit(void)
+static void __exit look_exit(void)
 {
-	elv_unregister(&elevator_noop);
+	elv_unregister(&iosched_look);
 }
 
-module_init(noop_init);
-module_exit(noop_exit);
-
+module_init(look_init);
+module_exit(look_exit);
 
-MODULE_AUTHOR("Jens Axboe");
 MODULE_LICENSE("GPL");
-MODULE_DESCRIPTION("No-op IO scheduler");
+MODULE_DESCRIPTION("LOOK IO scheduler");
@@ -13,6 +13,7 @@
 #include <linux/moduleparam.h>
 #include <linux/major.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/radix-tree.h>
@@ -319,6 +320,56 @@ out:
 	return 0;
 }
 
+/*
+ * Request based variant of brd_make_request, used when the device sits on
+ * a multiqueue request_queue. Runs in process context and may sleep.
+ */
+static int brd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct brd_device *brd = hctx->driver_data;
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	sector_t sector;
+	int rw;
+	int err = -EIO;
+
+	if (!blk_fs_request(rq))
+		goto out;
+
+	sector = blk_rq_pos(rq);
+	if (sector + blk_rq_sectors(rq) > get_capacity(rq->rq_disk))
+		goto out;
+
+	rw = rq_data_dir(rq);
+	err = 0;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		unsigned int len = bvec->bv_len;
+		err = brd_do_bvec(brd, bvec->bv_page, len,
+					bvec->bv_offset, rw, sector);
+		if (err)
+			break;
+		sector += len >> SECTOR_SHIFT;
+	}
+
+out:
+	blk_mq_end_io(rq, err);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops brd_mq_ops = {
+	.queue_rq	= brd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg brd_mq_reg = {
+	.ops		= &brd_mq_ops,
+	.queue_depth	= 64,
+	.numa_node	= -1,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
 #ifdef CONFIG_BLK_DEV_XIP
 static int brd_direct_access (struct block_device *bdev, sector_t sector,
 			void **kaddr, unsigned long *pfn)
@@ -390,12 +441,18 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static int use_mq;
+static int hw_queues;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(use_mq, bool, 0);
+MODULE_PARM_DESC(use_mq, "Use the multiqueue block layer");
+module_param(hw_queues, int, 0);
+MODULE_PARM_DESC(hw_queues, "Hardware queues per RAM disk with use_mq");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -429,10 +486,18 @@ static struct brd_device *brd_alloc(int i)
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
-	if (!brd->brd_queue)
-		goto out_free_dev;
-	blk_queue_make_request(brd->brd_queue, brd_make_request);
+	if (use_mq) {
+		brd_mq_reg.nr_hw_queues = hw_queues > 0 ?
+						hw_queues : nr_cpu_ids;
+		brd->brd_queue = blk_mq_init_queue(&brd_mq_reg, brd);
+		if (IS_ERR(brd->brd_queue))
+			goto out_free_dev;
+	} else {
+		brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+		blk_queue_make_request(brd->brd_queue, brd_make_request);
+	}
 	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
 	blk_queue_max_hw_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
@@ -2,6 +2,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -11,6 +12,12 @@
 
 static int major, index;
 
+static int use_mq;
+module_param(use_mq, bool, 0444);
+MODULE_PARM_DESC(use_mq, "Use the multiqueue block layer");
+
+#define VIRTBLK_MQ_DEPTH	64
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -71,12 +78,18 @@ static void blk_done(struct virtqueue *vq)
 			vbr->req->errors = vbr->in_hdr.errors;
 		}
 
-		__blk_end_request_all(vbr->req, error);
+		if (use_mq)
+			blk_mq_end_io(vbr->req, error);
+		else
+			__blk_end_request_all(vbr->req, error);
 		list_del(&vbr->list);
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (use_mq)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue, 1);
+	else
+		blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
@@ -183,6 +196,41 @@ static void do_virtblk_request(struct request_queue *q)
 		vblk->vq->vq_ops->kick(vblk->vq);
 }
 
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
+{
+	struct request_queue *q = hctx->queue;
+	struct virtio_blk *vblk = q->queuedata;
+	unsigned long flags;
+	int ret = BLK_MQ_RQ_QUEUE_OK;
+
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	if (do_req(q, vblk, req))
+		vblk->vq->vq_ops->kick(vblk->vq);
+	else {
+		/* Restarted from blk_done() once something finishes. */
+		blk_mq_stop_hw_queue(hctx);
+		ret = BLK_MQ_RQ_QUEUE_BUSY;
+	}
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return ret;
+}
+
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg virtblk_mq_reg = {
+	.ops		= &virtblk_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= VIRTBLK_MQ_DEPTH,
+	.numa_node	= -1,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -296,11 +344,21 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
-	if (!q) {
-		err = -ENOMEM;
-		goto out_put_disk;
+	if (use_mq) {
+		/* A single virtqueue, so a single hardware context. */
+		q = blk_mq_init_queue(&virtblk_mq_reg, vblk);
+		if (IS_ERR(q)) {
+			err = PTR_ERR(q);
+			goto out_put_disk;
+		}
+	} else {
+		q = blk_init_queue(do_virtblk_request, &vblk->lock);
+		if (!q) {
+			err = -ENOMEM;
+			goto out_put_disk;
+		}
 	}
+	vblk->disk->queue = q;
 
 	q->queuedata = vblk;
 
@@ -324,8 +382,15 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	vblk->disk->driverfs_dev = &vdev->dev;
 	index++;
 
-	/* If barriers are supported, tell block layer that queue is ordered */
-	if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
+	/*
+	 * If barriers are supported, tell block layer that queue is ordered.
+	 * Multiqueue dispatch can't drain the queue around a flush, so it
+	 * only makes use of barriers the host orders by tag.
+	 */
+	if (use_mq) {
+		if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
+			blk_queue_ordered(q, QUEUE_ORDERED_TAG, NULL);
+	} else if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
 		blk_queue_ordered(q, QUEUE_ORDERED_DRAIN_FLUSH,
 				  virtblk_prepare_flush);
 	else if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
@@ -36,6 +36,7 @@
 #include <linux/blkdev.h>
 #include <linux/mempool.h>
 #include <linux/hash.h>
+#include <linux/kthread.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -74,6 +75,7 @@ mempool_t *abe_pool;
 
 static void aio_kick_handler(struct work_struct *);
 static void aio_queue_work(struct kioctx *);
+static int aio_sq_thread(void *);
 
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
@@ -183,6 +185,162 @@ static int aio_setup_ring(struct kioctx *ctx)
 	return 0;
 }
 
+/*
+ * Submission ring of a context created by io_ring_setup().  The ring is
+ * pinned like the completion ring; head is the kernel's trusted copy.
+ */
+#define AIO_SQ_MAX_ENTRIES	0x10000
+#define AIO_SQ_IDLE_MS		1000	/* default poll thread idle time */
+
+struct aio_sq {
+	struct kioctx		*ctx;
+	unsigned long		mmap_base;
+	unsigned long		mmap_size;
+	struct page		**pages;
+	long			nr_pages;
+
+	unsigned		nr;	/* entries, a power of two */
+	unsigned		head;	/* next entry to consume */
+	struct mutex		lock;	/* serializes consumers */
+
+	/* AIO_RING_SQPOLL only */
+	int			poll;
+	struct task_struct	*thread;
+	wait_queue_head_t	wait;
+	unsigned long		idle;	/* jiffies */
+};
+
+#define AIO_SQ_PER_PAGE		(PAGE_SIZE / sizeof(struct iocb))
+
+/* Header and entries are both 64 bytes: entry n is in slot n + 1 */
+static struct iocb *aio_sq_entry(struct aio_sq *sq, unsigned idx,
+				 unsigned long *offset)
+{
+	unsigned slot = (idx & (sq->nr - 1)) + 1;
+	struct iocb *iocb;
+
+	*offset = slot * sizeof(struct iocb);
+	iocb = kmap_atomic(sq->pages[slot / AIO_SQ_PER_PAGE], KM_USER0);
+	return iocb + slot % AIO_SQ_PER_PAGE;
+}
+
+static void aio_free_sq(struct kioctx *ctx, struct aio_sq *sq)
+{
+	long i;
+
+	for (i = 0; i < sq->nr_pages; i++)
+		put_page(sq->pages[i]);
+
+	if (sq->mmap_size) {
+		down_write(&ctx->mm->mmap_sem);
+		do_munmap(ctx->mm, sq->mmap_base, sq->mmap_size);
+		up_write(&ctx->mm->mmap_sem);
+	}
+
+	kfree(sq->pages);
+	kfree(sq);
+}
+
+/* aio_setup_sq
+ *	Maps a submission ring of at least nr entries into the caller's
+ *	address space, starts the poll thread if asked to and attaches the
+ *	ring to ctx.
+ */
+static int aio_setup_sq(struct kioctx *ctx, unsigned nr, unsigned flags,
+			unsigned idle_ms)
+{
+	struct aio_sq_ring *ring;
+	struct aio_sq *sq;
+	int nr_pages;
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct aio_sq_ring) != sizeof(struct iocb));
+
+	sq = kzalloc(sizeof(*sq), GFP_KERNEL);
+	if (!sq)
+		return -ENOMEM;
+	sq->ctx = ctx;
+	sq->nr = roundup_pow_of_two(nr);
+	mutex_init(&sq->lock);
+	init_waitqueue_head(&sq->wait);
+
+	nr_pages = DIV_ROUND_UP((sq->nr + 1) * sizeof(struct iocb), PAGE_SIZE);
+	ret = -ENOMEM;
+	sq->pages = kcalloc(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!sq->pages)
+		goto out_free;
+
+	ret = -EAGAIN;
+	sq->mmap_size = nr_pages * PAGE_SIZE;
+	down_write(&ctx->mm->mmap_sem);
+	sq->mmap_base = do_mmap(NULL, 0, sq->mmap_size,
+				PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE,
+				0);
+	if (IS_ERR((void *)sq->mmap_base)) {
+		up_write(&ctx->mm->mmap_sem);
+		sq->mmap_size = 0;
+		goto out_free;
+	}
+	sq->nr_pages = get_user_pages(current, ctx->mm, sq->mmap_base,
+				      nr_pages, 1, 0, sq->pages, NULL);
+	up_write(&ctx->mm->mmap_sem);
+	if (sq->nr_pages != nr_pages) {
+		if (sq->nr_pages < 0)
+			sq->nr_pages = 0;
+		goto out_free;
+	}
+
+	ring = kmap_atomic(sq->pages[0], KM_USER0);
+	ring->head = ring->tail = 0;
+	ring->nr = sq->nr;
+	ring->flags = 0;
+	ring->header_length = sizeof(struct aio_sq_ring);
+	kunmap_atomic(ring, KM_USER0);
+
+	if (flags & AIO_RING_SQPOLL) {
+		sq->poll = 1;
+		sq->idle = msecs_to_jiffies(idle_ms ? idle_ms : AIO_SQ_IDLE_MS);
+		sq->thread = kthread_run(aio_sq_thread, sq, "aio-sq");
+		if (IS_ERR(sq->thread)) {
+			ret = PTR_ERR(sq->thread);
+			sq->thread = NULL;
+			goto out_free;
+		}
+	}
+
+	/* pairs with smp_read_barrier_depends() in io_ring_enter */
+	smp_wmb();
+	ctx->sq = sq;
+	return 0;
+
+out_free:
+	aio_free_sq(ctx, sq);
+	return ret;
+}
+
+/* aio_sq_stop
+ *	Stops the poll thread of ctx, if there is one.  The thread uses
+ *	the owner's mm, so this must happen before the mm is torn down.
+ */
+static void aio_sq_stop(struct kioctx *ctx)
+{
+	struct task_struct *thread;
+
+	if (ctx->sq && (thread = xchg(&ctx->sq->thread, NULL)))
+		kthread_stop(thread);
+}
+
+static void aio_put_fixed_files(struct kioctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_fixed_files; i++)
+		if (ctx->fixed_files[i])
+			fput(ctx->fixed_files[i]);
+	kfree(ctx->fixed_files);
+	ctx->fixed_files = NULL;
+	ctx->nr_fixed_files = 0;
+}
 
 /* aio_ring_event: returns a pointer to the event at the given index from
  * kmap_atomic(, km).  Release the pointer with put_aio_ring_event();
@@ -231,6 +389,12 @@ static void __put_ioctx(struct kioctx *ctx)
 
 	cancel_delayed_work(&ctx->wq);
 	cancel_work_sync(&ctx->wq.work);
+	if (ctx->sq) {
+		aio_sq_stop(ctx);
+		aio_free_sq(ctx, ctx->sq);
+		ctx->sq = NULL;
+	}
+	aio_put_fixed_files(ctx);
 	aio_free_ring(ctx);
 	mmdrop(ctx->mm);
 	ctx->mm = NULL;
@@ -412,6 +576,7 @@ void exit_aio(struct mm_struct *mm)
 		ctx = hlist_entry(mm->ioctx_list.first, struct kioctx, list);
 		hlist_del_rcu(&ctx->list);
 
+		aio_sq_stop(ctx);
 		aio_cancel_all(ctx);
 
 		wait_for_all_aios(ctx);
@@ -429,6 +594,62 @@ void exit_aio(struct mm_struct *mm)
 	}
 }
 
+static int __aio_put_req(struct kioctx *ctx, struct kiocb *req);
+
+/*
+ * Wake function of kiocb->ki_wait: the page bit a buffered read waited
+ * for has been cleared, so kick a retry of the iocb.
+ *
+ * Once ki_wait is off the queue, aio_dequeue_wait() no longer waits for
+ * us, and a retry, a cancel or io_destroy may complete and free the
+ * iocb: hold a reference on it until it has been kicked.  Called with
+ * the wait queue lock held and interrupts disabled.
+ */
+static int aio_wake_function(wait_queue_t *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_bit_queue *wait_bit
+		= container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+	struct kioctx *ctx = iocb->ki_ctx;
+	struct wait_bit_key *key = arg;
+
+	/* page wait queues are hashed and shared */
+	if (wait_bit->key.flags != key->flags ||
+			wait_bit->key.bit_nr != key->bit_nr ||
+			test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	spin_lock(&ctx->ctx_lock);
+	iocb->ki_users++;
+	spin_unlock(&ctx->ctx_lock);
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+
+	spin_lock(&ctx->ctx_lock);
+	__aio_put_req(ctx, iocb);
+	spin_unlock(&ctx->ctx_lock);
+	return 1;
+}
+
+/*
+ * Take kiocb->ki_wait off the page wait queue, if a retry left it there.
+ * Must be called before the kiocb completes, and not under ctx_lock, which
+ * nests inside the wait queue lock through aio_wake_function().
+ */
+static void aio_dequeue_wait(struct kiocb *iocb)
+{
+	wait_queue_head_t *wqh = iocb->ki_wait_head;
+	unsigned long flags;
+
+	if (!wqh || list_empty_careful(&iocb->ki_wait.wait.task_list))
+		return;
+	spin_lock_irqsave(&wqh->lock, flags);
+	list_del_init(&iocb->ki_wait.wait.task_list);
+	spin_unlock_irqrestore(&wqh->lock, flags);
+}
+
 /* aio_get_req
  *	Allocate a slot for an aio request.  Increments the users count
  * of the kioctx so that the kioctx stays around until all requests are
@@ -460,6 +681,8 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
 	req->ki_eventfd = NULL;
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	req->ki_wait_head = NULL;
 
 	/* Check if the completion queue has enough free space to
 	 * accept an event from this io.
@@ -562,8 +785,12 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 	 * schedule work in case it is not __fput() time. In normal cases,
 	 * we would not be holding the last reference to the file*, so
 	 * this function will be executed w/out any aio kthread wakeup.
+	 * Fixed files are referenced by the kioctx, not by the request.
 	 */
-	if (unlikely(atomic_long_dec_and_test(&req->ki_filp->f_count))) {
+	if (kiocbIsFixedFile(req)) {
+		req->ki_filp = NULL;
+		really_put_req(ctx, req);
+	} else if (unlikely(atomic_long_dec_and_test(&req->ki_filp->f_count))) {
 		get_ioctx(ctx);
 		spin_lock(&fput_lock);
 		list_add(&req->ki_list, &fput_head);
@@ -776,17 +1003,13 @@ static int __aio_run_iocbs(struct kioctx *ctx)
 
 static void aio_queue_work(struct kioctx * ctx)
 {
-	unsigned long timeout;
 	/*
-	 * if someone is waiting, get the work started right
-	 * away, otherwise, use a longer delay
+	 * Most retries are buffered reads whose page just came in.
+	 * Completions may be waited for through an eventfd rather than
+	 * io_getevents(), so get the work started right away whether or
+	 * not someone is waiting on the context.
 	 */
-	smp_mb();
-	if (waitqueue_active(&ctx->wait))
-		timeout = 1;
-	else
-		timeout = HZ/10;
-	queue_delayed_work(aio_wq, &ctx->wq, timeout);
+	queue_delayed_work(aio_wq, &ctx->wq, 0);
 }
 
 
@@ -925,6 +1148,8 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 		return 1;
 	}
 
+	aio_dequeue_wait(iocb);
+
 	info = &ctx->ring_info;
 
 	/* add a completion event to the ring buffer.
@@ -1216,6 +1441,7 @@ static void io_destroy(struct kioctx *ioctx)
 	if (likely(!was_dead))
 		put_ioctx(ioctx);	/* twice for the list */
 
+	aio_sq_stop(ioctx);
 	aio_cancel_all(ioctx);
 	wait_for_all_aios(ioctx);
 
@@ -1343,6 +1569,15 @@ static ssize_t aio_rw_vect_retry(struct kiocb *iocb)
 		if (ret > 0)
 			aio_advance_iovec(iocb, ret);
 
+		/*
+		 * A partial read that stopped at a locked page has queued
+		 * ki_wait on it: the unlock kicks the next retry, which
+		 * carries on from ki_pos.
+		 */
+		if (ret > 0 && iocb->ki_left > 0 &&
+		    !list_empty_careful(&iocb->ki_wait.wait.task_list))
+			return -EIOCBRETRY;
+
 	/* retry all partial writes.  retry partial reads as long as its a
 	 * regular file. */
 	} while (ret > 0 && iocb->ki_left > 0 &&
@@ -1547,9 +1782,22 @@ static void aio_batch_free(struct hlist_head *batch_hash)
 	}
 }
 
+/* aio_fixed_file
+ *	Returns the file registered at index fd, without taking a
+ *	reference: registered files live as long as the kioctx.
+ */
+static struct file *aio_fixed_file(struct kioctx *ctx, unsigned fd)
+{
+	if (fd >= ctx->nr_fixed_files)
+		return NULL;
+	smp_rmb();	/* pairs with smp_wmb() in aio_register_files */
+	return ctx->fixed_files[fd];
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, struct hlist_head *batch_hash)
 {
+	int fixed = iocb->aio_flags & IOCB_FLAG_FIXED_FILE;
 	struct kiocb *req;
 	struct file *file;
 	ssize_t ret;
@@ -1570,16 +1818,22 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		return -EINVAL;
 	}
 
-	file = fget(iocb->aio_fildes);
+	if (fixed)
+		file = aio_fixed_file(ctx, iocb->aio_fildes);
+	else
+		file = fget(iocb->aio_fildes);
 	if (unlikely(!file))
 		return -EBADF;
 
 	req = aio_get_req(ctx);		/* returns with 2 references to req */
 	if (unlikely(!req)) {
-		fput(file);
+		if (!fixed)
+			fput(file);
 		return -EAGAIN;
 	}
 	req->ki_filp = file;
+	if (fixed)
+		kiocbSetFixedFile(req);
 	if (iocb->aio_flags & IOCB_FLAG_RESFD) {
 		/*
 		 * If the IOCB_FLAG_RESFD flag of aio_flags is set, get an
@@ -1697,6 +1951,392 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	return i ? i : ret;
 }
 
+/* aio_sq_fail
+ *	Reports a submission ring entry that could not be submitted as a
+ *	completion event with res set to the error, since there is no
+ *	syscall to return it from.  Returns -EAGAIN if the completion ring
+ *	is full, in which case the entry must be left in place.
+ */
+static int aio_sq_fail(struct kioctx *ctx, struct iocb __user *user_iocb,
+		       struct iocb *iocb, long err)
+{
+	struct kiocb *req;
+
+	req = aio_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	req->ki_filp = NULL;
+	kiocbSetFixedFile(req);		/* nothing to fput */
+	req->ki_obj.user = user_iocb;
+	req->ki_user_data = iocb->aio_data;
+	aio_complete(req, err, 0);
+	aio_put_req(req);
+	return 0;
+}
+
+/* aio_sq_submit
+ *	Submits up to nr entries of the submission ring of ctx.  Returns
+ *	the number of entries consumed, or -EAGAIN if the completion ring
+ *	is full.  Entries that fail to submit are consumed and completed
+ *	with the error.  The poll thread has no file table of its own, so
+ *	it only accepts iocbs using registered files.
+ */
+static int aio_sq_submit(struct kioctx *ctx, unsigned nr, int polled)
+{
+	struct hlist_head batch_hash[AIO_BATCH_HASH_SIZE] = { { 0, }, };
+	struct aio_sq *sq = ctx->sq;
+	struct aio_sq_ring *ring;
+	unsigned head, tail;
+	int submitted = 0;
+	int ret = 0;
+
+	mutex_lock(&sq->lock);
+	ring = kmap_atomic(sq->pages[0], KM_USER0);
+	tail = ring->tail;
+	kunmap_atomic(ring, KM_USER0);
+	smp_rmb();	/* read the entries after the tail */
+
+	head = sq->head;
+	if (unlikely(tail - head > sq->nr)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	nr = min(nr, tail - head);
+
+	while (submitted < nr) {
+		struct iocb __user *user_iocb;
+		unsigned long offset;
+		struct iocb *entry;
+		struct iocb tmp;
+
+		entry = aio_sq_entry(sq, head, &offset);
+		tmp = *entry;
+		kunmap_atomic(entry, KM_USER0);
+		user_iocb = (struct iocb __user *)(sq->mmap_base + offset);
+
+		if (polled && (!(tmp.aio_flags & IOCB_FLAG_FIXED_FILE) ||
+			       (tmp.aio_flags & IOCB_FLAG_RESFD)))
+			ret = -EINVAL;
+		else
+			ret = io_submit_one(ctx, user_iocb, &tmp, batch_hash);
+		if (ret == -EAGAIN)
+			break;
+		if (ret) {
+			ret = aio_sq_fail(ctx, user_iocb, &tmp, ret);
+			if (ret)
+				break;
+		}
+		head++;
+		submitted++;
+	}
+	aio_batch_free(batch_hash);
+
+	if (submitted) {
+		sq->head = head;
+		smp_mb();	/* done with the entries before freeing them */
+		ring = kmap_atomic(sq->pages[0], KM_USER0);
+		ring->head = head;
+		kunmap_atomic(ring, KM_USER0);
+	}
+out:
+	mutex_unlock(&sq->lock);
+	return submitted ? submitted : ret;
+}
+
+static int aio_sq_pending(struct aio_sq *sq)
+{
+	struct aio_sq_ring *ring;
+	int pending;
+
+	ring = kmap_atomic(sq->pages[0], KM_USER0);
+	pending = ring->tail != sq->head;
+	kunmap_atomic(ring, KM_USER0);
+	return pending;
+}
+
+static void aio_sq_set_flags(struct aio_sq *sq, unsigned flags)
+{
+	struct aio_sq_ring *ring;
+
+	ring = kmap_atomic(sq->pages[0], KM_USER0);
+	ring->flags = flags;
+	kunmap_atomic(ring, KM_USER0);
+}
+
+/* aio_sq_thread
+ *	Polls the submission ring of an AIO_RING_SQPOLL context, so that
+ *	user space can queue iocbs without entering the kernel.  After
+ *	sq->idle jiffies without work the thread sets AIO_SQ_NEED_WAKEUP
+ *	and sleeps until io_ring_enter(AIO_ENTER_SQ_WAKEUP).
+ */
+static int aio_sq_thread(void *data)
+{
+	struct aio_sq *sq = data;
+	struct kioctx *ctx = sq->ctx;
+	unsigned long timeout = jiffies + sq->idle;
+	mm_segment_t oldfs = get_fs();
+	DEFINE_WAIT(wait);
+	int ret;
+
+	use_mm(ctx->mm);
+	set_fs(USER_DS);	/* iocbs carry user addresses */
+
+	while (!kthread_should_stop()) {
+		ret = aio_sq_submit(ctx, sq->nr, 1);
+		if (ret > 0) {
+			timeout = jiffies + sq->idle;
+			cond_resched();
+			continue;
+		}
+		if (ret == -EAGAIN) {
+			/* completion ring full: let user space reap */
+			schedule_timeout_interruptible(1);
+			continue;
+		}
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			cpu_relax();
+			continue;
+		}
+
+		prepare_to_wait(&sq->wait, &wait, TASK_INTERRUPTIBLE);
+		aio_sq_set_flags(sq, AIO_SQ_NEED_WAKEUP);
+		smp_mb();	/* flag visible before checking the tail */
+		if (!aio_sq_pending(sq) && !kthread_should_stop())
+			schedule();
+		finish_wait(&sq->wait, &wait);
+		aio_sq_set_flags(sq, 0);
+		timeout = jiffies + sq->idle;
+	}
+
+	set_fs(oldfs);
+	unuse_mm(ctx->mm);
+	return 0;
+}
+
+/* aio_register_files
+ *	Takes a reference on each of the nr files in fds, to be used with
+ *	IOCB_FLAG_FIXED_FILE until the context is destroyed.  A negative
+ *	fd leaves its slot empty.  Files can be registered only once.
+ */
+static int aio_register_files(struct kioctx *ctx, int __user *fds,
+			      unsigned nr)
+{
+	struct file **files;
+	unsigned i;
+	int ret;
+
+	if (!nr || nr > rlimit(RLIMIT_NOFILE))
+		return -EINVAL;
+	if (ctx->nr_fixed_files)
+		return -EBUSY;
+
+	files = kcalloc(nr, sizeof(struct file *), GFP_KERNEL);
+	if (!files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		int fd;
+
+		ret = -EFAULT;
+		if (get_user(fd, fds + i))
+			goto out_put;
+		if (fd < 0)
+			continue;
+		ret = -EBADF;
+		files[i] = fget(fd);
+		if (!files[i])
+			goto out_put;
+	}
+
+	ret = -EBUSY;
+	spin_lock_irq(&ctx->ctx_lock);
+	if (!ctx->fixed_files) {
+		ctx->fixed_files = files;
+		smp_wmb();	/* pairs with smp_rmb() in aio_fixed_file */
+		ctx->nr_fixed_files = nr;
+		ret = 0;
+	}
+	spin_unlock_irq(&ctx->ctx_lock);
+	if (!ret)
+		return 0;
+
+out_put:
+	for (i = 0; i < nr; i++)
+		if (files[i])
+			fput(files[i]);
+	kfree(files);
+	return ret;
+}
+
+static unsigned aio_ring_events(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	unsigned head;
+
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	head = ring->head;
+	kunmap_atomic(ring, KM_USER0);
+
+	return (info->tail + info->nr - head % info->nr) % info->nr;
+}
+
+/* aio_wait_events
+ *	Waits until the completion ring of ctx holds at least min_nr
+ *	events, which user space reaps directly from the ring.
+ */
+static int aio_wait_events(struct kioctx *ctx, unsigned min_nr)
+{
+	DEFINE_WAIT(wait);
+	int ret = 0;
+
+	if (min_nr >= ctx->ring_info.nr)
+		return -EINVAL;
+
+	for (;;) {
+		prepare_to_wait(&ctx->wait, &wait, TASK_INTERRUPTIBLE);
+		if (aio_ring_events(ctx) >= min_nr)
+			break;
+		if (unlikely(ctx->dead)) {
+			ret = -EINVAL;
+			break;
+		}
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		if (ctx->reqs_active)
+			io_schedule();
+		else
+			schedule();
+	}
+	finish_wait(&ctx->wait, &wait);
+	return ret;
+}
+
+/* sys_io_ring_setup:
+ *	Create an aio_context with a submission ring as well as the usual
+ *	completion ring, both mapped into the caller's address space, as
+ *	described by the struct aio_ring_params at uparams.  On success
+ *	ctx_id, sq_ring and the rounded up nr_sq are filled in.  With
+ *	AIO_RING_SQPOLL a kernel thread consumes the submission ring; this
+ *	requires CAP_SYS_ADMIN.  May fail with the errors of io_setup, or
+ *	with -EPERM.
+ */
+SYSCALL_DEFINE1(io_ring_setup, struct aio_ring_params __user *, uparams)
+{
+	struct aio_ring_params p;
+	struct kioctx *ioctx;
+	long ret;
+
+	if (copy_from_user(&p, uparams, sizeof(p)))
+		return -EFAULT;
+
+	if (p.flags & ~AIO_RING_SQPOLL || p.ctx_id || p.sq_ring ||
+	    p.reserved[0] || p.reserved[1] || !p.nr_events || !p.nr_sq ||
+	    p.nr_sq > AIO_SQ_MAX_ENTRIES)
+		return -EINVAL;
+	if ((p.flags & AIO_RING_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	ioctx = ioctx_alloc(p.nr_events);
+	if (IS_ERR(ioctx))
+		return PTR_ERR(ioctx);
+
+	ret = aio_setup_sq(ioctx, p.nr_sq, p.flags, p.sq_idle_ms);
+	if (!ret) {
+		p.ctx_id = ioctx->user_id;
+		p.sq_ring = ioctx->sq->mmap_base;
+		p.nr_sq = ioctx->sq->nr;
+		if (!copy_to_user(uparams, &p, sizeof(p)))
+			return 0;
+		ret = -EFAULT;
+	}
+
+	get_ioctx(ioctx); /* io_destroy() expects us to hold a ref */
+	io_destroy(ioctx);
+	return ret;
+}
+
+/* sys_io_ring_enter:
+ *	Submit up to to_submit iocbs queued on the submission ring of the
+ *	aio_context ctx_id, then wait until its completion ring holds at
+ *	least min_complete events.  With AIO_RING_SQPOLL nothing is
+ *	submitted here; AIO_ENTER_SQ_WAKEUP wakes the poll thread once it
+ *	has set AIO_SQ_NEED_WAKEUP.  Returns the number of iocbs consumed.
+ *	May fail with -EINVAL if ctx_id has no submission ring, with
+ *	-EAGAIN if the completion ring is full, or with -EINTR.
+ */
+SYSCALL_DEFINE4(io_ring_enter, aio_context_t, ctx_id, unsigned, to_submit,
+		unsigned, min_complete, unsigned, flags)
+{
+	struct kioctx *ioctx;
+	struct aio_sq *sq;
+	long ret = -EINVAL;
+	int err;
+
+	if (flags & ~AIO_ENTER_SQ_WAKEUP)
+		return -EINVAL;
+
+	ioctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ioctx))
+		return -EINVAL;
+
+	sq = ioctx->sq;
+	smp_read_barrier_depends();
+	if (!sq)
+		goto out;
+
+	ret = 0;
+	if (sq->poll) {
+		if (flags & AIO_ENTER_SQ_WAKEUP)
+			wake_up(&sq->wait);
+	} else if (to_submit) {
+		ret = aio_sq_submit(ioctx, to_submit, 0);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (min_complete) {
+		err = aio_wait_events(ioctx, min_complete);
+		if (err && !ret)
+			ret = err;
+	}
+out:
+	put_ioctx(ioctx);
+	return ret;
+}
+
+/* sys_io_ring_register:
+ *	Register resources with the aio_context ctx_id.  The only opcode
+ *	is AIO_REGISTER_FILES: arg is an array of nr_args file descriptors
+ *	which iocbs can then refer to by index with IOCB_FLAG_FIXED_FILE,
+ *	saving the fget/fput of each request.  May fail with -EINVAL,
+ *	-EBADF, -EFAULT, -ENOMEM, or -EBUSY if files are already
+ *	registered.
+ */
+SYSCALL_DEFINE4(io_ring_register, aio_context_t, ctx_id, unsigned, opcode,
+		void __user *, arg, unsigned, nr_args)
+{
+	struct kioctx *ioctx;
+	long ret = -EINVAL;
+
+	ioctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ioctx))
+		return -EINVAL;
+
+	switch (opcode) {
+	case AIO_REGISTER_FILES:
+		ret = aio_register_files(ioctx, arg, nr_args);
+		break;
+	}
+
+	put_ioctx(ioctx);
+	return ret;
+}
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
@@ -455,7 +455,7 @@ void ceph_queue_cap_snap(struct ceph_inode_info *ci)
 	} else if (ci->i_wrbuffer_ref_head || (used & CEPH_CAP_FILE_WR)) {
 		struct ceph_snap_context *snapc = ci->i_head_snapc;
 
-		igrab(inode);
+		__iget(inode);
 
 		atomic_set(&capsnap->nref, 1);
 		capsnap->ci = ci;
@@ -40,6 +40,12 @@ EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lock);
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
+/*
+ * dcache_lru_lock protects the per-sb unused dentry lists and their
+ * counters.  It nests inside dentry->d_lock, so that dput() can park an
+ * unused dentry on the LRU without taking dcache_lock.
+ */
+static __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lru_lock);
 
 EXPORT_SYMBOL(dcache_lock);
 
@@ -106,7 +112,9 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
+		write_seqcount_begin(&dentry->d_seq);
 		dentry->d_inode = NULL;
+		write_seqcount_end(&dentry->d_seq);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -123,37 +131,47 @@ static void dentry_iput(struct dentry * dentry)
 }
 
 /*
- * dentry_lru_(add|add_tail|del|del_init) must be called with dcache_lock held.
+ * dentry_lru_(add|add_tail|del|del_init) take dcache_lru_lock themselves.
+ * Adding also needs dentry->d_lock, so that a dentry cannot be put back
+ * on the LRU while the pruning code is killing it.
  */
 static void dentry_lru_add(struct dentry *dentry)
 {
+	spin_lock(&dcache_lru_lock);
 	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
 	dentry->d_sb->s_nr_dentry_unused++;
 	dentry_stat.nr_unused++;
+	spin_unlock(&dcache_lru_lock);
 }
 
 static void dentry_lru_add_tail(struct dentry *dentry)
 {
+	spin_lock(&dcache_lru_lock);
 	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
 	dentry->d_sb->s_nr_dentry_unused++;
 	dentry_stat.nr_unused++;
+	spin_unlock(&dcache_lru_lock);
 }
 
 static void dentry_lru_del(struct dentry *dentry)
 {
 	if (!list_empty(&dentry->d_lru)) {
+		spin_lock(&dcache_lru_lock);
 		list_del(&dentry->d_lru);
 		dentry->d_sb->s_nr_dentry_unused--;
 		dentry_stat.nr_unused--;
+		spin_unlock(&dcache_lru_lock);
 	}
 }
 
 static void dentry_lru_del_init(struct dentry *dentry)
 {
 	if (likely(!list_empty(&dentry->d_lru))) {
+		spin_lock(&dcache_lru_lock);
 		list_del_init(&dentry->d_lru);
 		dentry->d_sb->s_nr_dentry_unused--;
 		dentry_stat.nr_unused--;
+		spin_unlock(&dcache_lru_lock);
 	}
 }
 
@@ -220,11 +238,32 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
-	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
 		return;
 
+	/*
+	 * Fast path: a hashed dentry without ->d_delete() just goes on
+	 * the LRU, and that only needs d_lock and dcache_lru_lock.
+	 */
+	if (!d_unhashed(dentry) &&
+	    !(dentry->d_op && dentry->d_op->d_delete)) {
+		if (list_empty(&dentry->d_lru)) {
+			dentry->d_flags |= DCACHE_REFERENCED;
+			dentry_lru_add(dentry);
+		}
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	/*
+	 * Slow path: hold on to the dentry while we retake the locks in
+	 * dcache_lock -> d_lock order, then see if we are still the last.
+	 */
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
+	spin_lock(&dcache_lock);
 	spin_lock(&dentry->d_lock);
-	if (atomic_read(&dentry->d_count)) {
+	if (!atomic_dec_and_test(&dentry->d_count)) {
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
 		return;
@@ -470,6 +509,7 @@ static void __shrink_dcache_sb(struct super_block *sb, int *count, int flags)
 		/* called from prune_dcache() and shrink_dcache_parent() */
 		cnt = *count;
 restart:
+	spin_lock(&dcache_lru_lock);
 	if (count == NULL)
 		list_splice_init(&sb->s_dentry_lru, &tmp);
 	else {
@@ -478,7 +518,15 @@ restart:
 					struct dentry, d_lru);
 			BUG_ON(dentry->d_sb != sb);
 
-			spin_lock(&dentry->d_lock);
+			/*
+			 * d_lock nests outside dcache_lru_lock, so we can only
+			 * try it here.  A busy dentry is about to be used or
+			 * put anyway: treat it as referenced.
+			 */
+			if (!spin_trylock(&dentry->d_lock)) {
+				list_move(&dentry->d_lru, &referenced);
+				goto next;
+			}
 			/*
 			 * If we are honouring the DCACHE_REFERENCED flag and
 			 * the dentry has this flag set, don't free it. Clear
@@ -496,13 +544,19 @@ restart:
 				if (!cnt)
 					break;
 			}
-			cond_resched_lock(&dcache_lock);
+next:
+			if (need_resched() || spin_needbreak(&dcache_lru_lock)) {
+				spin_unlock(&dcache_lru_lock);
+				cond_resched_lock(&dcache_lock);
+				spin_lock(&dcache_lru_lock);
+			}
 		}
 	}
+	spin_unlock(&dcache_lru_lock);
 	while (!list_empty(&tmp)) {
 		dentry = list_entry(tmp.prev, struct dentry, d_lru);
-		dentry_lru_del_init(dentry);
 		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		/*
 		 * We found an inuse dentry which was not removed from
 		 * the LRU because of laziness during lookup.  Do not free
@@ -520,8 +574,11 @@ restart:
 		goto restart;
 	if (count != NULL)
 		*count = cnt;
-	if (!list_empty(&referenced))
+	if (!list_empty(&referenced)) {
+		spin_lock(&dcache_lru_lock);
 		list_splice(&referenced, &sb->s_dentry_lru);
+		spin_unlock(&dcache_lru_lock);
+	}
 	spin_unlock(&dcache_lock);
 }
 
@@ -829,6 +886,7 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 
+		spin_lock(&dentry->d_lock);
 		dentry_lru_del_init(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
@@ -838,6 +896,7 @@ resume:
 			dentry_lru_add_tail(dentry);
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -950,6 +1009,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -1432,6 +1492,55 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without taking locks or references
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seqp: returns the d_seq value of the dentry found
+ *
+ * This is the lookup used by the RCU path walk.  It must be called under
+ * rcu_read_lock(), and the dentry it returns is only stable for as long as
+ * d_seq does not change: the caller must check @seqp with
+ * read_seqcount_retry() after it has read what it needs from the dentry.
+ *
+ * ->d_compare() is not called, so the caller must use __d_lookup() for
+ * parents that have one.  A racing d_move() can make the name and length
+ * seen here inconsistent; memcmp() may then compare garbage, but both
+ * stay within live dentry memory (names are only freed after a grace
+ * period) and the d_seq check rejects the result.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+			      unsigned *seqp)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		unsigned seq;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+		seq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		if (memcmp(dentry->d_name.name, str, len))
+			continue;
+		if (read_seqcount_retry(&dentry->d_seq, seq))
+			return NULL;
+		*seqp = seq;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1664,6 +1773,12 @@ static void d_move_locked(struct dentry * dentry, struct dentry * target)
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
 
+	/* Unhash the target: dput() will then get rid of it */
+	__d_drop(target);
+
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
+
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (d_unhashed(dentry))
 		goto already_unhashed;
@@ -1674,9 +1789,6 @@ already_unhashed:
 	list = d_hash(target->d_parent, target->d_name.hash);
 	__d_rehash(dentry, list);
 
-	/* Unhash the target: dput() will then get rid of it */
-	__d_drop(target);
-
 	list_del(&dentry->d_u.d_child);
 	list_del(&target->d_u.d_child);
 
@@ -1697,6 +1809,8 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -94,3 +94,8 @@ extern int do_remount_sb(struct super_block *, int, void *, int);
 struct nameidata;
 extern struct file *nameidata_to_filp(struct nameidata *);
 extern void release_open_intent(struct nameidata *);
+
+/*
+ * inode.c
+ */
+extern int get_nr_dirty_inodes(void);
@@ -482,6 +482,26 @@ ok:
 	return security_inode_permission(inode, MAY_EXEC);
 }
 
+/*
+ * exec_permission() for the RCU path walk: @inode is not pinned and we
+ * must not sleep, so anything beyond the plain mode bits (->permission,
+ * an ACL that is not known to be absent, a capability override, a
+ * security module with its own hook) is left to the ref-counted walk by
+ * returning -ECHILD.
+ */
+static int exec_permission_rcu(struct inode *inode)
+{
+	if (inode->i_op->permission)
+		return -ECHILD;
+#ifdef CONFIG_FS_POSIX_ACL
+	if (IS_POSIXACL(inode) && ACCESS_ONCE(inode->i_acl) != NULL)
+		return -ECHILD;
+#endif
+	if (acl_permission_check(inode, MAY_EXEC, NULL))
+		return -ECHILD;
+	return security_inode_permission_rcu(inode, MAY_EXEC);
+}
+
 static __always_inline void set_root(struct nameidata *nd)
 {
 	if (!nd->root.mnt) {
@@ -974,6 +994,122 @@ return_err:
 	return err;
 }
 
+/*
+ * RCU path walk.
+ *
+ * Most of a path is directories that are already in the dcache, and
+ * getting and putting a reference on each of them is what makes parallel
+ * lookups bounce dentry cachelines between CPUs.  rcu_walk_prefix() walks
+ * as many leading components as it can under rcu_read_lock() alone,
+ * checking each step against the dentry's d_seq instead of pinning it,
+ * and only takes a reference on the directory where it stops.
+ *
+ * Anything it does not handle locklessly - "..", mountpoints, symlinks,
+ * ->d_revalidate(), ->d_hash()/->d_compare(), permission checks that need
+ * more than the mode bits, or a racing rename/unlink - simply ends the
+ * lockless part and link_path_walk() carries on from there.  The last
+ * component is always left to link_path_walk().
+ *
+ * Returns the part of @name that is left to walk.
+ */
+static const char *rcu_walk_prefix(const char *name, struct nameidata *nd)
+{
+	struct dentry *parent = nd->path.dentry;
+	struct super_block *sb = parent->d_sb;
+	struct inode *inode;
+	const char *start = name, *p = name;
+	unsigned seq;
+
+	/* inodes must not be freed under us, see destroy_inode() */
+	if (sb->s_op->destroy_inode && !(sb->s_type->fs_flags & FS_RCU_INODES))
+		return name;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&parent->d_seq);
+	inode = parent->d_inode;
+	for (;;) {
+		struct dentry *dentry;
+		struct inode *child;
+		struct qstr this;
+		unsigned long hash;
+		unsigned int c;
+		unsigned dseq;
+
+		while (*p == '/')
+			p++;
+		this.name = p;
+		c = *(const unsigned char *)p;
+		if (!c)
+			break;
+		hash = init_name_hash();
+		do {
+			p++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)p;
+		} while (c && (c != '/'));
+		this.len = p - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* leave the last component to link_path_walk() */
+		while (*p == '/')
+			p++;
+		if (!*p)
+			break;
+
+		if (!inode || exec_permission_rcu(inode))
+			break;
+		if (this.name[0] == '.') {
+			if (this.len == 1) {
+				name = p;
+				continue;
+			}
+			if (this.len == 2 && this.name[1] == '.')
+				break;
+		}
+
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			break;
+		dentry = __d_lookup_rcu(parent, &this, &dseq);
+		if (!dentry)
+			break;
+		if (dentry->d_op && dentry->d_op->d_revalidate)
+			break;
+		if (d_mountpoint(dentry))
+			break;
+		child = dentry->d_inode;
+		if (!child || child->i_op->follow_link || !child->i_op->lookup)
+			break;
+		if (read_seqcount_retry(&dentry->d_seq, dseq) ||
+		    read_seqcount_retry(&parent->d_seq, seq))
+			break;
+
+		parent = dentry;
+		seq = dseq;
+		inode = child;
+		name = p;
+	}
+
+	if (parent != nd->path.dentry) {
+		/* pin where we stopped, unless it changed since we got there */
+		spin_lock(&parent->d_lock);
+		if (d_unhashed(parent) ||
+		    read_seqcount_retry(&parent->d_seq, seq)) {
+			spin_unlock(&parent->d_lock);
+			rcu_read_unlock();
+			return start;
+		}
+		atomic_inc(&parent->d_count);
+		spin_unlock(&parent->d_lock);
+		rcu_read_unlock();
+		dput(nd->path.dentry);
+		nd->path.dentry = parent;
+		return name;
+	}
+	rcu_read_unlock();
+	return name;
+}
+
 static int path_walk(const char *name, struct nameidata *nd)
 {
 	struct path save = nd->path;
@@ -984,7 +1120,7 @@ static int path_walk(const char *name, struct nameidata *nd)
 	/* make sure the stuff we saved doesn't go away */
 	path_get(&save);
 
-	result = link_path_walk(name, nd);
+	result = link_path_walk(rcu_walk_prefix(name, nd), nd);
 	if (result == -ESTALE) {
 		/* nd->path had been dropped */
 		current->total_link_count = 0;
@@ -1800,8 +1936,7 @@ reval:
 	if (force_reval)
 		nd.flags |= LOOKUP_REVAL;
 
-	current->total_link_count = 0;
-	error = link_path_walk(pathname, &nd);
+	error = path_walk(pathname, &nd);
 	if (error) {
 		filp = ERR_PTR(error);
 		goto out;
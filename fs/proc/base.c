@@ -373,6 +373,21 @@ static int proc_pid_schedstat(struct task_struct *task, char *buffer)
 }
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Provides /proc/PID/numa_faults: NUMA hinting faults on memory of the
+ * node the task ran on and of other nodes, the pages they migrated and
+ * the node the task prefers.
+ */
+static int proc_pid_numa_faults(struct task_struct *task, char *buffer)
+{
+	return sprintf(buffer, "local %lu\nremote %lu\nmigrated %lu\n"
+			"preferred_node %d\n",
+			task->numa_faults_local, task->numa_faults_remote,
+			task->numa_pages_migrated, task->numa_preferred_nid);
+}
+#endif
+
 #ifdef CONFIG_LATENCYTOP
 static int lstats_show_proc(struct seq_file *m, void *v)
 {
@@ -2593,6 +2608,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("maps",       S_IRUGO, proc_maps_operations),
 #ifdef CONFIG_NUMA
 	REG("numa_maps",  S_IRUGO, proc_numa_maps_operations),
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	INF("numa_faults", S_IRUGO, proc_pid_numa_faults),
 #endif
 	REG("mem",        S_IRUSR|S_IWUSR, proc_mem_operations),
 	LNK("cwd",        proc_cwd_link),
@@ -2928,6 +2946,9 @@ static const struct pid_entry tid_base_stuff[] = {
 	REG("maps",      S_IRUGO, proc_maps_operations),
 #ifdef CONFIG_NUMA
 	REG("numa_maps", S_IRUGO, proc_numa_maps_operations),
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	INF("numa_faults", S_IRUGO, proc_pid_numa_faults),
 #endif
 	REG("mem",       S_IRUSR|S_IWUSR, proc_mem_operations),
 	LNK("cwd",       proc_cwd_link),
@@ -9,6 +9,7 @@
 #include <linux/mempolicy.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/huge_mm.h>
 
 #include <asm/elf.h>
 #include <asm/uaccess.h>
@@ -339,10 +340,87 @@ struct mem_size_stats {
 	unsigned long private_clean;
 	unsigned long private_dirty;
 	unsigned long referenced;
+	unsigned long anonymous_thp;
 	unsigned long swap;
 	u64 pss;
 };
 
+static void smaps_account(struct mem_size_stats *mss, struct page *page,
+			  int young, int dirty)
+{
+	int mapcount;
+
+	mss->resident += PAGE_SIZE;
+	/* Accumulate the size in pages that have been accessed. */
+	if (young || PageReferenced(page))
+		mss->referenced += PAGE_SIZE;
+	mapcount = page_mapcount(page);
+	if (mapcount >= 2) {
+		if (dirty)
+			mss->shared_dirty += PAGE_SIZE;
+		else
+			mss->shared_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
+	} else {
+		if (dirty)
+			mss->private_dirty += PAGE_SIZE;
+		else
+			mss->private_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT);
+	}
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Account a huge pmd, returns 0 if it was split from under us.  An
+ * anonymous huge page is shared after fork() like a small page; the
+ * page cache pages behind a file huge pmd are accounted one by one.
+ */
+static int smaps_huge_pmd(pmd_t *pmd, struct mem_size_stats *mss,
+			  struct mm_struct *mm)
+{
+	struct page *page;
+	int i, ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && !PageAnon(pmd_page(*pmd))) {
+		page = pmd_page(*pmd);
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			smaps_account(mss, page + i, pmd_young(*pmd),
+				      pmd_dirty(*pmd));
+		ret = 1;
+	} else if (pmd_trans_huge(*pmd)) {
+		int mapcount;
+
+		page = pmd_page(*pmd);
+		mapcount = page_mapcount(page);
+		mss->resident += HPAGE_PMD_SIZE;
+		mss->anonymous_thp += HPAGE_PMD_SIZE;
+		if (pmd_young(*pmd) || PageReferenced(page))
+			mss->referenced += HPAGE_PMD_SIZE;
+		if (mapcount >= 2) {
+			if (pmd_dirty(*pmd))
+				mss->shared_dirty += HPAGE_PMD_SIZE;
+			else
+				mss->shared_clean += HPAGE_PMD_SIZE;
+			mss->pss += ((u64)HPAGE_PMD_SIZE << PSS_SHIFT) /
+				    mapcount;
+		} else {
+			if (pmd_dirty(*pmd))
+				mss->private_dirty += HPAGE_PMD_SIZE;
+			else
+				mss->private_clean += HPAGE_PMD_SIZE;
+			mss->pss += (u64)HPAGE_PMD_SIZE << PSS_SHIFT;
+		}
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+#else
+#define smaps_huge_pmd(pmd, mss, mm)	0
+#endif
+
 static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 			   struct mm_walk *walk)
 {
@@ -351,7 +429,11 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	pte_t *pte, ptent;
 	spinlock_t *ptl;
 	struct page *page;
-	int mapcount;
+
+	if (pmd_trans_huge(*pmd) && smaps_huge_pmd(pmd, mss, vma->vm_mm)) {
+		cond_resched();
+		return 0;
+	}
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
@@ -369,24 +451,7 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 		if (!page)
 			continue;
 
-		mss->resident += PAGE_SIZE;
-		/* Accumulate the size in pages that have been accessed. */
-		if (pte_young(ptent) || PageReferenced(page))
-			mss->referenced += PAGE_SIZE;
-		mapcount = page_mapcount(page);
-		if (mapcount >= 2) {
-			if (pte_dirty(ptent))
-				mss->shared_dirty += PAGE_SIZE;
-			else
-				mss->shared_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
-		} else {
-			if (pte_dirty(ptent))
-				mss->private_dirty += PAGE_SIZE;
-			else
-				mss->private_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT);
-		}
+		smaps_account(mss, page, pte_young(ptent), pte_dirty(ptent));
 	}
 	pte_unmap_unlock(pte - 1, ptl);
 	cond_resched();
@@ -422,6 +487,7 @@ static int show_smap(struct seq_file *m, void *v)
 		   "Private_Clean:  %8lu kB\n"
 		   "Private_Dirty:  %8lu kB\n"
 		   "Referenced:     %8lu kB\n"
+		   "AnonHugePages:  %8lu kB\n"
 		   "Swap:           %8lu kB\n"
 		   "KernelPageSize: %8lu kB\n"
 		   "MMUPageSize:    %8lu kB\n",
@@ -433,6 +499,7 @@ static int show_smap(struct seq_file *m, void *v)
 		   mss.private_clean >> 10,
 		   mss.private_dirty >> 10,
 		   mss.referenced >> 10,
+		   mss.anonymous_thp >> 10,
 		   mss.swap >> 10,
 		   vma_kernel_pagesize(vma) >> 10,
 		   vma_mmu_pagesize(vma) >> 10);
@@ -461,6 +528,29 @@ const struct file_operations proc_smaps_operations = {
 	.release	= seq_release_private,
 };
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* Returns 0 if the huge pmd was split from under us */
+static int clear_refs_huge_pmd(pmd_t *pmd, unsigned long addr,
+			       struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd)) {
+		/* Clear accessed and referenced bits. */
+		set_pmd_at(mm, addr, pmd, pmd_mkold(*pmd));
+		flush_tlb_range(vma, addr, addr + HPAGE_PMD_SIZE);
+		ClearPageReferenced(pmd_page(*pmd));
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+#else
+#define clear_refs_huge_pmd(pmd, addr, vma)	0
+#endif
+
 static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 				unsigned long end, struct mm_walk *walk)
 {
@@ -469,6 +559,11 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 	spinlock_t *ptl;
 	struct page *page;
 
+	if (pmd_trans_huge(*pmd) && clear_refs_huge_pmd(pmd, addr, vma)) {
+		cond_resched();
+		return 0;
+	}
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
 		ptent = *pte;
@@ -624,6 +719,32 @@ static int pagemap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	pte_t *pte;
 	int err = 0;
 
+	if (pmd_trans_huge(*pmd)) {
+		struct mm_struct *mm = walk->mm;
+		unsigned long pfn = 0;
+
+		spin_lock(&mm->page_table_lock);
+		if (pmd_trans_huge(*pmd))
+			pfn = page_to_pfn(pmd_page(*pmd));
+		spin_unlock(&mm->page_table_lock);
+		if (pfn) {
+			/* report the subpages, as for a hugetlb page */
+			for (; addr != end; addr += PAGE_SIZE) {
+				int offset = (addr & ~HPAGE_PMD_MASK) >>
+					PAGE_SHIFT;
+
+				err = add_to_pagemap(addr,
+						     PM_PFRAME(pfn + offset) |
+						     PM_PSHIFT(PAGE_SHIFT) |
+						     PM_PRESENT, pm);
+				if (err)
+					return err;
+			}
+			cond_resched();
+			return 0;
+		}
+	}
+
 	/* find the first VMA at or above 'addr' */
 	vma = find_vma(walk->mm, addr);
 	for (; addr != end; addr += PAGE_SIZE) {
@@ -193,11 +193,38 @@ static inline int pud_none_or_clear_bad(pud_t *pud)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+static inline int pmd_trans_splitting(pmd_t pmd)
+{
+	return 0;
+}
+#else
+#ifndef __HAVE_ARCH_PMD_SAME
+static inline int pmd_same(pmd_t pmd_a, pmd_t pmd_b)
+{
+	return pmd_val(pmd_a) == pmd_val(pmd_b);
+}
+#endif
+#endif
+
+/*
+ * Walkers which care about transparent huge pmds must deal with them
+ * before calling this.  A huge pmd can still show up here when a fault
+ * races with a walker holding mmap_sem for read: it is treated like the
+ * none pmd the walker would have seen a moment earlier, instead of
+ * being cleared as bad.
+ */
 static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 {
-	if (pmd_none(*pmd))
+	pmd_t pmdval = *pmd;
+
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval))
 		return 1;
-	if (unlikely(pmd_bad(*pmd))) {
+	if (unlikely(pmd_bad(pmdval))) {
 		pmd_clear_bad(pmd);
 		return 1;
 	}
@@ -6,6 +6,7 @@
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
+#include <linux/wait.h>
 
 #include <asm/atomic.h>
 
@@ -13,6 +14,7 @@
 #define AIO_KIOGRP_NR_ATOMIC	8
 
 struct kioctx;
+struct aio_sq;
 
 /* Notes on cancelling a kiocb:
  *	If a kiocb is cancelled, aio_complete may return 0 to indicate 
@@ -34,6 +36,7 @@ struct kioctx;
 /* #define KIF_LOCKED		0 */
 #define KIF_KICKED		1
 #define KIF_CANCELLED		2
+#define KIF_FIXED_FILE		3	/* ki_filp is held by the kioctx */
 
 #define kiocbTryLock(iocb)	test_and_set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbTryKick(iocb)	test_and_set_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -41,6 +44,7 @@ struct kioctx;
 #define kiocbSetLocked(iocb)	set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbSetKicked(iocb)	set_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbSetCancelled(iocb)	set_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbSetFixedFile(iocb)	set_bit(KIF_FIXED_FILE, &(iocb)->ki_flags)
 
 #define kiocbClearLocked(iocb)	clear_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbClearKicked(iocb)	clear_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -49,6 +53,7 @@ struct kioctx;
 #define kiocbIsLocked(iocb)	test_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbIsKicked(iocb)	test_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbIsCancelled(iocb)	test_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbIsFixedFile(iocb)	test_bit(KIF_FIXED_FILE, &(iocb)->ki_flags)
 
 /* is there a better place to document function pointer methods? */
 /**
@@ -77,8 +82,8 @@ struct kioctx;
  *
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
- * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
+ * through generic helpers that queue kiocb->ki_wait on a wait queue head,
+ * as buffered reads do with lock_page_async().  It can also happen
  * with custom tracking and manual calls to kick_iocb(), though that is
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
@@ -123,6 +128,13 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * Queued on a page's wait queue when a buffered read has to wait
+	 * for the page: unlocking it kicks a retry, see lock_page_async().
+	 */
+	struct wait_bit_queue	ki_wait;
+	wait_queue_head_t	*ki_wait_head;	/* where ki_wait was queued */
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -197,6 +209,11 @@ struct kioctx {
 
 	struct aio_ring_info	ring_info;
 
+	/* io_ring_setup() contexts only */
+	struct aio_sq		*sq;
+	struct file		**fixed_files;
+	unsigned		nr_fixed_files;
+
 	struct delayed_work	wq;
 
 	struct rcu_head		rcu_head;
@@ -53,6 +53,12 @@ enum {
  *                   is valid.
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
+/*
+ * IOCB_FLAG_FIXED_FILE - Set if "aio_fildes" is an index into the files
+ *                        registered with io_ring_register() rather than
+ *                        a file descriptor.
+ */
+#define IOCB_FLAG_FIXED_FILE	(1 << 1)
 
 /* read() from /dev/aio returns these structures. */
 struct io_event {
@@ -104,6 +110,44 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/*
+ * Submission ring, set up by io_ring_setup() and mapped into the caller's
+ * address space at aio_ring_params.sq_ring.  User space fills iocbs[] at
+ * tail and advances it, the kernel consumes entries at head.  Both are
+ * free running: the slot of an index is index & (nr - 1).
+ */
+#define AIO_SQ_NEED_WAKEUP	(1 << 0)	/* poll thread is asleep */
+
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by user space */
+	__u32	nr;		/* number of entries, a power of two */
+	__u32	flags;		/* AIO_SQ_ flags, written by the kernel */
+	__u32	header_length;	/* size of the header, offset of iocbs[] */
+	__u32	reserved[11];
+
+	struct iocb	iocbs[0];
+}; /* 64 byte header */
+
+/* aio_ring_params.flags */
+#define AIO_RING_SQPOLL		(1 << 0)	/* a kernel thread submits */
+
+struct aio_ring_params {
+	__u32	nr_events;	/* completion ring size, as for io_setup */
+	__u32	nr_sq;		/* submission ring size, rounded up */
+	__u32	flags;		/* AIO_RING_ flags */
+	__u32	sq_idle_ms;	/* AIO_RING_SQPOLL thread idle time */
+	__u64	ctx_id;		/* returned: the aio_context_t */
+	__u64	sq_ring;	/* returned: address of struct aio_sq_ring */
+	__u64	reserved[2];
+};
+
+/* io_ring_enter() flags */
+#define AIO_ENTER_SQ_WAKEUP	(1 << 0)	/* wake the poll thread */
+
+/* io_ring_register() opcodes */
+#define AIO_REGISTER_FILES	0
+
 #undef IFBIG
 #undef IFLITTLE
 
@@ -0,0 +1,128 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_tags;
+struct blk_mq_ctx;
+
+/*
+ * A hardware dispatch context. Each one owns a private tag space and a
+ * preallocated set of requests, and is fed from the per-cpu software
+ * queues that map to it.
+ */
+struct blk_mq_hw_ctx {
+	spinlock_t		lock ____cacheline_aligned_in_smp;
+	struct list_head	dispatch;	/* requests the driver bounced */
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+	cpumask_var_t		cpumask;
+
+	unsigned long		flags;		/* BLK_MQ_F_* flags */
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+
+	void			*driver_data;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;	/* software queues with work */
+
+	struct request		**rqs;
+	struct list_head	page_list;
+	struct blk_mq_tags	*tags;
+
+	unsigned int		queue_depth;
+	unsigned int		cmd_size;	/* per-request driver payload */
+
+	unsigned int		numa_node;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *,
+					     const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Queue request. May be called concurrently for different hardware
+	 * contexts, but never for the same one. A driver returning
+	 * BLK_MQ_RQ_QUEUE_BUSY must stop the hardware context, and restart
+	 * it once it can make progress again.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Map a software queue (cpu) to a hardware context
+	 */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * Called when the block layer side of a hardware queue has been
+	 * set up and torn down, allowing the driver to attach its own data
+	 */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;
+	unsigned int		cmd_size;	/* per-request extra data */
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* */
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+	BLK_MQ_S_RUNNING	= 1,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+void blk_mq_free_queue(struct request_queue *);
+
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp);
+void blk_mq_free_request(struct request *rq);
+void blk_mq_insert_request(struct request_queue *, struct request *, int, int);
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+void blk_mq_end_io(struct request *rq, int error);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, int async);
+void blk_mq_run_queues(struct request_queue *q, int async);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, int async);
+
+/*
+ * Driver command data is immediately after the request. So subtract request
+ * size to get back to the original request.
+ */
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif
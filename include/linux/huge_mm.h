@@ -0,0 +1,172 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: anonymous memory mapped by huge pmds.
+ *
+ * A transparent huge page is a compound page of HPAGE_PMD_ORDER mapped
+ * by huge pmds only: fork() shares it write protected, and the first
+ * write copies it, like a small anonymous page.  It is not on the LRU:
+ * when the VM needs to treat it like normal memory (reclaim,
+ * get_user_pages, partial unmap or mprotect, ...) every pmd mapping it
+ * is split into a pte table mapping the small pages the huge page is
+ * then broken into.  A pmd being split is marked with
+ * pmd_trans_splitting(): whoever finds one under the page_table_lock
+ * must drop the lock and wait_split_huge_page() before going on.
+ *
+ * A huge pmd in a shared file mapping (tmpfs, see vm_ops->pmd_fault)
+ * maps HPAGE_PMD_NR contiguous page cache pages instead, which are
+ * normal pages on the LRU all along: splitting that pmd only replaces
+ * it with ptes.  The two kinds are told apart by PageAnon().
+ */
+
+#include <linux/mm.h>
+
+struct mem_cgroup;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+struct mmu_gather;
+
+#define HPAGE_PMD_SHIFT PMD_SHIFT
+#define HPAGE_PMD_SIZE	(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER (HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR	(1 << HPAGE_PMD_ORDER)
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+};
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * The vm_flags which rule out huge pmds: the vma must be plain private
+ * anonymous memory.
+ */
+#define VM_NO_THP	(VM_SPECIAL | VM_HUGETLB | VM_SHARED | VM_MAYSHARE | \
+			 VM_NONLINEAR | VM_INSERTPAGE | VM_MIXEDMAP | VM_SAO)
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_ops || vma->vm_file || (vma->vm_flags & VM_NO_THP))
+		return 0;
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return 1;
+	return test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags) &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      unsigned int flags);
+extern int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd,
+			     pmd_t orig_pmd, unsigned int flags);
+extern int do_huge_pmd_file_page(struct vm_area_struct *vma,
+				 unsigned long address, pmd_t *pmd,
+				 struct page *page, unsigned int flags);
+extern struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+					  unsigned long address, pmd_t *pmd,
+					  unsigned int flags);
+extern int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			 pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
+			 struct vm_area_struct *vma);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+extern int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			   unsigned long addr, pgprot_t newprot);
+
+extern void wait_split_huge_page(struct mm_struct *mm, pmd_t *pmd);
+extern void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+				  pmd_t *pmd);
+#define split_huge_page_pmd(__mm, __address, __pmd)			\
+	do {								\
+		pmd_t *____pmd = (__pmd);				\
+		if (unlikely(pmd_trans_huge(*____pmd)))			\
+			__split_huge_page_pmd(__mm, __address, ____pmd);\
+	} while (0)
+
+extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+				    unsigned long start, unsigned long end,
+				    long adjust_next);
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+	/* only anonymous vmas and vmas with ->pmd_fault have huge pmds */
+	if (vma->vm_ops) {
+		if (!vma->vm_ops->pmd_fault)
+			return;
+	} else if (!vma->anon_vma || vma->vm_file)
+		return;
+	__vma_adjust_trans_huge(vma, start, end, adjust_next);
+}
+
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+extern unsigned long split_huge_pages_zone(struct zone *zone,
+					   unsigned long nr_to_split,
+					   struct mem_cgroup *mem);
+
+#else /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SHIFT ({ BUG(); 0; })
+#define HPAGE_PMD_MASK ({ BUG(); 0; })
+#define HPAGE_PMD_SIZE ({ BUG(); 0; })
+#define HPAGE_PMD_NR ({ BUG(); 0; })
+
+#define transparent_hugepage_enabled(__vma) 0
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+					     struct vm_area_struct *vma,
+					     unsigned long address, pmd_t *pmd,
+					     unsigned int flags)
+{
+	BUG();
+	return 0;
+}
+static inline int do_huge_pmd_fault(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address, pmd_t *pmd,
+				    pmd_t orig_pmd, unsigned int flags)
+{
+	BUG();
+	return 0;
+}
+#define follow_trans_huge_pmd(__vma, __address, __pmd, __flags) \
+	({ BUG(); NULL; })
+#define copy_huge_pmd(__dst_mm, __src_mm, __dst_pmd, __src_pmd, __addr, \
+		      __vma) ({ BUG(); 0; })
+#define zap_huge_pmd(__tlb, __vma, __pmd) ({ BUG(); 0; })
+#define change_huge_pmd(__vma, __pmd, __addr, __newprot) ({ BUG(); 0; })
+#define wait_split_huge_page(__mm, __pmd)	do { } while (0)
+#define split_huge_page_pmd(__mm, __address, __pmd)	do { } while (0)
+
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+}
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	BUG();
+	return 0;
+}
+static inline unsigned long split_huge_pages_zone(struct zone *zone,
+						  unsigned long nr_to_split,
+						  struct mem_cgroup *mem)
+{
+	return 0;
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
@@ -53,6 +53,12 @@ struct tpacket_stats {
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3 {
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;
+};
+
 struct tpacket_auxdata {
 	__u32		tp_status;
 	__u32		tp_len;
@@ -68,6 +74,7 @@ struct tpacket_auxdata {
 #define TP_STATUS_COPY		0x2
 #define TP_STATUS_LOSING	0x4
 #define TP_STATUS_CSUMNOTREADY	0x8
+#define TP_STATUS_BLK_TMO	0x20
 
 /* Tx ring - header status */
 #define TP_STATUS_AVAILABLE	0x0
@@ -102,9 +109,65 @@ struct tpacket2_hdr {
 
 #define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket3_hdr {
+	__u32		tp_next_offset;	/* to the next packet, 0 if last */
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	__u16		tp_vlan_tci;
+	__u16		tp_padding;
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts {
+	unsigned int	ts_sec;
+	union {
+		unsigned int	ts_usec;
+		unsigned int	ts_nsec;
+	};
+};
+
+struct tpacket_hdr_v1 {
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+
+	/*
+	 * Number of valid bytes in the block, including the block
+	 * descriptor and the private area.
+	 */
+	__u32		blk_len;
+
+	/*
+	 * Incremented for every block handed to user space, so a reader
+	 * can tell whether it missed any.
+	 */
+	__u64		seq_num __attribute__((aligned(8)));
+
+	struct tpacket_bd_ts	ts_first_pkt, ts_last_pkt;
+};
+
+union tpacket_bd_header_u {
+	struct tpacket_hdr_v1 bh1;
+};
+
+struct tpacket_block_desc {
+	__u32		version;
+	__u32		offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
+#define TPACKET3_BLKHDRLEN	TPACKET_ALIGN(sizeof(struct tpacket_block_desc))
+
 enum tpacket_versions {
 	TPACKET_V1,
 	TPACKET_V2,
+	TPACKET_V3,
 };
 
 /*
@@ -118,6 +181,16 @@ enum tpacket_versions {
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   Block structure (TPACKET_V3, receive ring only):
+
+   - Start. Block is aligned to the page size
+   - struct tpacket_block_desc
+   - Optional private area of tp_sizeof_priv bytes, aligned to
+     TPACKET_ALIGNMENT=16
+   - Packets, each laid out like a frame above but with a struct
+     tpacket3_hdr, packed back to back. tp_next_offset leads from one
+     to the next, num_pkts tells how many there are.
  */
 
 struct tpacket_req {
@@ -127,6 +200,21 @@ struct tpacket_req {
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+struct tpacket_req3 {
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Size of frame */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* timeout in msecs */
+	unsigned int	tp_sizeof_priv; /* offset to private data area */
+	unsigned int	tp_feature_req_word;
+};
+
+union tpacket_req_u {
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
 struct packet_mreq {
 	int		mr_ifindex;
 	unsigned short	mr_type;
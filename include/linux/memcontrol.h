@@ -128,6 +128,11 @@ void mem_cgroup_update_file_mapped(struct page *page, int val);
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask, int nid,
 						int zid);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail);
+bool mem_cgroup_page_charged_to(struct page *page, struct mem_cgroup *mem);
+#endif
 #else /* CONFIG_CGROUP_MEM_RES_CTLR */
 struct mem_cgroup;
 
@@ -306,6 +311,17 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 	return 0;
 }
 
+static inline void mem_cgroup_split_huge_fixup(struct page *head,
+					       struct page *tail)
+{
+}
+
+static inline bool mem_cgroup_page_charged_to(struct page *page,
+					      struct mem_cgroup *mem)
+{
+	return true;
+}
+
 #endif /* CONFIG_CGROUP_MEM_CONT */
 
 #endif /* _LINUX_MEMCONTROL_H */
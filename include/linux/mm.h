@@ -97,7 +97,11 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_NORESERVE	0x00200000	/* should the VM suppress accounting */
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
 #define VM_MAPPED_COPY	0x01000000	/* T if mapped copy of data (nommu mmap) */
+#else
+#define VM_HUGEPAGE	0x01000000	/* MADV_HUGEPAGE marked this vma */
+#endif
 #define VM_INSERTPAGE	0x02000000	/* The vma has had "vm_insert_page()" done on it */
 #define VM_ALWAYSDUMP	0x04000000	/* Always include in core dumps */
 
@@ -196,6 +200,13 @@ struct vm_operations_struct {
 	 */
 	int (*access)(struct vm_area_struct *vma, unsigned long addr,
 		      void *buf, int len, int write);
+
+	/* called on a fault on an empty pmd: it may map the whole pmd range
+	 * with a huge pmd, otherwise it returns VM_FAULT_FALLBACK and the
+	 * fault is handled with small pages by fault() as usual
+	 */
+	int (*pmd_fault)(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd, unsigned int flags);
 #ifdef CONFIG_NUMA
 	/*
 	 * set_policy() op must add a reference to any non-NULL @new mempolicy
@@ -335,6 +346,7 @@ void put_page(struct page *page);
 void put_pages_list(struct list_head *pages);
 
 void split_page(struct page *page, unsigned int order);
+int split_free_page(struct page *page);
 
 /*
  * Compound pages have a destructor function.  Provide a
@@ -714,6 +726,7 @@ static inline int page_mapped(struct page *page)
 
 #define VM_FAULT_NOPAGE	0x0100	/* ->fault installed the pte, not return page */
 #define VM_FAULT_LOCKED	0x0200	/* ->fault locked the returned page */
+#define VM_FAULT_FALLBACK 0x0800	/* huge page fault failed, fall back to small */
 
 #define VM_FAULT_ERROR	(VM_FAULT_OOM | VM_FAULT_SIGBUS | VM_FAULT_HWPOISON)
 
@@ -730,7 +743,8 @@ int shmem_lock(struct file *file, int lock, struct user_struct *user);
 struct file *shmem_file_setup(const char *name, loff_t size, unsigned long flags);
 int shmem_zero_setup(struct vm_area_struct *);
 
-#ifndef CONFIG_MMU
+#if !defined(CONFIG_MMU) || \
+	(defined(CONFIG_SHMEM) && defined(CONFIG_TRANSPARENT_HUGEPAGE))
 extern unsigned long shmem_get_unmapped_area(struct file *file,
 					     unsigned long addr,
 					     unsigned long len,
@@ -1302,6 +1316,17 @@ void task_dirty_inc(struct task_struct *tsk);
 #define VM_MAX_READAHEAD	128	/* kbytes */
 #define VM_MIN_READAHEAD	16	/* kbytes (includes current page) */
 
+/* How ondemand readahead classified a read, for the readahead tracepoint */
+enum ra_pattern {
+	RA_PATTERN_INITIAL,	/* start of file, or a new stream */
+	RA_PATTERN_SEQUENTIAL,	/* expected offset of the current stream */
+	RA_PATTERN_STREAM,	/* expected offset of another stream */
+	RA_PATTERN_MARKER,	/* hit PG_readahead of an unknown window */
+	RA_PATTERN_CONTEXT,	/* cached history pages before the read */
+	RA_PATTERN_OVERSIZE,	/* read larger than the readahead maximum */
+	RA_PATTERN_RANDOM,	/* none of the above: no readahead */
+};
+
 int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			pgoff_t offset, unsigned long nr_to_read);
 
@@ -310,6 +310,15 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* page tables set aside for splitting huge pmds, page_table_lock */
+	pgtable_t pmd_huge_pte;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* when and where the next NUMA hinting scan of the mm starts */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
@@ -223,6 +223,7 @@ struct netif_rx_stats {
 	unsigned dropped;
 	unsigned time_squeeze;
 	unsigned cpu_collision;
+	unsigned received_rps;
 };
 
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
@@ -530,6 +531,28 @@ struct netdev_queue {
 	unsigned long		tx_dropped;
 } ____cacheline_aligned_in_smp;
 
+#ifdef CONFIG_RPS
+/*
+ * The set of cpus that packets from a receive queue are steered to,
+ * indexed by flow hash. Replaced as a whole under RCU.
+ */
+struct rps_map {
+	unsigned int		len;
+	struct rcu_head		rcu;
+	u16			cpus[0];
+};
+#define RPS_MAP_SIZE(_num) (sizeof(struct rps_map) + ((_num) * sizeof(u16)))
+
+/*
+ * Receive queue state. Only exists for steering, packets are still
+ * handed to the stack through netif_receive_skb() and netif_rx().
+ */
+struct netdev_rx_queue {
+	struct rps_map		*rps_map;
+	struct kobject		kobj;
+} ____cacheline_aligned_in_smp;
+#endif /* CONFIG_RPS */
+
 
 /*
  * This structure defines the management hooks for network devices.
@@ -880,6 +903,15 @@ struct net_device {
 
 	struct netdev_queue	rx_queue;
 
+#ifdef CONFIG_RPS
+	struct kset		*queues_kset;
+
+	struct netdev_rx_queue	*_rx;
+
+	/* Number of RX queues allocated at alloc_netdev_mq() time  */
+	unsigned int		num_rx_queues;
+#endif
+
 	struct netdev_queue	*_tx ____cacheline_aligned_in_smp;
 
 	/* Number of TX queues allocated at alloc_netdev_mq() time  */
@@ -1306,15 +1338,25 @@ static inline int unregister_gifconf(unsigned int family)
 }
 
 /*
- * Incoming packets are placed on per-cpu queues so that
- * no locking is needed.
+ * Incoming packets are placed on per-cpu queues. Without RPS only the
+ * owning cpu touches them, so no locking is needed. With RPS other cpus
+ * may append to input_pkt_queue, which is then protected by its lock.
  */
 struct softnet_data {
 	struct Qdisc		*output_queue;
-	struct sk_buff_head	input_pkt_queue;
 	struct list_head	poll_list;
 	struct sk_buff		*completion_queue;
 
+#ifdef CONFIG_RPS
+	/* remote backlogs this cpu has to kick at the end of net_rx_action */
+	struct softnet_data	*rps_ipi_list;
+
+	/* Elements below can be accessed between cpus for RPS */
+	struct call_single_data	csd ____cacheline_aligned_in_smp;
+	struct softnet_data	*rps_ipi_next;
+	unsigned int		cpu;
+#endif
+	struct sk_buff_head	input_pkt_queue;
 	struct napi_struct	backlog;
 };
 
@@ -179,6 +179,19 @@ void *ring_buffer_alloc_read_page(struct ring_buffer *buffer);
 void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data);
 int ring_buffer_read_page(struct ring_buffer *buffer, void **data_page,
 			  size_t len, int cpu, int full);
+int ring_buffer_read_pages(struct ring_buffer *buffer, void **pages,
+			   int nr_pages, int cpu);
+
+struct ring_buffer_merge_iter;
+
+struct ring_buffer_merge_iter *
+ring_buffer_merge_start(struct ring_buffer *buffer);
+void ring_buffer_merge_finish(struct ring_buffer_merge_iter *miter);
+struct ring_buffer_event *
+ring_buffer_merge_peek(struct ring_buffer_merge_iter *miter, int *cpu, u64 *ts);
+struct ring_buffer_event *
+ring_buffer_merge_consume(struct ring_buffer_merge_iter *miter,
+			  int *cpu, u64 *ts);
 
 struct trace_seq;
 
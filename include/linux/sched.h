@@ -436,6 +436,7 @@ extern int get_dumpable(struct mm_struct *mm);
 #endif
 					/* leave room for more dump flags */
 #define MMF_VM_MERGEABLE	16	/* KSM may merge identical pages */
+#define MMF_VM_HUGEPAGE		17	/* registered with khugepaged */
 
 #define MMF_INIT_MASK		(MMF_DUMPABLE_MASK | MMF_DUMP_FILTER_MASK)
 
@@ -1138,6 +1139,8 @@ struct sched_entity {
 	u64			nr_wakeups_affine_attempts;
 	u64			nr_wakeups_passive;
 	u64			nr_wakeups_idle;
+	u64			nr_wakeups_pair;
+	u64			nr_wakeups_wide;
 #endif
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -1180,6 +1183,10 @@ struct task_struct {
 #ifdef __ARCH_WANT_UNLOCKED_CTXSW
 	int oncpu;
 #endif
+	/* wakeup placement, see record_wakee() */
+	struct task_struct *last_wakee;	/* compared only, never dereferenced */
+	unsigned int wakee_flips;
+	unsigned long wakee_flip_decay_ts;
 #endif
 
 	int prio, static_prio, normal_prio;
@@ -1449,6 +1456,15 @@ struct task_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *mempolicy;	/* Protected by alloc_lock */
 	short il_next;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_preferred_nid;		/* node most faults were on, or -1 */
+	int numa_work_pending;
+	unsigned long numa_scan_next;	/* jiffies */
+	unsigned long *numa_faults;	/* recent hinting faults per node */
+	unsigned long numa_faults_local;
+	unsigned long numa_faults_remote;
+	unsigned long numa_pages_migrated;
 #endif
 	atomic_t fs_excl;	/* holding fs exclusive resources */
 	struct rcu_head rcu;
@@ -1699,6 +1715,7 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 #define PF_EXITING	0x00000004	/* getting shut down */
 #define PF_EXITPIDONE	0x00000008	/* pi exit done on shut down */
 #define PF_VCPU		0x00000010	/* I'm a virtual CPU */
+#define PF_WQ_WORKER	0x00000020	/* I'm a workqueue worker */
 #define PF_FORKNOEXEC	0x00000040	/* forked but didn't exec */
 #define PF_MCE_PROCESS  0x00000080      /* process policy on mce errors */
 #define PF_SUPERPRIV	0x00000100	/* used super-user privileges */
@@ -1867,6 +1884,26 @@ extern unsigned int sysctl_sched_shares_ratelimit;
 extern unsigned int sysctl_sched_shares_thresh;
 extern unsigned int sysctl_sched_child_runs_first;
 
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_period;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_work(void);
+extern void task_numa_fault(int page_nid, int this_nid, int migrated);
+extern void task_numa_free(struct task_struct *p);
+#else
+static inline void task_numa_work(void)
+{
+}
+static inline void task_numa_fault(int page_nid, int this_nid, int migrated)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif
+
 enum sched_tunable_scaling {
 	SCHED_TUNABLESCALING_NONE,
 	SCHED_TUNABLESCALING_LOG,
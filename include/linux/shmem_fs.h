@@ -31,6 +31,7 @@ struct shmem_sb_info {
 	gid_t gid;		    /* Mount gid for root directory */
 	mode_t mode;		    /* Mount mode for root directory */
 	struct mempolicy *mpol;     /* default memory policy for mappings */
+	int huge;		    /* Allocate huge pages: huge=always */
 };
 
 static inline struct shmem_inode_info *SHMEM_I(struct inode *inode)
@@ -32,12 +32,18 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	FREE_REMOTE_QUEUED,	/* Freeing queued for a slab not the cpu slab */
+	FREE_REMOTE_FLUSH,	/* Queued objects returned to their slab */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to first free per cpu object */
 	struct page *page;	/* The slab from which we are allocating */
 	int node;		/* The node of the page (or -1 for debug) */
+	int remote_count;	/* Number of objects in the remote queue */
+	struct page *remote_page;	/* The slab they are to be freed to */
+	void **remote_freelist;	/* Objects queued for remote_page */
+	void **remote_tail;	/* Last object of remote_freelist */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
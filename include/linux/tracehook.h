@@ -593,6 +593,7 @@ static inline void set_notify_resume(struct task_struct *task)
  */
 static inline void tracehook_notify_resume(struct pt_regs *regs)
 {
+	task_numa_work();
 }
 #endif	/* TIF_NOTIFY_RESUME */
 
@@ -26,7 +26,12 @@ struct work_struct {
 	atomic_long_t data;
 #define WORK_STRUCT_PENDING 0		/* T if work item pending execution */
 #define WORK_STRUCT_STATIC  1		/* static initializer (debugobjects) */
-#define WORK_STRUCT_FLAG_MASK (3UL)
+#define WORK_STRUCT_DELAYED 2		/* T if work item is delayed by max_active */
+#define WORK_STRUCT_LINKED  3		/* T if next work is linked to this one */
+#define WORK_STRUCT_COLOR_SHIFT 4	/* color for workqueue flushing */
+#define WORK_STRUCT_COLOR_BITS 2
+#define WORK_STRUCT_FLAG_BITS (WORK_STRUCT_COLOR_SHIFT + WORK_STRUCT_COLOR_BITS)
+#define WORK_STRUCT_FLAG_MASK ((1UL << WORK_STRUCT_FLAG_BITS) - 1)
 #define WORK_STRUCT_WQ_DATA_MASK (~WORK_STRUCT_FLAG_MASK)
 	struct list_head entry;
 	work_func_t func;
@@ -38,6 +43,13 @@ struct work_struct {
 #define WORK_DATA_INIT()	ATOMIC_LONG_INIT(0)
 #define WORK_DATA_STATIC_INIT()	ATOMIC_LONG_INIT(2)
 
+/*
+ * flush_workqueue() alternates between two colors; barriers used by
+ * flush_work() and cancel_work_sync() carry no color.
+ */
+#define WORK_NR_COLORS		2
+#define WORK_NO_COLOR		3
+
 struct delayed_work {
 	struct work_struct work;
 	struct timer_list timer;
@@ -180,13 +192,23 @@ static inline void destroy_work_on_stack(struct work_struct *work) { }
 	clear_bit(WORK_STRUCT_PENDING, work_data_bits(work))
 
 
+/*
+ * Workqueue flags and constants.  For details, please refer to
+ * Documentation/workqueue.txt.
+ */
+#define WQ_FREEZEABLE		(1 << 0) /* freeze during suspend */
+#define WQ_SINGLE_CPU		(1 << 1) /* run all works on one cpu */
+#define WQ_RESCUER		(1 << 2) /* has a rescue worker */
+
+#define WQ_MAX_ACTIVE		512	 /* max in-flight works per cpu */
+#define WQ_DFL_ACTIVE		(WQ_MAX_ACTIVE / 2)
+
 extern struct workqueue_struct *
-__create_workqueue_key(const char *name, int singlethread,
-		       int freezeable, int rt, struct lock_class_key *key,
-		       const char *lock_name);
+__alloc_workqueue_key(const char *name, unsigned int flags, int max_active,
+		      struct lock_class_key *key, const char *lock_name);
 
 #ifdef CONFIG_LOCKDEP
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
+#define alloc_workqueue(name, flags, max_active)		\
 ({								\
 	static struct lock_class_key __key;			\
 	const char *__lock_name;				\
@@ -196,20 +218,25 @@ __create_workqueue_key(const char *name, int singlethread,
 	else							\
 		__lock_name = #name;				\
 								\
-	__create_workqueue_key((name), (singlethread),		\
-			       (freezeable), (rt), &__key,	\
-			       __lock_name);			\
+	__alloc_workqueue_key((name), (flags), (max_active),	\
+			      &__key, __lock_name);		\
 })
 #else
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
-	__create_workqueue_key((name), (singlethread), (freezeable), (rt), \
-			       NULL, NULL)
+#define alloc_workqueue(name, flags, max_active)		\
+	__alloc_workqueue_key((name), (flags), (max_active), NULL, NULL)
 #endif
 
-#define create_workqueue(name) __create_workqueue((name), 0, 0, 0)
-#define create_rt_workqueue(name) __create_workqueue((name), 0, 0, 1)
-#define create_freezeable_workqueue(name) __create_workqueue((name), 1, 1, 0)
-#define create_singlethread_workqueue(name) __create_workqueue((name), 1, 0, 0)
+/*
+ * The legacy interfaces keep their old guarantees: works queued on one
+ * cpu are executed one at a time, and the workqueue can always make
+ * forward progress, even when no new worker can be created.
+ */
+#define create_workqueue(name)					\
+	alloc_workqueue((name), WQ_RESCUER, 1)
+#define create_freezeable_workqueue(name)			\
+	alloc_workqueue((name), WQ_FREEZEABLE | WQ_SINGLE_CPU | WQ_RESCUER, 1)
+#define create_singlethread_workqueue(name)			\
+	alloc_workqueue((name), WQ_SINGLE_CPU | WQ_RESCUER, 1)
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
@@ -297,4 +324,10 @@ static inline long work_on_cpu(unsigned int cpu, long (*fn)(void *), void *arg)
 #else
 long work_on_cpu(unsigned int cpu, long (*fn)(void *), void *arg);
 #endif /* CONFIG_SMP */
+
+#ifdef CONFIG_FREEZER
+extern void freeze_workqueues_begin(void);
+extern bool freeze_workqueues_busy(void);
+extern void thaw_workqueues(void);
+#endif /* CONFIG_FREEZER */
 #endif
@@ -0,0 +1,73 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/tracepoint.h>
+
+#define show_ra_pattern(pattern)					\
+	__print_symbolic(pattern,					\
+		{ RA_PATTERN_INITIAL,		"initial" },		\
+		{ RA_PATTERN_SEQUENTIAL,	"sequential" },		\
+		{ RA_PATTERN_STREAM,		"stream" },		\
+		{ RA_PATTERN_MARKER,		"marker" },		\
+		{ RA_PATTERN_CONTEXT,		"context" },		\
+		{ RA_PATTERN_OVERSIZE,		"oversize" },		\
+		{ RA_PATTERN_RANDOM,		"random" })
+
+/*
+ * Tracepoint for each ondemand readahead decision.  A read which was
+ * served from a known stream shows as sequential or stream (a hit); one
+ * which had to be rediscovered from marker or context, or started a new
+ * window, is a miss for the streams remembered in file_ra_state.
+ */
+TRACE_EVENT(readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, int pattern,
+		 struct file_ra_state *ra, unsigned long actual),
+
+	TP_ARGS(mapping, offset, req_size, pattern, ra, actual),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	req_size	)
+		__field(	int,		pattern		)
+		__field(	pgoff_t,	start		)
+		__field(	unsigned int,	size		)
+		__field(	unsigned int,	async_size	)
+		__field(	unsigned long,	actual		)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->pattern	= pattern;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->actual		= actual;
+	),
+
+	TP_printk("dev=%d:%d ino=%lu pattern=%s offset=%lu req_size=%lu "
+		  "ra=(%lu+%u-%u) actual=%lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev),
+		(unsigned long)__entry->ino,
+		show_ra_pattern(__entry->pattern),
+		(unsigned long)__entry->offset, __entry->req_size,
+		(unsigned long)__entry->start, __entry->size,
+		__entry->async_size, __entry->actual)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -63,7 +63,8 @@ TRACE_EVENT(timer_start,
  * timer_expire_entry - called immediately before the timer callback
  * @timer:	pointer to struct timer_list
  *
- * Allows to determine the timer latency.
+ * Allows to determine the timer latency: the timer wheel runs timers up
+ * to one wheel level granularity after their expiry time.
  */
 TRACE_EVENT(timer_expire_entry,
 
@@ -72,16 +73,22 @@ TRACE_EVENT(timer_expire_entry,
 	TP_ARGS(timer),
 
 	TP_STRUCT__entry(
-		__field( void *,	timer	)
-		__field( unsigned long,	now	)
+		__field( void *,	timer		)
+		__field( void *,	function	)
+		__field( unsigned long,	expires		)
+		__field( unsigned long,	now		)
 	),
 
 	TP_fast_assign(
 		__entry->timer		= timer;
+		__entry->function	= timer->function;
+		__entry->expires	= timer->expires;
 		__entry->now		= jiffies;
 	),
 
-	TP_printk("timer=%p now=%lu", __entry->timer, __entry->now)
+	TP_printk("timer=%p function=%pf now=%lu [late=%ld]",
+		  __entry->timer, __entry->function, __entry->now,
+		  (long)__entry->now - __entry->expires)
 );
 
 /**
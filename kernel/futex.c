@@ -59,6 +59,10 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +70,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Priority Inheritance state:
  */
@@ -130,9 +132,30 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The hash table is sized at boot from the number of possible cpus, or
+ * with futex_hashsize=, and on NUMA spread over the nodes like the other
+ * large system hashes: see futex_init().
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned int futex_hashmask __read_mostly;
+static unsigned long futex_hashsize __initdata;
+
+#ifdef CONFIG_FUTEX_STATS
+struct futex_stats {
+	unsigned long lookups;		/* hash_futex() calls */
+	unsigned long collisions;	/* other futexes' waiters walked */
+	unsigned long contended;	/* bucket lock found held */
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+static DEFINE_PER_CPU(struct futex_stats, futex_stats);
+
+#define futex_stat_inc(item)	this_cpu_inc(futex_stats.item)
+#else
+#define futex_stat_inc(item)	do { } while (0)
+#endif
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -142,7 +165,19 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	futex_stat_inc(lookups);
+	return &futex_queues[hash & futex_hashmask];
+}
+
+static inline void hb_lock(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_FUTEX_STATS
+	if (spin_trylock(&hb->lock))
+		return;
+	futex_stat_inc(contended);
+#endif
+	spin_lock(&hb->lock);
 }
 
 /*
@@ -858,11 +893,11 @@ static inline void
 double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
 {
 	if (hb1 <= hb2) {
-		spin_lock(&hb1->lock);
+		hb_lock(hb1);
 		if (hb1 < hb2)
 			spin_lock_nested(&hb2->lock, SINGLE_DEPTH_NESTING);
 	} else { /* hb1 > hb2 */
-		spin_lock(&hb2->lock);
+		hb_lock(hb2);
 		spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
 	}
 }
@@ -894,7 +929,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	head = &hb->chain;
 
 	plist_for_each_entry_safe(this, next, head, list) {
@@ -911,7 +946,8 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 			wake_futex(this);
 			if (++ret >= nr_wake)
 				break;
-		}
+		} else
+			futex_stat_inc(collisions);
 	}
 
 	spin_unlock(&hb->lock);
@@ -1376,7 +1412,7 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	hb = hash_futex(&q->key);
 	q->lock_ptr = &hb->lock;
 
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	return hb;
 }
 
@@ -2049,7 +2085,7 @@ retry:
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 
 	/*
 	 * To avoid races, try to do the TID -> 0 atomic transition
@@ -2644,10 +2680,83 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+static int __init setup_futex_hashsize(char *str)
+{
+	futex_hashsize = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("futex_hashsize=", setup_futex_hashsize);
+
+#ifdef CONFIG_FUTEX_STATS
+static int futex_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long lookups = 0, collisions = 0, contended = 0;
+	unsigned long used = 0, waiters = 0, max_chain = 0;
+	unsigned int i;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct futex_stats *stats = &per_cpu(futex_stats, cpu);
+
+		lookups += stats->lookups;
+		collisions += stats->collisions;
+		contended += stats->contended;
+	}
+
+	for (i = 0; i <= futex_hashmask; i++) {
+		struct futex_hash_bucket *hb = &futex_queues[i];
+		struct futex_q *this;
+		unsigned long chain = 0;
+
+		if (plist_head_empty(&hb->chain))
+			continue;
+		spin_lock(&hb->lock);
+		plist_for_each_entry(this, &hb->chain, list)
+			chain++;
+		spin_unlock(&hb->lock);
+
+		if (chain)
+			used++;
+		waiters += chain;
+		max_chain = max(max_chain, chain);
+		cond_resched();
+	}
+
+	seq_printf(m, "buckets %u\n", futex_hashmask + 1);
+	seq_printf(m, "buckets_used %lu\n", used);
+	seq_printf(m, "waiters %lu\n", waiters);
+	seq_printf(m, "longest_chain %lu\n", max_chain);
+	seq_printf(m, "lookups %lu\n", lookups);
+	seq_printf(m, "collisions %lu\n", collisions);
+	seq_printf(m, "contended %lu\n", contended);
+	return 0;
+}
+
+static int futex_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, futex_stats_show, NULL);
+}
+
+static const struct file_operations futex_stats_fops = {
+	.open		= futex_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init futex_stats_init(void)
+{
+	debugfs_create_file("futex_stats", 0400, NULL, NULL,
+			    &futex_stats_fops);
+	return 0;
+}
+late_initcall(futex_stats_init);
+#endif
+
 static int __init futex_init(void)
 {
 	u32 curval;
-	int i;
+	unsigned int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2663,7 +2772,20 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+	/*
+	 * Unrelated futexes sharing a bucket contend on its lock, so give
+	 * each cpu a fair number of buckets of its own.
+	 */
+	if (!futex_hashsize)
+		futex_hashsize = roundup_pow_of_two((CONFIG_BASE_SMALL ? 16 : 256)
+						    * num_possible_cpus());
+	futex_queues = alloc_large_system_hash("futex",
+					       sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       NULL, &futex_hashmask,
+					       futex_hashsize);
+
+	for (i = 0; i <= futex_hashmask; i++) {
 		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
 		spin_lock_init(&futex_queues[i].lock);
 	}
@@ -77,6 +77,7 @@
 #include <asm/irq_regs.h>
 
 #include "sched_cpupri.h"
+#include "workqueue_sched.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -598,6 +599,15 @@ struct rq {
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
+#ifdef CONFIG_SMP
+/*
+ * The highest sched_domain of each cpu whose cpus share its last level
+ * cache, and the number of those cpus.  Set by update_top_cache_domain().
+ */
+static DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+static DEFINE_PER_CPU(int, sd_llc_size) = 1;
+#endif
+
 static inline
 void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags)
 {
@@ -2460,6 +2470,10 @@ out_activate:
 	activate_task(rq, p, 1);
 	success = 1;
 
+	/* if a worker is waking up, notify workqueue */
+	if (p->flags & PF_WQ_WORKER)
+		wq_worker_waking_up(p, cpu_of(rq));
+
 	/*
 	 * Only attribute actual wakeups done by this task.
 	 */
@@ -2503,6 +2517,44 @@ out:
 	return success;
 }
 
+/**
+ * try_to_wake_up_local - try to wake up a local task with rq lock held
+ * @p: the thread to be awakened
+ *
+ * Put @p on the run-queue if it's not alredy there.  The caller must
+ * ensure that this_rq() is locked, @p is bound to this_rq() and not
+ * the current task.  this_rq() stays locked over invocation.
+ */
+static void try_to_wake_up_local(struct task_struct *p)
+{
+	struct rq *rq = task_rq(p);
+	bool success = false;
+
+	BUG_ON(rq != this_rq());
+	BUG_ON(p == current);
+
+	if (!(p->state & TASK_NORMAL))
+		return;
+
+	if (!p->se.on_rq) {
+		if (likely(!task_running(rq, p))) {
+			schedstat_inc(rq, ttwu_count);
+			schedstat_inc(rq, ttwu_local);
+		}
+		activate_task(rq, p, 1);
+		success = true;
+	}
+
+	trace_sched_wakeup(rq, p, success);
+	check_preempt_curr(rq, p, 0);
+
+	p->state = TASK_RUNNING;
+#ifdef CONFIG_SMP
+	if (p->sched_class->task_woken)
+		p->sched_class->task_woken(rq, p);
+#endif
+}
+
 /**
  * wake_up_process - Wake up a specific process
  * @p: The process to be woken up.
@@ -2572,9 +2624,17 @@ static void __sched_fork(struct task_struct *p)
 	p->se.nr_wakeups_affine_attempts	= 0;
 	p->se.nr_wakeups_passive		= 0;
 	p->se.nr_wakeups_idle			= 0;
+	p->se.nr_wakeups_pair			= 0;
+	p->se.nr_wakeups_wide			= 0;
 
 #endif
 
+#ifdef CONFIG_SMP
+	p->last_wakee = NULL;
+	p->wakee_flips = 0;
+	p->wakee_flip_decay_ts = jiffies;
+#endif
+
 	INIT_LIST_HEAD(&p->rt.run_list);
 	p->se.on_rq = 0;
 	INIT_LIST_HEAD(&p->se.group_node);
@@ -2582,6 +2642,16 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->numa_preferred_nid = -1;
+	p->numa_work_pending = 0;
+	p->numa_scan_next = jiffies +
+		msecs_to_jiffies(sysctl_numa_balancing_scan_period);
+	p->numa_faults_local = 0;
+	p->numa_faults_remote = 0;
+	p->numa_pages_migrated = 0;
+#endif
 }
 
 /*
@@ -3172,6 +3242,63 @@ again:
 	task_rq_unlock(rq, &flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Move current to the least loaded cpu of @nid it is allowed on, the
+ * node most of its recent NUMA hinting faults were on, unless that cpu
+ * would end up busier than the one it runs on now.
+ */
+static void sched_move_to_node(int nid)
+{
+	struct task_struct *p = current;
+	unsigned long load, min_load = ULONG_MAX;
+	struct migration_req req;
+	int cpu, this_cpu, dest_cpu = -1;
+	unsigned long flags;
+	struct rq *rq;
+
+	this_cpu = get_cpu();
+	for_each_cpu_and(cpu, cpumask_of_node(nid), &p->cpus_allowed) {
+		if (!cpu_active(cpu))
+			continue;
+		load = weighted_cpuload(cpu);
+		if (load < min_load) {
+			min_load = load;
+			dest_cpu = cpu;
+		}
+	}
+	if (dest_cpu < 0 ||
+	    min_load + p->se.load.weight > weighted_cpuload(this_cpu)) {
+		put_cpu();
+		return;
+	}
+
+	rq = task_rq_lock(p, &flags);
+	put_cpu();
+
+	/* ->cpus_allowed may have changed meanwhile */
+	if (!cpumask_test_cpu(dest_cpu, &p->cpus_allowed)
+	    || unlikely(!cpu_active(dest_cpu))) {
+		task_rq_unlock(rq, &flags);
+		return;
+	}
+
+	if (migrate_task(p, dest_cpu, &req)) {
+		/* Need to wait for migration thread (might exit: take ref). */
+		struct task_struct *mt = rq->migration_thread;
+
+		get_task_struct(mt);
+		task_rq_unlock(rq, &flags);
+		wake_up_process(mt);
+		put_task_struct(mt);
+		wait_for_completion(&req.done);
+
+		return;
+	}
+	task_rq_unlock(rq, &flags);
+}
+#endif
+
 #endif
 
 DEFINE_PER_CPU(struct kernel_stat, kstat);
@@ -3723,10 +3850,24 @@ need_resched_nonpreemptible:
 	clear_tsk_need_resched(prev);
 
 	if (prev->state && !(preempt_count() & PREEMPT_ACTIVE)) {
-		if (unlikely(signal_pending_state(prev->state, prev)))
+		if (unlikely(signal_pending_state(prev->state, prev))) {
 			prev->state = TASK_RUNNING;
-		else
+		} else {
+			/*
+			 * If a worker is going to sleep, notify and
+			 * ask workqueue whether it wants to wake up a
+			 * task to maintain concurrency.  If so, wake
+			 * up the task.
+			 */
+			if (prev->flags & PF_WQ_WORKER) {
+				struct task_struct *to_wakeup;
+
+				to_wakeup = wq_worker_sleeping(prev, cpu);
+				if (to_wakeup)
+					try_to_wake_up_local(to_wakeup);
+			}
 			deactivate_task(rq, prev, 1);
+		}
 		switch_count = &prev->nvcsw;
 	}
 
@@ -6305,6 +6446,23 @@ static struct root_domain *alloc_rootdomain(void)
 	return rd;
 }
 
+static void update_top_cache_domain(struct sched_domain *sd, int cpu)
+{
+	struct sched_domain *llc = NULL;
+	int size = 1;
+
+	for (; sd; sd = sd->parent) {
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			break;
+		llc = sd;
+	}
+	if (llc)
+		size = cpumask_weight(sched_domain_span(llc));
+
+	rcu_assign_pointer(per_cpu(sd_llc, cpu), llc);
+	per_cpu(sd_llc_size, cpu) = size;
+}
+
 /*
  * Attach the domain 'sd' to 'cpu' as its base domain. Callers must
  * hold the hotplug lock.
@@ -6339,6 +6497,7 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 
 	rq_attach_root(rq, rd);
 	rcu_assign_pointer(rq->sd, sd);
+	update_top_cache_domain(sd, cpu);
 }
 
 /* cpus with isolated domains */
@@ -443,6 +443,8 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.nr_wakeups_affine_attempts);
 	P(se.nr_wakeups_passive);
 	P(se.nr_wakeups_idle);
+	P(se.nr_wakeups_pair);
+	P(se.nr_wakeups_wide);
 
 	{
 		u64 avg_atom, avg_per_cpu;
@@ -518,6 +520,8 @@ void proc_sched_set_task(struct task_struct *p)
 	p->se.nr_wakeups_affine_attempts	= 0;
 	p->se.nr_wakeups_passive		= 0;
 	p->se.nr_wakeups_idle			= 0;
+	p->se.nr_wakeups_pair			= 0;
+	p->se.nr_wakeups_wide			= 0;
 	p->sched_info.bkl_count			= 0;
 #endif
 }
@@ -22,6 +22,7 @@
 
 #include <linux/latencytop.h>
 #include <linux/sched.h>
+#include <linux/mempolicy.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -988,6 +989,187 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 		check_preempt_tick(cfs_rq, curr);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/**************************************************
+ * Automatic NUMA balancing:
+ *
+ * Every sysctl_numa_balancing_scan_period milliseconds, one thread of
+ * each mm makes the next sysctl_numa_balancing_scan_size megabytes of
+ * its address space inaccessible, see change_prot_numa().  The next
+ * access to one of those pages takes a NUMA hinting fault, which
+ * restores the mapping, migrates the page to the node of the faulting
+ * cpu if only this task maps it, and records the node the memory was
+ * on.  The node most recent faults were on becomes the preferred node
+ * of the task: it is moved there, and the load balancer is reluctant
+ * to move it away again.
+ */
+
+unsigned int sysctl_numa_balancing = 1;
+unsigned int sysctl_numa_balancing_scan_period = 1000;	/* ms */
+unsigned int sysctl_numa_balancing_scan_size = 256;	/* MB */
+
+static void sched_move_to_node(int nid);
+
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long faults, max_faults = 0, total_faults = 0;
+	int nid, max_nid = -1;
+
+	if (!p->numa_faults)
+		return;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		/* Halve the old counts, so that recent faults dominate */
+		p->numa_faults[nid] = faults / 2;
+		total_faults += faults;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	/* Only follow a clear majority of the faults */
+	if (max_nid < 0 || max_faults * 2 <= total_faults)
+		return;
+
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		sched_move_to_node(max_nid);
+}
+
+/*
+ * Called on the way back to user space after task_tick_numa() found the
+ * scan period expired: update the placement of the task, and scan the
+ * next part of the address space unless another thread of the mm
+ * already did so in this period.
+ */
+void task_numa_work(void)
+{
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end, next_scan, now = jiffies;
+	long pages;
+
+	if (!p->numa_work_pending)
+		return;
+	p->numa_work_pending = 0;
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	task_numa_placement(p);
+
+	next_scan = mm->numa_next_scan;
+	if (time_before(now, next_scan))
+		return;
+	if (cmpxchg(&mm->numa_next_scan, next_scan, now +
+		    msecs_to_jiffies(sysctl_numa_balancing_scan_period))
+	    != next_scan)
+		return;
+
+	pages = (long)sysctl_numa_balancing_scan_size << (20 - PAGE_SHIFT);
+	start = mm->numa_scan_offset;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma) {
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) ||
+		    !(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+		/* Shared libraries and text are best left where they are */
+		if (vma->vm_file &&
+		    (vma->vm_flags & (VM_READ | VM_WRITE)) == VM_READ)
+			continue;
+
+		start = max(start, vma->vm_start);
+		end = min(vma->vm_end, start + (pages << PAGE_SHIFT));
+		change_prot_numa(vma, start, end);
+		pages -= (end - start) >> PAGE_SHIFT;
+		start = end;
+		if (pages <= 0)
+			break;
+	}
+	/* Start over at the beginning once the end has been reached */
+	mm->numa_scan_offset = vma ? start : 0;
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Account a NUMA hinting fault of current on a page of node @page_nid,
+ * taken on node @this_nid.  A migrated page is now on @this_nid.
+ */
+void task_numa_fault(int page_nid, int this_nid, int migrated)
+{
+	struct task_struct *p = current;
+
+	if (!p->numa_faults) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	p->numa_faults[migrated ? this_nid : page_nid]++;
+	if (page_nid == this_nid)
+		p->numa_faults_local++;
+	else
+		p->numa_faults_remote++;
+	if (migrated)
+		p->numa_pages_migrated++;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	if (!sysctl_numa_balancing || nr_online_nodes < 2)
+		return;
+	if (!curr->mm || (curr->flags & (PF_EXITING | PF_KTHREAD)))
+		return;
+	if (time_before(jiffies, curr->numa_scan_next))
+		return;
+
+	curr->numa_scan_next = jiffies +
+		msecs_to_jiffies(sysctl_numa_balancing_scan_period);
+	curr->numa_work_pending = 1;
+	set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+}
+
+/*
+ * Moving a task to its preferred node is as good as moving a cache cold
+ * task; moving it away from there is as bad as moving a cache hot one.
+ */
+static int task_numa_hot(struct task_struct *p, int dest_cpu, int hot)
+{
+	int nid = p->numa_preferred_nid;
+
+	if (!sysctl_numa_balancing || nid < 0)
+		return hot;
+	if (cpu_to_node(dest_cpu) == nid)
+		return 0;
+	if (cpu_to_node(task_cpu(p)) == nid)
+		return 1;
+	return hot;
+}
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline int task_numa_hot(struct task_struct *p, int dest_cpu, int hot)
+{
+	return hot;
+}
+#endif
+
 /**************************************************
  * CFS operations on tasks:
  */
@@ -1434,6 +1616,80 @@ select_idle_sibling(struct task_struct *p, struct sched_domain *sd, int target)
 	return target;
 }
 
+/*
+ * Learn who wakes whom: wakee_flips counts how often the current task
+ * wakes a different task than the previous time, halved every second.
+ * It stays low for a task that keeps waking the same partner and grows
+ * with the number of tasks it wakes in turn.
+ */
+static void record_wakee(struct task_struct *p)
+{
+	if (time_after(jiffies, current->wakee_flip_decay_ts + HZ)) {
+		current->wakee_flips >>= 1;
+		current->wakee_flip_decay_ts = jiffies;
+	}
+
+	if (current->last_wakee != p) {
+		current->last_wakee = p;
+		current->wakee_flips++;
+	}
+}
+
+/*
+ * Detect a 1:N waker/wakee relationship: one side switches partners at
+ * least llc_size times as often as the other, which itself switches
+ * often.  Pulling all those wakees next to the waker would overload its
+ * cache domain, so they are better left where they are.
+ */
+static int wake_wide(struct task_struct *p, int llc_size)
+{
+	unsigned int master = current->wakee_flips;
+	unsigned int slave = p->wakee_flips;
+
+	if (master < slave)
+		swap(master, slave);
+	if (slave < llc_size || master < slave * llc_size)
+		return 0;
+	return 1;
+}
+
+/*
+ * A 1:1 relationship: the waker woke p the last time as well, and hardly
+ * wakes anyone else.  p will consume what the waker just produced, so it
+ * should run in the cache the data is in.
+ */
+static int wake_pair(struct task_struct *p, int llc_size)
+{
+	return current->last_wakee == p && current->wakee_flips < llc_size;
+}
+
+/*
+ * Find an idle cpu for p sharing the last level cache with cpu: p's
+ * previous cpu if it qualifies, as p may still have data in its private
+ * caches, else the first one.  Returns -1 if there is none.
+ */
+static int select_idle_llc(struct task_struct *p, int cpu)
+{
+	struct sched_domain *sd;
+	int prev_cpu = task_cpu(p);
+	int i;
+
+	sd = rcu_dereference_check_sched_domain(per_cpu(sd_llc, cpu));
+	if (!sd)
+		return -1;
+
+	if (cpumask_test_cpu(prev_cpu, sched_domain_span(sd)) &&
+	    cpumask_test_cpu(prev_cpu, &p->cpus_allowed) &&
+	    !cpu_rq(prev_cpu)->cfs.nr_running)
+		return prev_cpu;
+
+	for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
+		if (!cpu_rq(i)->cfs.nr_running)
+			return i;
+	}
+	return -1;
+}
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -1456,9 +1712,25 @@ static int select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flag
 	int sync = wake_flags & WF_SYNC;
 
 	if (sd_flag & SD_BALANCE_WAKE) {
-		if (sched_feat(AFFINE_WAKEUPS) &&
-		    cpumask_test_cpu(cpu, &p->cpus_allowed))
+		int llc_size = per_cpu(sd_llc_size, cpu);
+		int pair = sched_feat(WAKE_PAIR) && wake_pair(p, llc_size);
+
+		record_wakee(p);
+
+		if (sched_feat(WAKE_WIDE) && wake_wide(p, llc_size)) {
+			schedstat_inc(p, se.nr_wakeups_wide);
+		} else if (sched_feat(AFFINE_WAKEUPS) &&
+			   cpumask_test_cpu(cpu, &p->cpus_allowed)) {
 			want_affine = 1;
+
+			if (pair) {
+				new_cpu = select_idle_llc(p, cpu);
+				if (new_cpu >= 0) {
+					schedstat_inc(p, se.nr_wakeups_pair);
+					return new_cpu;
+				}
+			}
+		}
 		new_cpu = prev_cpu;
 	}
 
@@ -1861,6 +2133,7 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	 */
 
 	tsk_cache_hot = task_hot(p, rq->clock, sd);
+	tsk_cache_hot = task_numa_hot(p, this_cpu, tsk_cache_hot);
 	if (!tsk_cache_hot ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
@@ -3567,6 +3840,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -69,6 +69,20 @@ SCHED_FEAT(SYNC_WAKEUPS, 1)
  */
 SCHED_FEAT(AFFINE_WAKEUPS, 1)
 
+/*
+ * Don't pull the wakees of a task that keeps waking different tasks
+ * (a dispatcher feeding workers) into the waker's cache domain, where
+ * they would pile up: see wake_wide().
+ */
+SCHED_FEAT(WAKE_WIDE, 1)
+
+/*
+ * A task waking the same task again, as in a pipe or a producer/consumer
+ * pipeline, places it on an idle cpu sharing the last level cache with
+ * the waker, without comparing loads: see wake_pair().
+ */
+SCHED_FEAT(WAKE_PAIR, 1)
+
 /*
  * Weaken SYNC hint based on overlap
  */
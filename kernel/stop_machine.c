@@ -38,14 +38,24 @@ struct stop_machine_data {
 static unsigned int num_threads;
 static atomic_t thread_ack;
 static DEFINE_MUTEX(lock);
-/* setup_lock protects refcount, stop_machine_wq and stop_machine_work. */
+/* setup_lock protects refcount and the stopper threads. */
 static DEFINE_MUTEX(setup_lock);
 /* Users of stop_machine. */
 static int refcount;
-static struct workqueue_struct *stop_machine_wq;
 static struct stop_machine_data active, idle;
 static const struct cpumask *active_cpus;
-static void __percpu *stop_machine_work;
+
+/*
+ * One SCHED_FIFO thread per possible cpu, bound to it.  A thread is only
+ * ever woken while its cpu is online, so binding to an offline cpu is fine.
+ */
+struct stopper {
+	struct task_struct	*thread;
+	int			run;	/* stop_cpu() has been requested */
+};
+static DEFINE_PER_CPU(struct stopper, stoppers);
+static atomic_t stoppers_running;
+static DECLARE_COMPLETION(stoppers_done);
 
 static void set_state(enum stopmachine_state newstate)
 {
@@ -63,8 +73,8 @@ static void ack_state(void)
 }
 
 /* This is the actual function which stops the CPU. It runs
- * in the context of a dedicated stopmachine workqueue. */
-static void stop_cpu(struct work_struct *unused)
+ * in the context of a dedicated stopmachine thread. */
+static void stop_cpu(void)
 {
 	enum stopmachine_state curstate = STOPMACHINE_NONE;
 	struct stop_machine_data *smdata = &idle;
@@ -112,25 +122,68 @@ static int chill(void *unused)
 	return 0;
 }
 
+static int stopper_thread(void *data)
+{
+	struct stopper *stopper = data;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!stopper->run) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		stopper->run = 0;
+		stop_cpu();
+		if (atomic_dec_and_test(&stoppers_running))
+			complete(&stoppers_done);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void destroy_stoppers(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct stopper *stopper = &per_cpu(stoppers, cpu);
+
+		if (stopper->thread) {
+			kthread_stop(stopper->thread);
+			stopper->thread = NULL;
+		}
+	}
+}
+
 int stop_machine_create(void)
 {
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	int cpu;
+
 	mutex_lock(&setup_lock);
 	if (refcount)
 		goto done;
-	stop_machine_wq = create_rt_workqueue("kstop");
-	if (!stop_machine_wq)
-		goto err_out;
-	stop_machine_work = alloc_percpu(struct work_struct);
-	if (!stop_machine_work)
-		goto err_out;
+	for_each_possible_cpu(cpu) {
+		struct stopper *stopper = &per_cpu(stoppers, cpu);
+		struct task_struct *p;
+
+		p = kthread_create(stopper_thread, stopper, "kstop/%d", cpu);
+		if (IS_ERR(p))
+			goto err_out;
+		kthread_bind(p, cpu);
+		sched_setscheduler_nocheck(p, SCHED_FIFO, &param);
+		stopper->thread = p;
+	}
 done:
 	refcount++;
 	mutex_unlock(&setup_lock);
 	return 0;
 
 err_out:
-	if (stop_machine_wq)
-		destroy_workqueue(stop_machine_wq);
+	destroy_stoppers();
 	mutex_unlock(&setup_lock);
 	return -ENOMEM;
 }
@@ -142,8 +195,7 @@ void stop_machine_destroy(void)
 	refcount--;
 	if (refcount)
 		goto done;
-	destroy_workqueue(stop_machine_wq);
-	free_percpu(stop_machine_work);
+	destroy_stoppers();
 done:
 	mutex_unlock(&setup_lock);
 }
@@ -151,7 +203,6 @@ EXPORT_SYMBOL_GPL(stop_machine_destroy);
 
 int __stop_machine(int (*fn)(void *), void *data, const struct cpumask *cpus)
 {
-	struct work_struct *sm_work;
 	int i, ret;
 
 	/* Set up initial state. */
@@ -165,18 +216,21 @@ int __stop_machine(int (*fn)(void *), void *data, const struct cpumask *cpus)
 	idle.data = NULL;
 
 	set_state(STOPMACHINE_PREPARE);
+	atomic_set(&stoppers_running, num_threads);
+	INIT_COMPLETION(stoppers_done);
 
-	/* Schedule the stop_cpu work on all cpus: hold this CPU so one
+	/* Kick the stopper thread on all cpus: hold this CPU so one
 	 * doesn't hit this CPU until we're ready. */
 	get_cpu();
 	for_each_online_cpu(i) {
-		sm_work = per_cpu_ptr(stop_machine_work, i);
-		INIT_WORK(sm_work, stop_cpu);
-		queue_work_on(i, stop_machine_wq, sm_work);
+		struct stopper *stopper = &per_cpu(stoppers, i);
+
+		stopper->run = 1;
+		wake_up_process(stopper->thread);
 	}
 	/* This will release the thread on our CPU. */
 	put_cpu();
-	flush_workqueue(stop_machine_wq);
+	wait_for_completion(&stoppers_done);
 	ret = active.fnret;
 	mutex_unlock(&lock);
 	return ret;
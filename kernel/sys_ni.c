@@ -135,6 +135,9 @@ cond_syscall(sys_io_destroy);
 cond_syscall(sys_io_submit);
 cond_syscall(sys_io_cancel);
 cond_syscall(sys_io_getevents);
+cond_syscall(sys_io_ring_setup);
+cond_syscall(sys_io_ring_enter);
+cond_syscall(sys_io_ring_register);
 cond_syscall(sys_syslog);
 
 /* arch-specific weak syscall entries */
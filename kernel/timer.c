@@ -40,6 +40,8 @@
 #include <linux/perf_event.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -55,33 +57,72 @@ u64 jiffies_64 __cacheline_aligned_in_smp = INITIAL_JIFFIES;
 EXPORT_SYMBOL(jiffies_64);
 
 /*
- * per-CPU timer vector definitions:
+ * per-CPU timer wheel definitions:
+ *
+ * The wheel has LVL_DEPTH levels of LVL_SIZE buckets.  Each level is
+ * LVL_CLK_DIV times coarser than the one below it, and a timer is queued
+ * once, in the level whose range covers its timeout, at its expiry time
+ * rounded up to the granularity of that level.  Timers are never moved
+ * between levels (cascaded): they expire straight from their bucket, up
+ * to one level granularity late, i.e. at most about 1/8 of the timeout.
+ * Most timers are deleted or rearmed long before they expire, so this is
+ * almost never noticed, while the work done per tick no longer depends
+ * on the number of pending timers.
+ *
+ * HZ 1000:
+ * Level  Granularity  Range
+ *  0        1 ms       0 ms -    63 ms
+ *  1        8 ms      63 ms -   504 ms
+ *  2       64 ms     504 ms -   4.0 s
+ *  3      512 ms     4.0 s  -    32 s
+ *  4      4.1 s       32 s  -   4.3 m
+ *  5       33 s      4.3 m  -    34 m
+ *  6      4.4 m       34 m  -   4.6 h
+ *  7       35 m      4.6 h  -    37 h
+ *  8      4.7 h       37 h  -    12 d
+ *
+ * Timers beyond the last level are queued at its end and requeued from
+ * there when that bucket comes up.
  */
-#define TVN_BITS (CONFIG_BASE_SMALL ? 4 : 6)
-#define TVR_BITS (CONFIG_BASE_SMALL ? 6 : 8)
-#define TVN_SIZE (1 << TVN_BITS)
-#define TVR_SIZE (1 << TVR_BITS)
-#define TVN_MASK (TVN_SIZE - 1)
-#define TVR_MASK (TVR_SIZE - 1)
-
-struct tvec {
-	struct list_head vec[TVN_SIZE];
-};
+#define LVL_CLK_SHIFT	3
+#define LVL_CLK_DIV	(1UL << LVL_CLK_SHIFT)
+#define LVL_CLK_MASK	(LVL_CLK_DIV - 1)
+#define LVL_SHIFT(n)	((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n)	(1UL << LVL_SHIFT(n))
+
+#define LVL_BITS	6
+#define LVL_SIZE	(1UL << LVL_BITS)
+#define LVL_MASK	(LVL_SIZE - 1)
+
+/* The smallest timeout that does not fit in level n - 1 */
+#define LVL_START(n)	((LVL_SIZE - 1) << LVL_SHIFT((n) - 1))
+
+#if HZ > 100
+# define LVL_DEPTH	9
+#else
+# define LVL_DEPTH	8
+#endif
 
-struct tvec_root {
-	struct list_head vec[TVR_SIZE];
+#define WHEEL_TIMEOUT_CUTOFF	LVL_START(LVL_DEPTH)
+#define WHEEL_SIZE		(LVL_SIZE * LVL_DEPTH)
+
+struct tvec_stats {
+	unsigned long expired;		/* timers run */
+	unsigned long late;		/* ... after their expiry time */
+	unsigned long late_jiffies;	/* sum of those delays */
+	unsigned long max_late;
+	unsigned long max_batch;	/* most timers run in one tick */
+	unsigned long requeued;		/* beyond the wheel, not due yet */
 };
 
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
-	unsigned long timer_jiffies;
+	unsigned long timer_jiffies;	/* the next tick to process */
 	unsigned long next_timer;
-	struct tvec_root tv1;
-	struct tvec tv2;
-	struct tvec tv3;
-	struct tvec tv4;
-	struct tvec tv5;
+	unsigned long next_expiry;	/* no later than the first bucket run */
+	struct tvec_stats stats;
+	struct list_head vectors[WHEEL_SIZE];
 } ____cacheline_aligned;
 
 struct tvec_base boot_tvec_bases;
@@ -328,48 +369,119 @@ static inline void set_running_timer(struct tvec_base *base,
 #endif
 }
 
+/*
+ * Jiffy at which the bucket a timer expiring at expires goes into on level
+ * lvl is run: expires rounded up to the level granularity.
+ */
+static inline unsigned long bucket_expiry(unsigned long expires,
+					  unsigned int lvl)
+{
+	return ((expires + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl))
+		<< LVL_SHIFT(lvl);
+}
+
+/*
+ * Bucket of level lvl for a timer expiring at expires.  Above level 0 the
+ * expiry time is rounded up to the level granularity, so that the timer
+ * can fire late but never early.
+ */
+static inline unsigned int calc_index(unsigned long expires, unsigned int lvl)
+{
+	expires = bucket_expiry(expires, lvl) >> LVL_SHIFT(lvl);
+	return lvl * LVL_SIZE + (expires & LVL_MASK);
+}
+
+/*
+ * Queue a timer in the bucket that runs at or after its expiry time, and
+ * let base->next_timer follow when that bucket is run, which is when an
+ * idle CPU has to wake up for it.  base->next_expiry follows it for
+ * deferrable timers too.  base->timer_jiffies must be current,
+ * see forward_timer_base(), or the timer lands on a coarser level than it
+ * should and fires late.
+ */
 static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 {
 	unsigned long expires = timer->expires;
-	unsigned long idx = expires - base->timer_jiffies;
-	struct list_head *vec;
-
-	if (idx < TVR_SIZE) {
-		int i = expires & TVR_MASK;
-		vec = base->tv1.vec + i;
-	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
-		int i = (expires >> TVR_BITS) & TVN_MASK;
-		vec = base->tv2.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		vec = base->tv3.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv4.vec + i;
-	} else if ((signed long) idx < 0) {
+	unsigned long clk = base->timer_jiffies;
+	unsigned long delta = expires - clk;
+	unsigned long run;
+	unsigned int lvl, idx;
+
+	if ((signed long) delta < 0) {
 		/*
 		 * Can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		vec = base->tv1.vec + (base->timer_jiffies & TVR_MASK);
+		idx = clk & LVL_MASK;
+		run = clk;
 	} else {
-		int i;
-		/* If the timeout is larger than 0xffffffff on 64-bit
-		 * architectures then we use the maximum timeout:
-		 */
-		if (idx > 0xffffffffUL) {
-			idx = 0xffffffffUL;
-			expires = idx + base->timer_jiffies;
-		}
-		i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv5.vec + i;
+		if (delta >= WHEEL_TIMEOUT_CUTOFF)
+			expires = clk + WHEEL_TIMEOUT_CUTOFF - 1;
+		for (lvl = 0; lvl < LVL_DEPTH - 1; lvl++)
+			if (delta < LVL_START(lvl + 1))
+				break;
+		idx = calc_index(expires, lvl);
+		run = bucket_expiry(expires, lvl);
 	}
 	/*
 	 * Timers are FIFO:
 	 */
-	list_add_tail(&timer->entry, vec);
+	list_add_tail(&timer->entry, base->vectors + idx);
+
+	if (time_before(run, base->next_timer) &&
+	    !tbase_get_deferrable(timer->base))
+		base->next_timer = run;
+	if (time_before(run, base->next_expiry))
+		base->next_expiry = run;
+}
+
+/*
+ * A timer expiring no later than base->next_timer may be the one that
+ * set it: make get_next_timer_interrupt() look again once it is gone.
+ */
+static inline void timer_next_invalidate(struct tvec_base *base,
+					 struct timer_list *timer)
+{
+	if (!time_after(timer->expires, base->next_timer) &&
+	    !tbase_get_deferrable(timer->base))
+		base->next_timer = base->timer_jiffies;
 }
 
+#ifdef CONFIG_NO_HZ
+static unsigned long __next_timer_interrupt(struct tvec_base *base,
+					    int deferrable);
+
+/*
+ * After the CPU has been idle, base->timer_jiffies can lag jiffies by
+ * many ticks.  Jump straight to the next bucket holding a timer instead
+ * of stepping through all of them, so that catching up costs the same
+ * as one tick.  Timers are never moved between levels, so this is also
+ * done before a timer is queued: its level must be chosen from the
+ * current time, not from when the CPU went idle.  Called with base->lock
+ * held.
+ *
+ * This is on the mod_timer() path, so it only trusts base->next_expiry,
+ * which removing a timer leaves early rather than wrong.  Once the clock
+ * has caught up with it, its bucket has been collected and the next one
+ * is unknown: the clock is then left alone until the value is looked up
+ * again, by get_next_timer_interrupt() when the CPU goes idle or by
+ * __run_timers() when it has fallen far behind.
+ */
+static void forward_timer_base(struct tvec_base *base)
+{
+	unsigned long next = base->next_expiry;
+
+	if (time_before_eq(next, base->timer_jiffies))
+		return;
+	if (time_after(next, jiffies))
+		next = jiffies;
+	if (time_after(next, base->timer_jiffies))
+		base->timer_jiffies = next;
+}
+#else
+static inline void forward_timer_base(struct tvec_base *base) { }
+#endif
+
 #ifdef CONFIG_TIMER_STATS
 void __timer_stats_timer_set_start_info(struct timer_list *timer, void *addr)
 {
@@ -550,6 +662,7 @@ static void __init_timer(struct timer_list *timer,
 {
 	timer->entry.next = NULL;
 	timer->base = __raw_get_cpu_var(tvec_bases);
+	timer->slack = -1;
 #ifdef CONFIG_TIMER_STATS
 	timer->start_site = NULL;
 	timer->start_pid = -1;
@@ -646,9 +759,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 
 	if (timer_pending(timer)) {
 		detach_timer(timer, 0);
-		if (timer->expires == base->next_timer &&
-		    !tbase_get_deferrable(timer->base))
-			base->next_timer = base->timer_jiffies;
+		timer_next_invalidate(base, timer);
 		ret = 1;
 	} else {
 		if (pending_only)
@@ -688,9 +799,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	}
 
 	timer->expires = expires;
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
+	forward_timer_base(base);
 	internal_add_timer(base, timer);
 
 out_unlock:
@@ -715,6 +824,66 @@ int mod_timer_pending(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pending);
 
+/*
+ * Decide where to put the timer while taking the slack into account
+ *
+ * Algorithm:
+ *   1) calculate the maximum (absolute) time
+ *   2) calculate the highest bit where the expires and new max are different
+ *   3) use this bit to make a mask
+ *   4) use the bitmask to round down the maximum time, so that all last
+ *      bits are zeros
+ *
+ * Timers rounded like this share their expiry time with the other timers
+ * of similar timeout, so they are run together from one tick instead of
+ * each one from a tick of its own, and rearming a timer with a slightly
+ * later timeout usually finds it already set to expire then.
+ */
+static inline
+unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
+{
+	unsigned long expires_limit, mask;
+	int bit;
+
+	if (timer->slack >= 0) {
+		expires_limit = expires + timer->slack;
+	} else {
+		long delta = expires - jiffies;
+
+		/* No slack if already expired, else auto slack 0.4% */
+		if (delta < 256)
+			return expires;
+		expires_limit = expires + delta / 256;
+	}
+	mask = expires ^ expires_limit;
+	if (mask == 0)
+		return expires;
+
+	bit = find_last_bit(&mask, BITS_PER_LONG);
+	mask = (1UL << bit) - 1;
+
+	return expires_limit & ~mask;
+}
+
+/**
+ * set_timer_slack - set the allowed slack for a timer
+ * @timer: the timer to be modified
+ * @slack_hz: the amount of time (in jiffies) allowed for rounding
+ *
+ * Set the amount of time, in jiffies, that a certain timer has
+ * in terms of slack. By setting this value, the timer subsystem
+ * will schedule the actual timer somewhere between
+ * the time mod_timer() asks for, and that time plus the slack.
+ *
+ * By setting the slack to -1, a percentage of the delay is used
+ * instead.
+ */
+void set_timer_slack(struct timer_list *timer, int slack_hz)
+{
+	timer->slack = slack_hz;
+}
+EXPORT_SYMBOL_GPL(set_timer_slack);
+
 /**
  * mod_timer - modify a timer's timeout
  * @timer: the timer to be modified
@@ -737,6 +906,8 @@ EXPORT_SYMBOL(mod_timer_pending);
  */
 int mod_timer(struct timer_list *timer, unsigned long expires)
 {
+	expires = apply_slack(timer, expires);
+
 	/*
 	 * This is a common optimization triggered by the
 	 * networking code - if the timer is re-modified
@@ -809,9 +980,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 	spin_lock_irqsave(&base->lock, flags);
 	timer_set_base(timer, base);
 	debug_activate(timer, timer->expires);
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
+	forward_timer_base(base);
 	internal_add_timer(base, timer);
 	/*
 	 * Check whether the other CPU is idle and needs to be
@@ -848,9 +1017,7 @@ int del_timer(struct timer_list *timer)
 		base = lock_timer_base(timer, &flags);
 		if (timer_pending(timer)) {
 			detach_timer(timer, 1);
-			if (timer->expires == base->next_timer &&
-			    !tbase_get_deferrable(timer->base))
-				base->next_timer = base->timer_jiffies;
+			timer_next_invalidate(base, timer);
 			ret = 1;
 		}
 		spin_unlock_irqrestore(&base->lock, flags);
@@ -885,9 +1052,7 @@ int try_to_del_timer_sync(struct timer_list *timer)
 	ret = 0;
 	if (timer_pending(timer)) {
 		detach_timer(timer, 1);
-		if (timer->expires == base->next_timer &&
-		    !tbase_get_deferrable(timer->base))
-			base->next_timer = base->timer_jiffies;
+		timer_next_invalidate(base, timer);
 		ret = 1;
 	}
 out:
@@ -935,34 +1100,47 @@ int del_timer_sync(struct timer_list *timer)
 EXPORT_SYMBOL(del_timer_sync);
 #endif
 
-static int cascade(struct tvec_base *base, struct tvec *tv, int index)
-{
-	/* cascade all the timers from tv up one level */
-	struct timer_list *timer, *tmp;
-	struct list_head tv_list;
+/*
+ * Move the timers of all buckets that expire at base->timer_jiffies to
+ * head.  A level is only looked at when the clock crosses a boundary of
+ * its granularity, so this visits at most LVL_DEPTH buckets.
+ */
+static void collect_expired_timers(struct tvec_base *base,
+				   struct list_head *head)
+{
+	unsigned long clk = base->timer_jiffies;
+	unsigned int lvl;
+
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++) {
+		list_splice_tail_init(base->vectors + lvl * LVL_SIZE +
+				      (clk & LVL_MASK), head);
+		if (clk & LVL_CLK_MASK)
+			break;
+		clk >>= LVL_CLK_SHIFT;
+	}
+}
 
-	list_replace_init(tv->vec + index, &tv_list);
+static inline void timer_account_expiry(struct tvec_base *base,
+					struct timer_list *timer,
+					unsigned long clk)
+{
+	unsigned long late = clk - timer->expires;
 
-	/*
-	 * We are removing _all_ timers from the list, so we
-	 * don't have to detach them individually.
-	 */
-	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
-		BUG_ON(tbase_get_base(timer->base) != base);
-		internal_add_timer(base, timer);
+	base->stats.expired++;
+	if (late) {
+		base->stats.late++;
+		base->stats.late_jiffies += late;
+		if (late > base->stats.max_late)
+			base->stats.max_late = late;
 	}
-
-	return index;
 }
 
-#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
-
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
  *
- * This function cascades all vectors and executes all expired timer
- * vectors.
+ * This function collects and executes the expired timer buckets of
+ * every tick up to jiffies.
  */
 static inline void __run_timers(struct tvec_base *base)
 {
@@ -972,27 +1150,36 @@ static inline void __run_timers(struct tvec_base *base)
 	while (time_after_eq(jiffies, base->timer_jiffies)) {
 		struct list_head work_list;
 		struct list_head *head = &work_list;
-		int index = base->timer_jiffies & TVR_MASK;
+		unsigned long clk, batch = 0;
 
-		/*
-		 * Cascade timers:
-		 */
-		if (!index &&
-			(!cascade(base, &base->tv2, INDEX(0))) &&
-				(!cascade(base, &base->tv3, INDEX(1))) &&
-					!cascade(base, &base->tv4, INDEX(2)))
-			cascade(base, &base->tv5, INDEX(3));
+#ifdef CONFIG_NO_HZ
+		if (time_before_eq(base->next_expiry, base->timer_jiffies) &&
+		    jiffies - base->timer_jiffies >= LVL_SIZE)
+			base->next_expiry = __next_timer_interrupt(base, 1);
+#endif
+		forward_timer_base(base);
+		clk = base->timer_jiffies;
+		INIT_LIST_HEAD(head);
+		collect_expired_timers(base, head);
 		++base->timer_jiffies;
-		list_replace_init(base->tv1.vec + index, &work_list);
 		while (!list_empty(head)) {
 			void (*fn)(unsigned long);
 			unsigned long data;
 
 			timer = list_first_entry(head, struct timer_list,entry);
+			if (unlikely(time_after(timer->expires, clk))) {
+				/* queued at the end of the wheel */
+				list_del(&timer->entry);
+				internal_add_timer(base, timer);
+				base->stats.requeued++;
+				continue;
+			}
 			fn = timer->function;
 			data = timer->data;
 
 			timer_stats_account_timer(timer);
+			timer_account_expiry(base, timer, clk);
+			batch++;
 
 			set_running_timer(base, timer);
 			detach_timer(timer, 1);
@@ -1039,85 +1226,71 @@ static inline void __run_timers(struct tvec_base *base)
 			}
 			spin_lock_irq(&base->lock);
 		}
+		if (batch > base->stats.max_batch)
+			base->stats.max_batch = batch;
 	}
 	set_running_timer(base, NULL);
 	spin_unlock_irq(&base->lock);
 }
 
 #ifdef CONFIG_NO_HZ
+/*
+ * Distance, in buckets of level lvl, from bucket pos to the next one
+ * holding a timer, or -1 if there is none.  Deferrable timers only count
+ * if deferrable is set.
+ */
+static int next_pending_bucket(struct tvec_base *base, unsigned int lvl,
+			       unsigned int pos, int deferrable)
+{
+	struct list_head *vec = base->vectors + lvl * LVL_SIZE;
+	struct timer_list *nte;
+	unsigned int i;
+
+	for (i = 0; i < LVL_SIZE; i++) {
+		list_for_each_entry(nte, vec + ((pos + i) & LVL_MASK), entry) {
+			if (deferrable || !tbase_get_deferrable(nte->base))
+				return i;
+		}
+	}
+	return -1;
+}
+
 /*
  * Find out when the next timer event is due to happen. This
  * is used on S/390 to stop all activity when a CPU is idle.
  * This function needs to be called with interrupts disabled.
+ *
+ * The result is the time the bucket of the first timer is run, which
+ * may be later than the expiry time of the timer itself.
  */
-static unsigned long __next_timer_interrupt(struct tvec_base *base)
+static unsigned long __next_timer_interrupt(struct tvec_base *base,
+					    int deferrable)
 {
-	unsigned long timer_jiffies = base->timer_jiffies;
-	unsigned long expires = timer_jiffies + NEXT_TIMER_MAX_DELTA;
-	int index, slot, array, found = 0;
-	struct timer_list *nte;
-	struct tvec *varray[4];
+	unsigned long clk = base->timer_jiffies;
+	unsigned long next = clk + NEXT_TIMER_MAX_DELTA;
+	unsigned int lvl;
 
-	/* Look for timer events in tv1. */
-	index = slot = timer_jiffies & TVR_MASK;
-	do {
-		list_for_each_entry(nte, base->tv1.vec + slot, entry) {
-			if (tbase_get_deferrable(nte->base))
-				continue;
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++) {
+		int pos = next_pending_bucket(base, lvl, clk & LVL_MASK,
+					      deferrable);
+		unsigned long adj;
 
-			found = 1;
-			expires = nte->expires;
-			/* Look at the cascade bucket(s)? */
-			if (!index || slot < index)
-				goto cascade;
-			return expires;
-		}
-		slot = (slot + 1) & TVR_MASK;
-	} while (slot != index);
-
-cascade:
-	/* Calculate the next cascade event */
-	if (index)
-		timer_jiffies += TVR_SIZE - index;
-	timer_jiffies >>= TVR_BITS;
-
-	/* Check tv2-tv5. */
-	varray[0] = &base->tv2;
-	varray[1] = &base->tv3;
-	varray[2] = &base->tv4;
-	varray[3] = &base->tv5;
-
-	for (array = 0; array < 4; array++) {
-		struct tvec *varp = varray[array];
-
-		index = slot = timer_jiffies & TVN_MASK;
-		do {
-			list_for_each_entry(nte, varp->vec + slot, entry) {
-				if (tbase_get_deferrable(nte->base))
-					continue;
-
-				found = 1;
-				if (time_before(nte->expires, expires))
-					expires = nte->expires;
-			}
-			/*
-			 * Do we still search for the first timer or are
-			 * we looking up the cascade buckets ?
-			 */
-			if (found) {
-				/* Look at the cascade bucket(s)? */
-				if (!index || slot < index)
-					break;
-				return expires;
-			}
-			slot = (slot + 1) & TVN_MASK;
-		} while (slot != index);
+		if (pos >= 0) {
+			unsigned long tmp = (clk + pos) << LVL_SHIFT(lvl);
 
-		if (index)
-			timer_jiffies += TVN_SIZE - index;
-		timer_jiffies >>= TVN_BITS;
+			if (time_before(tmp, next))
+				next = tmp;
+		}
+		/*
+		 * The next bucket of the level above runs at the current
+		 * clock of that level if this level is at a boundary of
+		 * its granularity, and one bucket later otherwise.
+		 */
+		adj = clk & LVL_CLK_MASK ? 1 : 0;
+		clk >>= LVL_CLK_SHIFT;
+		clk += adj;
 	}
-	return expires;
+	return next;
 }
 
 /*
@@ -1175,7 +1348,9 @@ unsigned long get_next_timer_interrupt(unsigned long now)
 
 	spin_lock(&base->lock);
 	if (time_before_eq(base->next_timer, base->timer_jiffies))
-		base->next_timer = __next_timer_interrupt(base);
+		base->next_timer = __next_timer_interrupt(base, 0);
+	if (time_before_eq(base->next_expiry, base->timer_jiffies))
+		base->next_expiry = __next_timer_interrupt(base, 1);
 	expires = base->next_timer;
 	spin_unlock(&base->lock);
 
@@ -1553,17 +1728,12 @@ static int __cpuinit init_timers_cpu(int cpu)
 
 	spin_lock_init(&base->lock);
 
-	for (j = 0; j < TVN_SIZE; j++) {
-		INIT_LIST_HEAD(base->tv5.vec + j);
-		INIT_LIST_HEAD(base->tv4.vec + j);
-		INIT_LIST_HEAD(base->tv3.vec + j);
-		INIT_LIST_HEAD(base->tv2.vec + j);
-	}
-	for (j = 0; j < TVR_SIZE; j++)
-		INIT_LIST_HEAD(base->tv1.vec + j);
+	for (j = 0; j < WHEEL_SIZE; j++)
+		INIT_LIST_HEAD(base->vectors + j);
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
+	base->next_expiry = base->timer_jiffies;
 	return 0;
 }
 
@@ -1576,9 +1746,6 @@ static void migrate_timer_list(struct tvec_base *new_base, struct list_head *hea
 		timer = list_first_entry(head, struct timer_list, entry);
 		detach_timer(timer, 0);
 		timer_set_base(timer, new_base);
-		if (time_before(timer->expires, new_base->next_timer) &&
-		    !tbase_get_deferrable(timer->base))
-			new_base->next_timer = timer->expires;
 		internal_add_timer(new_base, timer);
 	}
 }
@@ -1600,15 +1767,10 @@ static void __cpuinit migrate_timers(int cpu)
 	spin_lock_nested(&old_base->lock, SINGLE_DEPTH_NESTING);
 
 	BUG_ON(old_base->running_timer);
+	forward_timer_base(new_base);
 
-	for (i = 0; i < TVR_SIZE; i++)
-		migrate_timer_list(new_base, old_base->tv1.vec + i);
-	for (i = 0; i < TVN_SIZE; i++) {
-		migrate_timer_list(new_base, old_base->tv2.vec + i);
-		migrate_timer_list(new_base, old_base->tv3.vec + i);
-		migrate_timer_list(new_base, old_base->tv4.vec + i);
-		migrate_timer_list(new_base, old_base->tv5.vec + i);
-	}
+	for (i = 0; i < WHEEL_SIZE; i++)
+		migrate_timer_list(new_base, old_base->vectors + i);
 
 	spin_unlock(&old_base->lock);
 	spin_unlock_irq(&new_base->lock);
@@ -1655,6 +1817,50 @@ void __init init_timers(void)
 	open_softirq(TIMER_SOFTIRQ, run_timer_softirq);
 }
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Expiry accuracy of the timer wheel, one line per cpu: timers run, how
+ * many of them ran after their expiry time, the total and maximum delay
+ * in jiffies, the most timers run from a single tick, and the timers
+ * requeued from the end of the wheel.
+ */
+static int timer_wheel_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "# cpu expired late late_jiffies max_late max_batch"
+		   " requeued\n");
+	for_each_online_cpu(cpu) {
+		struct tvec_stats *stats = &per_cpu(tvec_bases, cpu)->stats;
+
+		seq_printf(m, "%d %lu %lu %lu %lu %lu %lu\n", cpu,
+			   stats->expired, stats->late, stats->late_jiffies,
+			   stats->max_late, stats->max_batch, stats->requeued);
+	}
+	return 0;
+}
+
+static int timer_wheel_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, timer_wheel_show, NULL);
+}
+
+static const struct file_operations timer_wheel_fops = {
+	.open		= timer_wheel_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init timer_wheel_stats_init(void)
+{
+	debugfs_create_file("timer_wheel", 0400, NULL, NULL,
+			    &timer_wheel_fops);
+	return 0;
+}
+late_initcall(timer_wheel_stats_init);
+#endif
+
 /**
  * msleep - sleep safely even with waitqueue interruptions
  * @msecs: Time in milliseconds to sleep for
@@ -3643,6 +3643,28 @@ void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data)
 }
 EXPORT_SYMBOL_GPL(ring_buffer_free_read_page);
 
+/*
+ * Hand the fully written reader page over to the caller, putting
+ * @data_page in its place.  Called with the reader_lock held.
+ */
+static void rb_swap_read_page(struct ring_buffer_per_cpu *cpu_buffer,
+			      struct buffer_page *reader, void **data_page)
+{
+	struct buffer_data_page *bpage = *data_page;
+
+	/* update the entry counter */
+	cpu_buffer->read += rb_page_entries(reader);
+
+	/* swap the pages */
+	rb_init_page(bpage);
+	bpage = reader->page;
+	reader->page = *data_page;
+	local_set(&reader->write, 0);
+	local_set(&reader->entries, 0);
+	reader->read = 0;
+	*data_page = bpage;
+}
+
 /**
  * ring_buffer_read_page - extract a page from the ring buffer
  * @buffer: buffer to extract from
@@ -3767,19 +3789,9 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 		/* we copied everything to the beginning */
 		read = 0;
-	} else {
-		/* update the entry counter */
-		cpu_buffer->read += rb_page_entries(reader);
-
-		/* swap the pages */
-		rb_init_page(bpage);
-		bpage = reader->page;
-		reader->page = *data_page;
-		local_set(&reader->write, 0);
-		local_set(&reader->entries, 0);
-		reader->read = 0;
-		*data_page = bpage;
-	}
+	} else
+		rb_swap_read_page(cpu_buffer, reader, data_page);
+
 	ret = read;
 
  out_unlock:
@@ -3790,6 +3802,349 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/**
+ * ring_buffer_read_pages - extract several full pages from the ring buffer
+ * @buffer: buffer to extract from
+ * @pages: array of pages allocated from ring_buffer_alloc_read_page
+ * @nr_pages: number of entries in @pages
+ * @cpu: the cpu of the buffer to extract
+ *
+ * This is the batched version of ring_buffer_read_page() with @full
+ * set.  As many pages as are fully written, up to @nr_pages, are
+ * swapped with the pages in @pages under a single acquisition of the
+ * reader lock.  The first n entries of @pages are replaced by the
+ * extracted pages, the remaining ones are left untouched.
+ *
+ * Returns:
+ *  The number of pages extracted.
+ */
+int ring_buffer_read_pages(struct ring_buffer *buffer,
+			   void **pages, int nr_pages, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	int i = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return 0;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	for (; i < nr_pages; i++) {
+		reader = rb_get_reader_page(cpu_buffer);
+
+		/* only whole pages the writer is done with */
+		if (!reader || reader->read ||
+		    cpu_buffer->reader_page == cpu_buffer->commit_page)
+			break;
+
+		rb_swap_read_page(cpu_buffer, reader, &pages[i]);
+	}
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return i;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_read_pages);
+
+/*
+ * Global ordered reads.
+ *
+ * The merge iterator pulls whole pages out of every per cpu buffer
+ * with ring_buffer_read_page() and walks the events of those private
+ * pages without any locking.  The per cpu streams are merged by
+ * timestamp through a small binary heap, so the reader lock is only
+ * taken once per page instead of once per event and per cpu.
+ */
+struct rb_merge_cpu {
+	void				*page;
+	unsigned int			pos;
+	unsigned int			commit;
+	u64				ts;
+	struct ring_buffer_event	*event;
+	int				cpu;
+};
+
+struct ring_buffer_merge_iter {
+	struct ring_buffer		*buffer;
+	struct rb_merge_cpu		*consumed;
+	int				nr_cpus;
+	int				nr_heap;
+	struct rb_merge_cpu		**heap;
+	struct rb_merge_cpu		cpus[];
+};
+
+static inline int rb_merge_before(struct rb_merge_cpu *a,
+				  struct rb_merge_cpu *b)
+{
+	return a->ts < b->ts || (a->ts == b->ts && a->cpu < b->cpu);
+}
+
+static void rb_merge_sift_down(struct ring_buffer_merge_iter *miter, int pos)
+{
+	struct rb_merge_cpu **heap = miter->heap;
+	struct rb_merge_cpu *mc = heap[pos];
+	int child;
+
+	while ((child = 2 * pos + 1) < miter->nr_heap) {
+		if (child + 1 < miter->nr_heap &&
+		    rb_merge_before(heap[child + 1], heap[child]))
+			child++;
+		if (!rb_merge_before(heap[child], mc))
+			break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = mc;
+}
+
+static void rb_merge_push(struct ring_buffer_merge_iter *miter,
+			  struct rb_merge_cpu *mc)
+{
+	struct rb_merge_cpu **heap = miter->heap;
+	int pos = miter->nr_heap++;
+
+	while (pos) {
+		int parent = (pos - 1) / 2;
+
+		if (!rb_merge_before(mc, heap[parent]))
+			break;
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = mc;
+}
+
+/*
+ * Move @mc to its next data event, pulling in a new page from the
+ * ring buffer when the current one is used up.  Returns 0 when the
+ * cpu buffer has nothing more to read.
+ */
+static int rb_merge_cpu_next(struct ring_buffer_merge_iter *miter,
+			     struct rb_merge_cpu *mc)
+{
+	struct buffer_data_page *bpage;
+	struct ring_buffer_event *event;
+	u64 delta;
+	int ret;
+
+ again:
+	bpage = mc->page;
+	while (mc->pos < mc->commit) {
+		event = (void *)&bpage->data[mc->pos];
+
+		/* end of page padding */
+		if (rb_null_event(event))
+			break;
+
+		mc->pos += rb_event_length(event);
+
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* discarded event */
+			break;
+
+		case RINGBUF_TYPE_TIME_EXTEND:
+			delta = event->array[0];
+			delta <<= TS_SHIFT;
+			delta += event->time_delta;
+			mc->ts += delta;
+			break;
+
+		case RINGBUF_TYPE_TIME_STAMP:
+			/* FIXME: not implemented */
+			break;
+
+		case RINGBUF_TYPE_DATA:
+			mc->ts += event->time_delta;
+			mc->event = event;
+			return 1;
+
+		default:
+			BUG();
+		}
+	}
+
+	mc->event = NULL;
+	ret = ring_buffer_read_page(miter->buffer, &mc->page, PAGE_SIZE,
+				    mc->cpu, 0);
+	if (ret < 0) {
+		mc->pos = mc->commit = 0;
+		return 0;
+	}
+
+	bpage = mc->page;
+	mc->pos = ret;
+	mc->commit = local_read(&bpage->commit);
+	mc->ts = bpage->time_stamp;
+	goto again;
+}
+
+/*
+ * Finish consuming the event returned last time and refill the heap
+ * with the cpus that had run dry.  This is deferred to the next call
+ * so that the returned event stays valid until then.
+ */
+static void rb_merge_update(struct ring_buffer_merge_iter *miter)
+{
+	struct rb_merge_cpu *mc = miter->consumed;
+	int i;
+
+	if (mc) {
+		miter->consumed = NULL;
+		if (rb_merge_cpu_next(miter, mc))
+			rb_merge_sift_down(miter, 0);
+		else {
+			miter->heap[0] = miter->heap[--miter->nr_heap];
+			if (miter->nr_heap)
+				rb_merge_sift_down(miter, 0);
+		}
+	}
+
+	if (miter->nr_heap)
+		return;
+
+	for (i = 0; i < miter->nr_cpus; i++) {
+		mc = &miter->cpus[i];
+		if (rb_merge_cpu_next(miter, mc))
+			rb_merge_push(miter, mc);
+	}
+}
+
+/**
+ * ring_buffer_merge_start - start a global ordered read of the buffer
+ * @buffer: The ring buffer to read from
+ *
+ * This sets up a consuming read of all the cpu buffers of @buffer,
+ * returning their events merged in timestamp order.  Events are
+ * consumed a page at a time: once the merge iterator has pulled in a
+ * page, its events are gone from the ring buffer, even if they have
+ * not been returned yet.
+ *
+ * A cpu buffer that runs empty is only looked at again once all the
+ * others have been drained as well.  Events recorded while the read
+ * is in progress may thus be returned after later events of other
+ * cpus.
+ *
+ * Must be paired with ring_buffer_merge_finish.  Only one reader may
+ * use the merge iterator at a time.
+ */
+struct ring_buffer_merge_iter *
+ring_buffer_merge_start(struct ring_buffer *buffer)
+{
+	struct ring_buffer_merge_iter *miter;
+	int nr_cpus = cpumask_weight(buffer->cpumask);
+	int cpu, i = 0;
+
+	miter = kzalloc(sizeof(*miter) + nr_cpus * sizeof(miter->cpus[0]),
+			GFP_KERNEL);
+	if (!miter)
+		return NULL;
+
+	miter->heap = kcalloc(nr_cpus, sizeof(*miter->heap), GFP_KERNEL);
+	if (!miter->heap)
+		goto fail;
+
+	miter->buffer = buffer;
+
+	for_each_buffer_cpu(buffer, cpu) {
+		struct rb_merge_cpu *mc;
+
+		if (i == nr_cpus)
+			break;
+
+		mc = &miter->cpus[i++];
+		mc->cpu = cpu;
+		mc->page = ring_buffer_alloc_read_page(buffer);
+		if (!mc->page)
+			goto fail;
+	}
+	miter->nr_cpus = i;
+
+	return miter;
+
+ fail:
+	miter->nr_cpus = i;
+	ring_buffer_merge_finish(miter);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_merge_start);
+
+/**
+ * ring_buffer_merge_finish - finish a global ordered read
+ * @miter: The merge iterator retrieved by ring_buffer_merge_start
+ *
+ * Frees the merge iterator.  Events that were pulled out of the ring
+ * buffer but not returned yet are dropped.
+ */
+void ring_buffer_merge_finish(struct ring_buffer_merge_iter *miter)
+{
+	int i;
+
+	for (i = 0; i < miter->nr_cpus; i++)
+		if (miter->cpus[i].page)
+			ring_buffer_free_read_page(miter->buffer,
+						   miter->cpus[i].page);
+	kfree(miter->heap);
+	kfree(miter);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_merge_finish);
+
+/**
+ * ring_buffer_merge_peek - peek at the oldest event of all cpus
+ * @miter: The merge iterator
+ * @cpu: if not NULL, the cpu the event was recorded on is stored here
+ * @ts: if not NULL, the normalized timestamp is stored here
+ *
+ * Returns the oldest event not returned by ring_buffer_merge_consume()
+ * yet, without consuming it, or NULL if there is none.
+ */
+struct ring_buffer_event *
+ring_buffer_merge_peek(struct ring_buffer_merge_iter *miter, int *cpu, u64 *ts)
+{
+	struct rb_merge_cpu *mc;
+
+	rb_merge_update(miter);
+	if (!miter->nr_heap)
+		return NULL;
+
+	mc = miter->heap[0];
+	if (cpu)
+		*cpu = mc->cpu;
+	if (ts) {
+		*ts = mc->ts;
+		ring_buffer_normalize_time_stamp(miter->buffer, mc->cpu, ts);
+	}
+	return mc->event;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_merge_peek);
+
+/**
+ * ring_buffer_merge_consume - return the oldest event of all cpus
+ * @miter: The merge iterator
+ * @cpu: if not NULL, the cpu the event was recorded on is stored here
+ * @ts: if not NULL, the normalized timestamp is stored here
+ *
+ * Returns the oldest event and consumes it, or NULL if all the cpu
+ * buffers are empty.  The event stays valid until the next call on
+ * @miter.
+ */
+struct ring_buffer_event *
+ring_buffer_merge_consume(struct ring_buffer_merge_iter *miter,
+			  int *cpu, u64 *ts)
+{
+	struct ring_buffer_event *event;
+
+	event = ring_buffer_merge_peek(miter, cpu, ts);
+	if (event)
+		miter->consumed = miter->heap[0];
+	return event;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_merge_consume);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
@@ -7,6 +7,7 @@
 #include <linux/completion.h>
 #include <linux/kthread.h>
 #include <linux/module.h>
+#include <linux/ktime.h>
 #include <linux/time.h>
 #include <asm/local.h>
 
@@ -31,6 +32,10 @@ static struct ring_buffer *buffer;
 static struct task_struct *producer;
 static struct task_struct *consumer;
 static unsigned long read;
+/* time the consumer spent reading, in nanosecs */
+static unsigned long long read_time;
+/* merged events that were older than the previous one of their cpu */
+static unsigned long unordered;
 
 static int disable_reader;
 module_param(disable_reader, uint, 0644);
@@ -58,7 +63,20 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, uint, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
-static int read_events;
+enum read_mode {
+	READ_EVENTS,
+	READ_PAGES,
+	READ_MERGED,
+	NR_READ_MODES,
+};
+
+static const char *read_mode_names[NR_READ_MODES] = {
+	[READ_EVENTS]	= "events",
+	[READ_PAGES]	= "pages",
+	[READ_MERGED]	= "merged events",
+};
+
+static int read_mode = NR_READ_MODES - 1;
 
 static int kill_test;
 
@@ -171,23 +189,64 @@ static enum event_status read_page(int cpu)
 	return EVENT_FOUND;
 }
 
+static u64 last_ts[NR_CPUS];
+
+/* read all cpus in timestamp order, through the merge iterator */
+static void read_merged(struct ring_buffer_merge_iter *miter)
+{
+	struct ring_buffer_event *event;
+	int *entry;
+	int cpu;
+	u64 ts;
+
+	while (!kill_test &&
+	       (event = ring_buffer_merge_consume(miter, &cpu, &ts))) {
+		entry = ring_buffer_event_data(event);
+		if (*entry != cpu) {
+			KILL_TEST();
+			break;
+		}
+		if (ts < last_ts[cpu])
+			unordered++;
+		last_ts[cpu] = ts;
+		read++;
+	}
+}
+
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	struct ring_buffer_merge_iter *miter = NULL;
+
+	/* cycle between reading events, pages and merged events */
+	read_mode = (read_mode + 1) % NR_READ_MODES;
+
+	if (read_mode == READ_MERGED) {
+		miter = ring_buffer_merge_start(buffer);
+		if (!miter)
+			read_mode = READ_EVENTS;
+		memset(last_ts, 0, sizeof(last_ts));
+	}
 
 	read = 0;
+	read_time = 0;
+	unordered = 0;
 	while (!reader_finish && !kill_test) {
+		u64 start = ktime_to_ns(ktime_get());
 		int found;
 
 		do {
 			int cpu;
 
 			found = 0;
+			if (read_mode == READ_MERGED) {
+				read_merged(miter);
+				break;
+			}
+
 			for_each_online_cpu(cpu) {
 				enum event_status stat;
 
-				if (read_events)
+				if (read_mode == READ_EVENTS)
 					stat = read_event(cpu);
 				else
 					stat = read_page(cpu);
@@ -199,6 +258,8 @@ static void ring_buffer_consumer(void)
 			}
 		} while (found && !kill_test);
 
+		read_time += ktime_to_ns(ktime_get()) - start;
+
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (reader_finish)
 			break;
@@ -206,6 +267,9 @@ static void ring_buffer_consumer(void)
 		schedule();
 		__set_current_state(TASK_RUNNING);
 	}
+	if (miter)
+		ring_buffer_merge_finish(miter);
+
 	reader_finish = 0;
 	complete(&read_done);
 }
@@ -316,12 +380,27 @@ static void ring_buffer_producer(void)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_mode_names[read_mode]);
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
 	trace_printk("Hit:      %ld\n", hit);
 
+	if (!disable_reader) {
+		unsigned long long rtime = read_time;
+
+		/* reader throughput, while it was actually reading */
+		do_div(rtime, NSEC_PER_USEC);
+		trace_printk("Read time: %lld (usecs)\n", rtime);
+		if (read) {
+			rtime = read_time;
+			do_div(rtime, read);
+			trace_printk("%lld ns per read entry\n", rtime);
+		}
+		if (read_mode == READ_MERGED)
+			trace_printk("Unordered: %ld\n", unordered);
+	}
+
 	/* Convert time from usecs to millisecs */
 	do_div(time, USEC_PER_MSEC);
 	if (time)
@@ -3755,8 +3755,9 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		.ops		= &buffer_pipe_buf_ops,
 		.spd_release	= buffer_spd_release,
 	};
+	void *rpages[PIPE_BUFFERS];
 	struct buffer_ref *ref;
-	int entries, size, i;
+	int entries, size, i, nr, nr_refs;
 	size_t ret;
 
 	if (*ppos & (PAGE_SIZE - 1)) {
@@ -3774,10 +3775,13 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	trace_access_lock(info->cpu);
 	entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 
-	for (i = 0; i < PIPE_BUFFERS && len && entries; i++, len -= PAGE_SIZE) {
-		struct page *page;
-		int r;
-
+	/*
+	 * Allocate the pages up front and pull in as many full pages as
+	 * there are in one go, rather than taking the reader lock for
+	 * every page.
+	 */
+	nr = min_t(size_t, PIPE_BUFFERS, len >> PAGE_SHIFT);
+	for (i = 0; i < nr && entries; i++) {
 		ref = kzalloc(sizeof(*ref), GFP_KERNEL);
 		if (!ref)
 			break;
@@ -3790,15 +3794,28 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 			break;
 		}
 
-		r = ring_buffer_read_page(ref->buffer, &ref->page,
-					  len, info->cpu, 1);
-		if (r < 0) {
-			ring_buffer_free_read_page(ref->buffer,
-						   ref->page);
+		rpages[i] = ref->page;
+		spd.partial[i].private = (unsigned long)ref;
+	}
+	nr_refs = i;
+
+	nr = 0;
+	if (nr_refs)
+		nr = ring_buffer_read_pages(info->tr->buffer, rpages, nr_refs,
+					    info->cpu);
+
+	for (i = 0; i < nr_refs; i++) {
+		ref = (struct buffer_ref *)spd.partial[i].private;
+
+		if (i >= nr) {
+			/* not used, ref->page was left alone */
+			ring_buffer_free_read_page(ref->buffer, ref->page);
 			kfree(ref);
-			break;
+			continue;
 		}
 
+		ref->page = rpages[i];
+
 		/*
 		 * zero out any left over data, this is going to
 		 * user land.
@@ -3807,20 +3824,14 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		if (size < PAGE_SIZE)
 			memset(ref->page + size, 0, PAGE_SIZE - size);
 
-		page = virt_to_page(ref->page);
-
-		spd.pages[i] = page;
+		spd.pages[i] = virt_to_page(ref->page);
 		spd.partial[i].len = PAGE_SIZE;
 		spd.partial[i].offset = 0;
-		spd.partial[i].private = (unsigned long)ref;
-		spd.nr_pages++;
 		*ppos += PAGE_SIZE;
-
-		entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 	}
 
 	trace_access_unlock(info->cpu);
-	spd.nr_pages = i;
+	spd.nr_pages = nr;
 
 	/* did we read anything? */
 	if (!spd.nr_pages) {
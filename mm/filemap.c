@@ -80,7 +80,7 @@
  *  ->i_mutex
  *    ->i_alloc_sem             (various)
  *
- *  ->inode_lock
+ *  ->inode_wb_list_lock
  *    ->sb_lock			(fs/fs-writeback.c)
  *    ->mapping->tree_lock	(__sync_single_inode)
  *
@@ -98,8 +98,8 @@
  *    ->zone.lru_lock		(check_pte_range->isolate_lru_page)
  *    ->private_lock		(page_remove_rmap->set_page_dirty)
  *    ->tree_lock		(page_remove_rmap->set_page_dirty)
- *    ->inode_lock		(page_remove_rmap->set_page_dirty)
- *    ->inode_lock		(zap_pte_range->set_page_dirty)
+ *    ->inode->i_lock		(page_remove_rmap->set_page_dirty)
+ *    ->inode->i_lock		(zap_pte_range->set_page_dirty)
  *    ->private_lock		(zap_pte_range->__set_page_dirty_buffers)
  *
  *  ->task->proc_lock
@@ -591,6 +591,59 @@ int __lock_page_killable(struct page *page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+/*
+ * lock_page_async - lock a page without sleeping, for an async kiocb
+ * @page: the page to lock, on which the caller holds a reference
+ * @iocb: the kiocb of the read
+ *
+ * If the page is locked, queue @iocb->ki_wait on the page's wait queue so
+ * that unlocking the page kicks a retry of the iocb, start the I/O that
+ * is probably holding the lock, and return -EIOCBRETRY.  The caller must
+ * not try again before that retry: ki_wait can only be queued once.
+ */
+static int lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	struct address_space *mapping;
+	unsigned long flags;
+
+	if (trylock_page(page))
+		return 0;
+
+	/* Already waiting for a page: the retry is still to come */
+	if (WARN_ON_ONCE(!list_empty_careful(&wait->wait.task_list)))
+		return -EIOCBRETRY;
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+	iocb->ki_wait_head = wq;
+	add_wait_queue(wq, &wait->wait);
+	/* The page may have been unlocked before we were queued */
+	if (trylock_page(page)) {
+		spin_lock_irqsave(&wq->lock, flags);
+		list_del_init(&wait->wait.task_list);
+		spin_unlock_irqrestore(&wq->lock, flags);
+		return 0;
+	}
+
+	mapping = page_mapping(page);
+	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
+		mapping->a_ops->sync_page(page);
+	return -EIOCBRETRY;
+}
+
+/*
+ * Reads on behalf of an async kiocb do not sleep on pages being read in:
+ * they return -EIOCBRETRY and are retried once the page is unlocked.
+ */
+static int lock_page_for_read(struct page *page, struct kiocb *iocb)
+{
+	if (!is_sync_kiocb(iocb))
+		return lock_page_async(page, iocb);
+	return lock_page_killable(page);
+}
+
 /**
  * __lock_page_nosync - get a lock on the page, without calling sync_page()
  * @page: the page to lock
@@ -949,9 +1002,29 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Look up a run of up to @nr_pages contiguous, uptodate pages starting at
+ * @index with a single gang lookup.  Returns the number of pages found,
+ * each with a reference held: zero if the page at @index is not cached
+ * or not uptodate yet.
+ */
+static unsigned find_get_read_batch(struct address_space *mapping,
+		pgoff_t index, unsigned int nr_pages, struct page **pages)
+{
+	unsigned int i, nr;
+
+	nr = find_get_pages_contig(mapping, index, nr_pages, pages);
+	for (i = 0; i < nr; i++)
+		if (!PageUptodate(pages[i]))
+			break;
+	while (nr > i)
+		page_cache_release(pages[--nr]);
+	return nr;
+}
+
 /**
  * do_generic_file_read - generic file read routine
- * @filp:	the file to read
+ * @iocb:	the kiocb of the read
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
@@ -959,12 +1032,20 @@ static void shrink_readahead_size_eio(struct file *filp,
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * For an async kiocb, it does not wait for pages to be read in: it
+ * returns what it copied so far, or -EIOCBRETRY in @desc->error if it
+ * copied nothing, and the kiocb is retried once the page is unlocked.
+ *
+ * Runs of cached, uptodate pages are looked up PAGEVEC_SIZE at a time,
+ * and readahead is triggered at most once per such batch.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
-static void do_generic_file_read(struct file *filp, loff_t *ppos,
+static void do_generic_file_read(struct kiocb *iocb, loff_t *ppos,
 		read_descriptor_t *desc, read_actor_t actor)
 {
+	struct file *filp = iocb->ki_filp;
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
 	struct file_ra_state *ra = &filp->f_ra;
@@ -973,6 +1054,8 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	struct page *batch[PAGEVEC_SIZE];
+	unsigned int batch_nr = 0, batch_idx = 0;
 	int error;
 
 	index = *ppos >> PAGE_CACHE_SHIFT;
@@ -989,6 +1072,36 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 
 		cond_resched();
 find_page:
+		if (batch_idx < batch_nr) {
+			if (batch[batch_idx]->index == index) {
+				page = batch[batch_idx++];
+				goto page_ok;
+			}
+			/* Short read at EOF or a retry: drop the rest */
+			while (batch_idx < batch_nr)
+				page_cache_release(batch[batch_idx++]);
+		}
+
+		batch_idx = 0;
+		batch_nr = find_get_read_batch(mapping, index,
+				min_t(pgoff_t, last_index - index, PAGEVEC_SIZE),
+				batch);
+		if (batch_nr) {
+			unsigned int i;
+
+			for (i = 0; i < batch_nr; i++) {
+				if (!PageReadahead(batch[i]))
+					continue;
+				page_cache_async_readahead(mapping,
+						ra, filp, batch[i],
+						batch[i]->index,
+						last_index - batch[i]->index);
+				break;
+			}
+			page = batch[batch_idx++];
+			goto page_ok;
+		}
+
 		page = find_get_page(mapping, index);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
@@ -1080,7 +1193,7 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		error = lock_page_for_read(page, iocb);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1111,7 +1224,7 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			error = lock_page_for_read(page, iocb);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1162,6 +1275,9 @@ no_cached_page:
 	}
 
 out:
+	while (batch_idx < batch_nr)
+		page_cache_release(batch[batch_idx++]);
+
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -1308,7 +1424,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(iocb, ppos, &desc, file_read_actor);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -0,0 +1,1904 @@
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * Suitably aligned ranges of private anonymous vmas are faulted in as
+ * a single compound page mapped by a huge pmd, and khugepaged collapses
+ * ranges which were populated with small pages into huge pages later.
+ * A huge pmd is split back into a pte table whenever the rest of the
+ * VM needs to see small pages, see include/linux/huge_mm.h.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
+#include <linux/rmap.h>
+#include <linux/ksm.h>
+#include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/pagemap.h>
+#include <linux/memcontrol.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/slab.h>
+#include <linux/huge_mm.h>
+#include <linux/khugepaged.h>
+#include <asm/tlb.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+/*
+ * By default transparent hugepage support is enabled for all mappings
+ * or only for madvise(MADV_HUGEPAGE) regions, depending on the Kconfig
+ * choice.  Defrag lets the page fault enter direct reclaim to find a
+ * huge page instead of falling back to small pages right away.
+ */
+unsigned long transparent_hugepage_flags __read_mostly =
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_ALWAYS
+	(1<<TRANSPARENT_HUGEPAGE_FLAG)|
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_MADVISE
+	(1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)|
+#endif
+	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_FLAG);
+
+#define khugepaged_enabled()					       \
+	(transparent_hugepage_flags &				       \
+	 ((1<<TRANSPARENT_HUGEPAGE_FLAG) |			       \
+	  (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)))
+#define transparent_hugepage_defrag()				       \
+	test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_FLAG, &transparent_hugepage_flags)
+
+/*
+ * All mapped huge pages, linked through page->lru (they are not on the
+ * LRU), so that reclaim can find pages to split.  The oldest are at the
+ * tail.
+ */
+static LIST_HEAD(huge_page_list);
+static DEFINE_SPINLOCK(huge_page_list_lock);
+static unsigned long huge_page_list_nr;
+
+/* default scan 8*512 pte (or vmas) every 10 second */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+/* during fragmentation poll the hugepage allocator once every minute */
+static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
+/* how many empty (or zero page) ptes a collapsed range may contain */
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
+
+static struct task_struct *khugepaged_thread __read_mostly;
+static DEFINE_MUTEX(khugepaged_mutex);
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+
+#define MM_SLOTS_HASH_HEADS 1024
+static struct hlist_head *mm_slots_hash __read_mostly;
+static struct kmem_cache *mm_slot_cache __read_mostly;
+
+/**
+ * struct mm_slot - hash lookup from mm to mm_slot
+ * @hash: hash collision list
+ * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm: the mm that this information is valid for
+ */
+struct mm_slot {
+	struct hlist_node hash;
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+/**
+ * struct khugepaged_scan - cursor for scanning
+ * @mm_head: the head of the mm list to scan
+ * @mm_slot: the current mm_slot we are scanning
+ * @address: the next address inside that to be scanned
+ *
+ * There is only the one khugepaged_scan instance of this cursor structure.
+ */
+struct khugepaged_scan {
+	struct list_head mm_head;
+	struct mm_slot *mm_slot;
+	unsigned long address;
+};
+static struct khugepaged_scan khugepaged_scan = {
+	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+};
+
+static int start_khugepaged(void);
+
+/*
+ * The pte table needed to split a huge pmd is allocated when the huge
+ * pmd is established and kept aside on a per-mm list until then, so
+ * that splitting can never fail.  This relies on pgtable_t being a
+ * struct page, as it is on x86.
+ */
+static void prepare_pmd_huge_pte(pgtable_t pgtable, struct mm_struct *mm)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	/* FIFO */
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t get_pmd_huge_pte(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	/* FIFO */
+	pgtable = mm->pmd_huge_pte;
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+static void huge_page_list_add(struct page *page)
+{
+	spin_lock(&huge_page_list_lock);
+	list_add(&page->lru, &huge_page_list);
+	huge_page_list_nr++;
+	spin_unlock(&huge_page_list_lock);
+}
+
+static void huge_page_list_del(struct page *page)
+{
+	spin_lock(&huge_page_list_lock);
+	list_del_init(&page->lru);
+	huge_page_list_nr--;
+	spin_unlock(&huge_page_list_lock);
+}
+
+/* Find the pmd mapping @address, NULL if there is no page table for it */
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	/* a huge pmd made PROT_NONE is not present, but still huge */
+	pmd = pmd_offset(pud, address);
+	if (pmd_none(*pmd))
+		return NULL;
+
+	return pmd;
+}
+
+static struct page *alloc_hugepage(int defrag)
+{
+	gfp_t gfp = GFP_HIGHUSER_MOVABLE | __GFP_COMP | __GFP_NOWARN;
+
+	if (!defrag)
+		gfp &= ~__GFP_WAIT;
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+
+static void clear_hugepage(struct page *page, unsigned long haddr)
+{
+	int i;
+
+	might_sleep();
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+	}
+}
+
+static pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pmd_t entry;
+
+	entry = pfn_pmd(page_to_pfn(page), vma->vm_page_prot);
+	entry = pmd_mkhuge(pmd_mkyoung(pmd_mkdirty(entry)));
+	/* a new huge page is private to this mm: nothing to COW */
+	if (likely(vma->vm_flags & VM_WRITE))
+		entry = pmd_mkwrite(entry);
+	return entry;
+}
+
+/*
+ * Map the new huge @page at @haddr, keeping @pgtable for splitting.
+ * Called with page_table_lock held and *pmd none.
+ */
+static void map_huge_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			 unsigned long haddr, pmd_t *pmd, struct page *page,
+			 pgtable_t pgtable)
+{
+	VM_BUG_ON(!pmd_none(*pmd));
+
+	page_add_huge_anon_rmap(page, vma, haddr);
+	prepare_pmd_huge_pte(pgtable, mm);
+	set_pmd_at(mm, haddr, pmd, mk_huge_pmd(page, vma));
+	huge_page_list_add(page);
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	if (unlikely(khugepaged_enter(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage(transparent_hugepage_defrag());
+	if (unlikely(!page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	/* over the cgroup limit: small pages are charged one by one */
+	if (unlikely(mem_cgroup_newpage_charge(page, mm, GFP_KERNEL))) {
+		put_page(page);
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		mem_cgroup_uncharge_page(page);
+		put_page(page);
+		return VM_FAULT_OOM;
+	}
+
+	clear_hugepage(page, haddr);
+	/* the clearing must be visible before the pmd, see __SetPageUptodate */
+	__SetPageUptodate(page);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		mem_cgroup_uncharge_page(page);
+		put_page(page);
+		pte_free(mm, pgtable);
+		return 0;
+	}
+	map_huge_pmd(mm, vma, haddr, pmd, page, pgtable);
+	add_mm_counter(mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return 0;
+}
+
+/*
+ * A write fault on a huge page shared with another mm since fork():
+ * copy it into a new huge page.  If none can be allocated or charged,
+ * split the pmd and let the small pages be copied one by one.  The
+ * caller holds a reference on @page.
+ */
+static int do_huge_pmd_wp_page(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       pmd_t orig_pmd, struct page *page)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *new_page;
+	int i;
+
+	new_page = alloc_hugepage(transparent_hugepage_defrag());
+	if (unlikely(!new_page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		goto split;
+	}
+	if (unlikely(mem_cgroup_newpage_charge(new_page, mm, GFP_KERNEL))) {
+		put_page(new_page);
+		count_vm_event(THP_FAULT_FALLBACK);
+		goto split;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		copy_user_highpage(new_page + i, page + i,
+				   haddr + i * PAGE_SIZE, vma);
+	}
+	__SetPageUptodate(new_page);
+
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_same(*pmd, orig_pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		mem_cgroup_uncharge_page(new_page);
+		put_page(new_page);
+		goto out;
+	}
+	pmdp_get_and_clear(mm, haddr, pmd);
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	page_add_huge_anon_rmap(new_page, vma, haddr);
+	set_pmd_at(mm, haddr, pmd, mk_huge_pmd(new_page, vma));
+	huge_page_list_add(new_page);
+	if (page_remove_huge_anon_rmap(page))
+		huge_page_list_del(page);
+	spin_unlock(&mm->page_table_lock);
+	/* the reference of the mapping just taken down */
+	put_page(page);
+	count_vm_event(THP_FAULT_ALLOC);
+out:
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	put_page(page);
+	return 0;
+
+split:
+	__split_huge_page_pmd(mm, address, pmd);
+	put_page(page);
+	return 0;
+}
+
+/*
+ * A fault on a present huge pmd: the accessed or dirty bit wasn't set,
+ * it was write protected by mprotect(), or it is shared since fork().
+ */
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		      unsigned long address, pmd_t *pmd, pmd_t orig_pmd,
+		      unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pmd_t entry;
+
+	/*
+	 * A forced write (ptrace) into a read-only mapping must COW:
+	 * leave that to the small page fault path.
+	 */
+	if ((flags & FAULT_FLAG_WRITE) && !(vma->vm_flags & VM_WRITE)) {
+		__split_huge_page_pmd(mm, address, pmd);
+		return 0;
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_same(*pmd, orig_pmd)))
+		goto unlock;
+	page = pmd_page(orig_pmd);
+	if ((flags & FAULT_FLAG_WRITE) && !pmd_write(orig_pmd) &&
+	    PageAnon(page) && page_mapcount(page) != 1) {
+		get_page(page);
+		spin_unlock(&mm->page_table_lock);
+		return do_huge_pmd_wp_page(mm, vma, address, pmd,
+					   orig_pmd, page);
+	}
+	entry = pmd_mkyoung(orig_pmd);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = pmd_mkwrite(pmd_mkdirty(entry));
+	if (!pmd_same(entry, orig_pmd))
+		set_pmd_at(mm, haddr, pmd, entry);
+	else if (flags & FAULT_FLAG_WRITE)
+		flush_tlb_page(vma, address);
+unlock:
+	spin_unlock(&mm->page_table_lock);
+	return 0;
+}
+
+/**
+ * do_huge_pmd_file_page - map page cache pages with a huge pmd
+ * @vma: the shared file mapping faulted on
+ * @address: the faulting address
+ * @pmd: the pmd, none when the fault started
+ * @page: the first of HPAGE_PMD_NR page cache pages
+ * @flags: the fault flags
+ *
+ * The pages must be physically contiguous and aligned, consecutive in
+ * the file, and mapped by @vma at the huge pmd containing @address.
+ * The caller holds them locked and uptodate, so that they can't be
+ * truncated, and holds a reference on each which is transferred to the
+ * mapping when the pmd is established.
+ *
+ * Returns 0 if the pmd was established, VM_FAULT_FALLBACK if the page
+ * references are left to the caller, VM_FAULT_OOM if it failed.
+ */
+int do_huge_pmd_file_page(struct vm_area_struct *vma, unsigned long address,
+			  pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+	VM_BUG_ON(!(vma->vm_flags & VM_SHARED));
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return VM_FAULT_FALLBACK;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	entry = pfn_pmd(page_to_pfn(page), vma->vm_page_prot);
+	entry = pmd_mkhuge(pmd_mkyoung(entry));
+	if (flags & FAULT_FLAG_WRITE)
+		entry = pmd_mkwrite(pmd_mkdirty(entry));
+	prepare_pmd_huge_pte(pgtable, mm);
+	set_pmd_at(mm, haddr, pmd, entry);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return 0;
+}
+
+/*
+ * get_user_pages() on a huge pmd mapping page cache: the subpages are
+ * normal pages, so there is no need to split the pmd.  Returns NULL if
+ * a write fault is needed first.  Called with page_table_lock held.
+ */
+struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+				   unsigned long address, pmd_t *pmd,
+				   unsigned int flags)
+{
+	struct page *page;
+
+	assert_spin_locked(&vma->vm_mm->page_table_lock);
+
+	if ((flags & FOLL_WRITE) && !pmd_write(*pmd))
+		return NULL;
+
+	page = pmd_page(*pmd);
+	VM_BUG_ON(PageAnon(page));
+	page += (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	if (flags & FOLL_GET)
+		get_page(page);
+	if (flags & FOLL_TOUCH) {
+		if ((flags & FOLL_WRITE) &&
+		    !pmd_dirty(*pmd) && !PageDirty(page))
+			set_page_dirty(page);
+		mark_page_accessed(page);
+	}
+	return page;
+}
+
+/*
+ * fork(): share the huge page with the child, write protected in both
+ * mms, as copy_one_pte() does with small pages.  A huge pmd mapping
+ * page cache is not copied: the child faults the pages in.  Returns 0
+ * if done, -EAGAIN if the pmd was split and the ptes are to be copied
+ * instead, -ENOMEM if out of memory.
+ */
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
+		  struct vm_area_struct *vma)
+{
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t pmd;
+	int ret;
+
+	pgtable = pte_alloc_one(dst_mm, addr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&dst_mm->page_table_lock);
+	spin_lock_nested(&src_mm->page_table_lock, SINGLE_DEPTH_NESTING);
+
+	ret = -EAGAIN;
+	pmd = *src_pmd;
+	if (unlikely(!pmd_trans_huge(pmd)))
+		goto out_free;
+	if (unlikely(pmd_trans_splitting(pmd))) {
+		spin_unlock(&src_mm->page_table_lock);
+		spin_unlock(&dst_mm->page_table_lock);
+		pte_free(dst_mm, pgtable);
+		wait_split_huge_page(src_mm, src_pmd);
+		return -EAGAIN;
+	}
+	ret = 0;
+	page = pmd_page(pmd);
+	if (!PageAnon(page))
+		goto out_free;
+
+	VM_BUG_ON(!pmd_none(*dst_pmd));
+	get_page(page);
+	page_dup_rmap(page);
+	add_mm_counter(dst_mm, MM_ANONPAGES, HPAGE_PMD_NR);
+
+	/* the caller flushes the TLB of src_mm */
+	pmdp_set_wrprotect(src_mm, addr, src_pmd);
+	pmd = pmd_mkold(pmd_wrprotect(pmd));
+	prepare_pmd_huge_pte(pgtable, dst_mm);
+	set_pmd_at(dst_mm, addr, dst_pmd, pmd);
+	dst_mm->nr_ptes++;
+	goto out_unlock;
+
+out_free:
+	pte_free(dst_mm, pgtable);
+out_unlock:
+	spin_unlock(&src_mm->page_table_lock);
+	spin_unlock(&dst_mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Unmap a huge pmd fully covered by the range being zapped.  Returns 1
+ * if it did, 0 if the pmd was split or zapped from under us.
+ */
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd)
+{
+	struct mm_struct *mm = tlb->mm;
+	pgtable_t pgtable;
+	struct page *page;
+	pmd_t orig_pmd;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	if (unlikely(pmd_trans_splitting(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		wait_split_huge_page(mm, pmd);
+		return 0;
+	}
+	orig_pmd = pmdp_get_and_clear(mm, 0, pmd);
+	page = pmd_page(orig_pmd);
+	pgtable = get_pmd_huge_pte(mm);
+	if (PageAnon(page)) {
+		if (page_remove_huge_anon_rmap(page))
+			huge_page_list_del(page);
+		add_mm_counter(mm, MM_ANONPAGES, -HPAGE_PMD_NR);
+	} else {
+		/* page cache pages, mapped one by one, as by zap_pte_range */
+		for (i = 0; i < HPAGE_PMD_NR; i++) {
+			if (pmd_dirty(orig_pmd))
+				set_page_dirty(page + i);
+			if (pmd_young(orig_pmd) &&
+			    likely(!VM_SequentialReadHint(vma)))
+				mark_page_accessed(page + i);
+			page_remove_rmap(page + i);
+		}
+		add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	}
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+
+	if (PageCompound(page))
+		tlb_remove_page(tlb, page);
+	else
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+	return 1;
+}
+
+/*
+ * mprotect() of a range fully covering a huge pmd.  Returns 1 if the
+ * protection was changed, 0 if the pmd was split from under us.
+ */
+int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		    unsigned long addr, pgprot_t newprot)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd))) {
+		pmd_t entry;
+
+		if (unlikely(pmd_trans_splitting(*pmd))) {
+			spin_unlock(&mm->page_table_lock);
+			wait_split_huge_page(mm, pmd);
+			return 0;
+		}
+		entry = pmdp_get_and_clear(mm, addr, pmd);
+		entry = pmd_modify(entry, newprot);
+		set_pmd_at(mm, addr, pmd, entry);
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Replace the huge pmd by a pte table mapping the subpages with the
+ * same protection.  Called with page_table_lock held.
+ */
+static void __split_huge_pmd_map(struct mm_struct *mm, unsigned long haddr,
+				 pmd_t *pmd)
+{
+	pmd_t orig_pmd = *pmd, _pmd;
+	struct page *page = pmd_page(orig_pmd);
+	pgprot_t prot = pmd_pgprot(orig_pmd);
+	pgtable_t pgtable;
+	pte_t *pte;
+	int i;
+
+	VM_BUG_ON(haddr & ~HPAGE_PMD_MASK);
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+	pte = pte_offset_map(&_pmd, haddr);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		set_pte_at(mm, haddr + i * PAGE_SIZE, pte + i,
+			   pfn_pte(page_to_pfn(page) + i, prot));
+	pte_unmap(pte);
+	smp_wmb(); /* make the ptes visible before the pmd */
+
+	/* don't let huge and small TLB entries for the range coexist */
+	pmd_clear(pmd);
+	flush_tlb_mm(mm);
+	pmd_populate(mm, pmd, pgtable);
+}
+
+/* The huge pmd of @mm mapping @page at @address, or NULL */
+static pmd_t *page_check_address_pmd(struct page *page, struct mm_struct *mm,
+				     unsigned long address)
+{
+	pmd_t *pmd;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pmd = mm_find_pmd(mm, address);
+	if (pmd && pmd_trans_huge(*pmd) && pmd_page(*pmd) == page)
+		return pmd;
+	return NULL;
+}
+
+/*
+ * Mark the pmd of @vma mapping the huge page as splitting, and flush it
+ * from the TLB: gup_fast, which runs with irqs disabled and looks at
+ * the compound page behind a huge pmd, is excluded by the IPI from then
+ * on.  Returns 1 if @vma maps the page.
+ */
+static int __split_huge_page_splitting(struct page *page,
+				       struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address = vma_address(page, vma);
+	pmd_t *pmd;
+	int ret = 0;
+
+	if (address == -EFAULT)
+		return 0;
+
+	spin_lock(&mm->page_table_lock);
+	pmd = page_check_address_pmd(page, mm, address);
+	if (pmd) {
+		VM_BUG_ON(pmd_trans_splitting(*pmd));
+		pmdp_set_splitting(mm, address, pmd);
+		flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Turn the compound page into HPAGE_PMD_NR normal anonymous pages on
+ * the LRU, each mapped @mapcount times, as the huge page was.  Each
+ * huge pmd held a reference on the head page: the ptes replacing it
+ * hold one on every subpage.
+ */
+static void __split_huge_page_refcount(struct page *page, int mapcount)
+{
+	struct address_space *mapping = page->mapping;
+	pgoff_t index = page->index;
+	int i;
+
+	VM_BUG_ON(!PageHead(page));
+	huge_page_list_del(page);
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+
+	__ClearPageHead(page);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *subpage = page + i;
+
+		if (i) {
+			__ClearPageTail(subpage);
+			set_page_private(subpage, 0);
+			set_page_count(subpage, mapcount);
+			SetPageUptodate(subpage);
+			/* the head page was charged for all of them */
+			mem_cgroup_split_huge_fixup(page, subpage);
+		}
+		SetPageSwapBacked(subpage);
+		atomic_set(&subpage->_mapcount, mapcount - 1);
+		subpage->mapping = mapping;
+		subpage->index = index + i;
+		lru_cache_add_lru(subpage, LRU_ACTIVE_ANON);
+	}
+}
+
+/* Replace the splitting pmd of @vma mapping the page by ptes */
+static int __split_huge_page_map(struct page *page,
+				 struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address = vma_address(page, vma);
+	pmd_t *pmd;
+	int ret = 0;
+
+	if (address == -EFAULT)
+		return 0;
+
+	spin_lock(&mm->page_table_lock);
+	pmd = page_check_address_pmd(page, mm, address);
+	if (pmd) {
+		VM_BUG_ON(!pmd_trans_splitting(*pmd));
+		__split_huge_pmd_map(mm, address, pmd);
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Split the huge page in all the pmds mapping it.  The anon_vma lock,
+ * held throughout, keeps rmap walks away and the vmas to visit stable;
+ * whoever finds a pmd marked splitting, fork() included, waits for it
+ * in wait_split_huge_page().  The caller holds a reference on the page.
+ * Returns 1 if the page was split.
+ */
+static int split_huge_page(struct page *page)
+{
+	struct anon_vma *anon_vma;
+	struct anon_vma_chain *avc;
+	int mapcount = 0, mapped = 0, ret = 0;
+
+	anon_vma = page_lock_anon_vma(page);
+	if (!anon_vma)
+		return 0;
+	/* split by someone else while we waited for the lock */
+	if (!PageHead(page))
+		goto out_unlock;
+
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma)
+		mapcount += __split_huge_page_splitting(page, avc->vma);
+	/* the last mapping went away meanwhile */
+	if (!mapcount)
+		goto out_unlock;
+	BUG_ON(mapcount != page_mapcount(page));
+
+	__split_huge_page_refcount(page, mapcount);
+
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma)
+		mapped += __split_huge_page_map(page, avc->vma);
+	BUG_ON(mapped != mapcount);
+
+	count_vm_event(THP_SPLIT);
+	ret = 1;
+out_unlock:
+	page_unlock_anon_vma(anon_vma);
+	return ret;
+}
+
+/*
+ * Wait until split_huge_page() is done with a pmd it marked splitting:
+ * it holds the anon_vma lock of the page until then.
+ */
+void wait_split_huge_page(struct mm_struct *mm, pmd_t *pmd)
+{
+	struct anon_vma *anon_vma = NULL;
+
+	/* anon_vmas are SLAB_DESTROY_BY_RCU */
+	rcu_read_lock();
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_trans_splitting(*pmd))
+		anon_vma = page_anon_vma(pmd_page(*pmd));
+	spin_unlock(&mm->page_table_lock);
+	if (anon_vma) {
+		spin_lock(&anon_vma->lock);
+		spin_unlock(&anon_vma->lock);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Split the huge pmd at @address.  A huge pmd mapping page cache maps
+ * normal pages, which only need the ptes; an anonymous huge page is
+ * split in every mm sharing it.
+ */
+void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmd)
+{
+	struct page *page;
+
+again:
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		__split_huge_pmd_map(mm, address & HPAGE_PMD_MASK, pmd);
+		spin_unlock(&mm->page_table_lock);
+		count_vm_event(THP_SPLIT);
+		return;
+	}
+	get_page(page);
+	spin_unlock(&mm->page_table_lock);
+
+	split_huge_page(page);
+	put_page(page);
+	/* a COW fault may have mapped a new huge page meanwhile */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		goto again;
+}
+
+static void split_huge_page_address(struct mm_struct *mm,
+				    unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = mm_find_pmd(mm, address);
+	if (pmd)
+		split_huge_page_pmd(mm, address, pmd);
+}
+
+/*
+ * A huge pmd must never straddle a vma boundary: split it when a vma is
+ * split or resized in the middle of it.  Called by vma_adjust() with
+ * mmap_sem held for write.
+ */
+void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+			     unsigned long start, unsigned long end,
+			     long adjust_next)
+{
+	if (start & ~HPAGE_PMD_MASK &&
+	    (start & HPAGE_PMD_MASK) >= vma->vm_start &&
+	    (start & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_page_address(vma->vm_mm, start);
+
+	if (end & ~HPAGE_PMD_MASK &&
+	    (end & HPAGE_PMD_MASK) >= vma->vm_start &&
+	    (end & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_page_address(vma->vm_mm, end);
+
+	if (adjust_next > 0) {
+		struct vm_area_struct *next = vma->vm_next;
+		unsigned long nstart = next->vm_start;
+
+		nstart += adjust_next << PAGE_SHIFT;
+		if (nstart & ~HPAGE_PMD_MASK &&
+		    (nstart & HPAGE_PMD_MASK) >= next->vm_start &&
+		    (nstart & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= next->vm_end)
+			split_huge_page_address(next->vm_mm, nstart);
+	}
+}
+
+/**
+ * split_huge_pages_zone - split huge pages of a zone for reclaim
+ * @zone: the zone being reclaimed
+ * @nr_to_split: how many huge pages to split
+ * @mem: only split the pages charged to this memory cgroup, if not NULL
+ *
+ * Huge pages are not on the LRU, so page reclaim can't swap them out.
+ * When reclaim puts pressure on anonymous memory, it calls this to turn
+ * the oldest huge pages of the zone into small pages on the LRU.
+ *
+ * Returns the number of huge pages split.
+ */
+unsigned long split_huge_pages_zone(struct zone *zone,
+				    unsigned long nr_to_split,
+				    struct mem_cgroup *mem)
+{
+	unsigned long nr_split = 0, nr_scan;
+	struct page *page;
+
+	spin_lock(&huge_page_list_lock);
+	nr_scan = huge_page_list_nr;
+	spin_unlock(&huge_page_list_lock);
+
+	while (nr_split < nr_to_split && nr_scan--) {
+		spin_lock(&huge_page_list_lock);
+		if (list_empty(&huge_page_list)) {
+			spin_unlock(&huge_page_list_lock);
+			break;
+		}
+		page = list_entry(huge_page_list.prev, struct page, lru);
+		list_move(&page->lru, &huge_page_list);
+		if (page_zone(page) != zone ||
+		    (mem && !mem_cgroup_page_charged_to(page, mem))) {
+			spin_unlock(&huge_page_list_lock);
+			continue;
+		}
+		/* listed while mapped: the last unmap unlists it first */
+		get_page(page);
+		spin_unlock(&huge_page_list_lock);
+
+		nr_split += split_huge_page(page);
+		put_page(page);
+		cond_resched();
+	}
+	return nr_split;
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		if (*vm_flags & VM_NO_THP || vma->vm_ops || vma->vm_file)
+			return -EINVAL;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * Register the mm with khugepaged right away: a page fault
+		 * in the range may not happen any time soon.
+		 */
+		if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+		    __khugepaged_enter(vma->vm_mm))
+			return -ENOMEM;
+		break;
+	case MADV_NOHUGEPAGE:
+		*vm_flags &= ~VM_HUGEPAGE;
+		break;
+	}
+	return 0;
+}
+
+static int __init khugepaged_slab_init(void)
+{
+	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
+					  sizeof(struct mm_slot),
+					  __alignof__(struct mm_slot), 0, NULL);
+	if (!mm_slot_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static inline struct mm_slot *alloc_mm_slot(void)
+{
+	if (!mm_slot_cache)	/* initialization failed */
+		return NULL;
+	return kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+}
+
+static inline void free_mm_slot(struct mm_slot *mm_slot)
+{
+	kmem_cache_free(mm_slot_cache, mm_slot);
+}
+
+static int __init mm_slots_hash_init(void)
+{
+	mm_slots_hash = kzalloc(MM_SLOTS_HASH_HEADS * sizeof(struct hlist_head),
+				GFP_KERNEL);
+	if (!mm_slots_hash)
+		return -ENOMEM;
+	return 0;
+}
+
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_head *bucket;
+	struct hlist_node *node;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	hlist_for_each_entry(mm_slot, node, bucket, hash) {
+		if (mm == mm_slot->mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static void insert_to_mm_slots_hash(struct mm_struct *mm,
+				    struct mm_slot *mm_slot)
+{
+	struct hlist_head *bucket;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	mm_slot->mm = mm;
+	hlist_add_head(&mm_slot->hash, bucket);
+}
+
+static inline int khugepaged_test_exit(struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) == 0;
+}
+
+int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int wakeup;
+
+	mm_slot = alloc_mm_slot();
+	if (!mm_slot)
+		return -ENOMEM;
+
+	/* __khugepaged_exit() must not run from under us */
+	VM_BUG_ON(khugepaged_test_exit(mm));
+	if (unlikely(test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))) {
+		free_mm_slot(mm_slot);
+		return 0;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	insert_to_mm_slots_hash(mm, mm_slot);
+	/*
+	 * Insert just behind the scanning cursor, to let the area settle
+	 * down a little.
+	 */
+	wakeup = list_empty(&khugepaged_scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+
+	atomic_inc(&mm->mm_count);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return 0;
+}
+
+void __khugepaged_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int free = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free = 1;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (free) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	} else if (mm_slot) {
+		/*
+		 * khugepaged is working on this mm under mmap_sem and
+		 * will free the mm_slot once it notices the mm_users
+		 * dropped to zero.  Wait for it to be done with the page
+		 * tables before exit_mmap() tears them down.
+		 */
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+static void release_pte_page(struct page *page)
+{
+	/* 0 stands for page_is_file_cache(page) == false */
+	dec_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	unlock_page(page);
+	putback_lru_page(page);
+}
+
+static void release_pte_pages(struct vm_area_struct *vma,
+			      unsigned long address, pte_t *pte, pte_t *_pte)
+{
+	while (--_pte >= pte) {
+		struct page *page;
+
+		page = vm_normal_page(vma, address + (_pte - pte) * PAGE_SIZE,
+				      *_pte);
+		if (!pte_none(*_pte) && page)
+			release_pte_page(page);
+	}
+}
+
+/*
+ * Isolate the small pages mapped by the pte table from the LRU and lock
+ * them, so that nobody else uses them while they are copied.  Empty
+ * ptes and the zero page (which vm_normal_page() doesn't return in an
+ * anonymous vma) are filled with zeroes.  Called with the pte lock held
+ * and the pmd cleared.
+ */
+static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
+					unsigned long address, pte_t *pte)
+{
+	struct page *page;
+	pte_t *_pte;
+	int none = 0;
+
+	for (_pte = pte; _pte < pte+HPAGE_PMD_NR;
+	     _pte++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out;
+		page = vm_normal_page(vma, address, pteval);
+		if (!page) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		VM_BUG_ON(PageCompound(page));
+		if (!PageAnon(page) || PageKsm(page))
+			goto out;
+		/* a gup pin or the swap cache holds another reference */
+		if (page_count(page) != 1)
+			goto out;
+		if (!trylock_page(page))
+			goto out;
+		/* don't collapse a page currently in use by the VM */
+		if (isolate_lru_page(page)) {
+			unlock_page(page);
+			goto out;
+		}
+		/* 0 stands for page_is_file_cache(page) == false */
+		inc_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	}
+	return 1;
+
+out:
+	release_pte_pages(vma, address - (_pte - pte) * PAGE_SIZE, pte, _pte);
+	return 0;
+}
+
+/*
+ * Copy the isolated small pages into the huge page and free them.
+ * Returns the number of ptes which didn't map an rss counted page.
+ */
+static int __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				     struct vm_area_struct *vma,
+				     unsigned long address,
+				     spinlock_t *ptl)
+{
+	pte_t *_pte;
+	int nr_none = 0;
+
+	for (_pte = pte; _pte < pte+HPAGE_PMD_NR; _pte++) {
+		pte_t pteval = *_pte;
+		struct page *src_page = NULL;
+
+		if (!pte_none(pteval))
+			src_page = vm_normal_page(vma, address, pteval);
+		if (!src_page) {
+			clear_user_highpage(page, address);
+			nr_none++;
+			if (!pte_none(pteval)) {
+				/* zero page */
+				spin_lock(ptl);
+				pte_clear(vma->vm_mm, address, _pte);
+				spin_unlock(ptl);
+			}
+		} else {
+			copy_user_highpage(page, src_page, address, vma);
+			VM_BUG_ON(page_mapcount(src_page) != 1);
+			release_pte_page(src_page);
+			/*
+			 * ptl mostly unnecessary, but preempt has to be
+			 * disabled to update the per-cpu stats inside
+			 * page_remove_rmap().
+			 */
+			spin_lock(ptl);
+			pte_clear(vma->vm_mm, address, _pte);
+			page_remove_rmap(src_page);
+			spin_unlock(ptl);
+			free_page_and_swap_cache(src_page);
+		}
+
+		address += PAGE_SIZE;
+		page++;
+	}
+	return nr_none;
+}
+
+/*
+ * Replace the pte table at @address by a huge pmd mapping a copy of the
+ * small pages.  Called with mmap_sem held for read, which is released.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address,
+			       struct page **hpage)
+{
+	struct vm_area_struct *vma;
+	unsigned long hstart, hend;
+	struct page *new_page;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	int nr_none;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	/* allocate the huge page without holding mmap_sem */
+	up_read(&mm->mmap_sem);
+	if (!*hpage) {
+		*hpage = alloc_hugepage(1);
+		if (unlikely(!*hpage)) {
+			count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+			*hpage = ERR_PTR(-ENOMEM);
+			return;
+		}
+		count_vm_event(THP_COLLAPSE_ALLOC);
+	}
+	new_page = *hpage;
+	/* keep the page for the next attempt if the cgroup is full */
+	if (unlikely(mem_cgroup_newpage_charge(new_page, mm, GFP_KERNEL)))
+		return;
+
+	/*
+	 * Prevent all access to the page tables, except for the rmap
+	 * walks which are excluded by the anon_vma lock.
+	 */
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma)
+		goto out;
+	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = vma->vm_end & HPAGE_PMD_MASK;
+	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
+		goto out;
+	if (!transparent_hugepage_enabled(vma) || !vma->anon_vma)
+		goto out;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd))
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	spin_lock(&vma->anon_vma->lock);
+
+	pte = pte_offset_map(pmd, address);
+	ptl = pte_lockptr(mm, pmd);
+
+	/*
+	 * After this gup_fast can't run anymore, and no small TLB entry
+	 * of the range survives next to the huge one we're going to map.
+	 */
+	spin_lock(&mm->page_table_lock);
+	_pmd = pmdp_get_and_clear(mm, address, pmd);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+	spin_unlock(&mm->page_table_lock);
+
+	spin_lock(ptl);
+	if (unlikely(!__collapse_huge_page_isolate(vma, address, pte))) {
+		spin_unlock(ptl);
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		BUG_ON(!pmd_none(*pmd));
+		set_pmd_at(mm, address, pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		spin_unlock(&vma->anon_vma->lock);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+	spin_unlock(ptl);
+
+	/*
+	 * All the small pages are isolated and locked, and unreachable
+	 * through the pmd, so that rmap walks can't get at them anymore:
+	 * don't stall them behind the copy.
+	 */
+	spin_unlock(&vma->anon_vma->lock);
+
+	nr_none = __collapse_huge_page_copy(pte, new_page, vma, address, ptl);
+	pte_unmap(pte);
+	__SetPageUptodate(new_page);
+	pgtable = pmd_pgtable(_pmd);
+
+	spin_lock(&mm->page_table_lock);
+	map_huge_pmd(mm, vma, address, pmd, new_page, pgtable);
+	add_mm_counter(mm, MM_ANONPAGES, nr_none);
+	spin_unlock(&mm->page_table_lock);
+
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	*hpage = NULL;
+	khugepaged_pages_collapsed++;
+out_up_write:
+	up_write(&mm->mmap_sem);
+	return;
+
+out:
+	mem_cgroup_uncharge_page(new_page);
+	goto out_up_write;
+}
+
+/*
+ * Check whether the pte table at @address is worth collapsing: all
+ * pages mapped are exclusively owned anonymous pages, not too many
+ * ptes are empty, and some page was referenced recently.  Called with
+ * mmap_sem held for read; returns 1 if mmap_sem was released.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address,
+			       struct page **hpage)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	int ret = 0, referenced = 0, none = 0;
+	unsigned long _address;
+	spinlock_t *ptl;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out_unmap;
+		page = vm_normal_page(vma, _address, pteval);
+		if (!page) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		VM_BUG_ON(PageCompound(page));
+		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
+			goto out_unmap;
+		if (page_count(page) != 1)
+			goto out_unmap;
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	if (referenced)
+		ret = 1;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	if (ret)
+		collapse_huge_page(mm, address, hpage);
+	return ret;
+}
+
+static void collect_mm_slot(struct mm_slot *mm_slot)
+{
+	struct mm_struct *mm = mm_slot->mm;
+
+	assert_spin_locked(&khugepaged_mm_lock);
+
+	if (khugepaged_test_exit(mm)) {
+		/* free mm_slot */
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	}
+}
+
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+					    struct page **hpage)
+	__releases(&khugepaged_mm_lock)
+	__acquires(&khugepaged_mm_lock)
+{
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned int progress = 0;
+
+	VM_BUG_ON(!pages);
+	assert_spin_locked(&khugepaged_mm_lock);
+
+	if (khugepaged_scan.mm_slot)
+		mm_slot = khugepaged_scan.mm_slot;
+	else {
+		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+				     struct mm_slot, mm_node);
+		khugepaged_scan.address = 0;
+		khugepaged_scan.mm_slot = mm_slot;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	mm = mm_slot->mm;
+	down_read(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		vma = NULL;
+	else
+		vma = find_vma(mm, khugepaged_scan.address);
+
+	progress++;
+	for (; vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		cond_resched();
+		if (unlikely(khugepaged_test_exit(mm))) {
+			progress++;
+			break;
+		}
+		if (!transparent_hugepage_enabled(vma) || !vma->anon_vma) {
+			progress++;
+			continue;
+		}
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (hstart >= hend) {
+			progress++;
+			continue;
+		}
+		if (khugepaged_scan.address < hstart)
+			khugepaged_scan.address = hstart;
+		while (khugepaged_scan.address < hend) {
+			int ret;
+
+			cond_resched();
+			if (unlikely(khugepaged_test_exit(mm)))
+				goto breakouterloop;
+			ret = khugepaged_scan_pmd(mm, vma,
+						  khugepaged_scan.address,
+						  hpage);
+			/* move to next address */
+			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			if (ret)
+				/* we released mmap_sem so break loop */
+				goto breakouterloop_mmap_sem;
+			if (progress >= pages)
+				goto breakouterloop;
+		}
+	}
+breakouterloop:
+	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
+breakouterloop_mmap_sem:
+
+	spin_lock(&khugepaged_mm_lock);
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	/*
+	 * Release the current mm_slot if this mm is about to die, or
+	 * if we scanned all vmas of this mm.
+	 */
+	if (khugepaged_test_exit(mm) || !vma) {
+		/*
+		 * Make sure that if mm_users is reaching zero while
+		 * khugepaged runs here, khugepaged_exit will find
+		 * mm_slot not pointing to the exiting mm.
+		 */
+		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
+			khugepaged_scan.mm_slot = list_entry(
+				mm_slot->mm_node.next,
+				struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		} else {
+			khugepaged_scan.mm_slot = NULL;
+			khugepaged_full_scans++;
+		}
+
+		collect_mm_slot(mm_slot);
+	}
+
+	return progress;
+}
+
+static int khugepaged_has_work(void)
+{
+	return !list_empty(&khugepaged_scan.mm_head);
+}
+
+static void khugepaged_do_scan(struct page **hpage)
+{
+	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+
+	while (progress < pages) {
+		cond_resched();
+
+		if (unlikely(kthread_should_stop() || freezing(current)))
+			break;
+		/* the allocator failed: wait before trying again */
+		if (IS_ERR(*hpage))
+			break;
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot)
+			pass_through_head++;
+		if (khugepaged_has_work() && pass_through_head < 2)
+			progress += khugepaged_scan_mm_slot(pages - progress,
+							    hpage);
+		else
+			progress = pages;
+		spin_unlock(&khugepaged_mm_lock);
+	}
+}
+
+static int khugepaged(void *none)
+{
+	struct page *hpage = NULL;
+
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		khugepaged_do_scan(&hpage);
+
+		if (IS_ERR(hpage)) {
+			hpage = NULL;
+			wait_event_freezable_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(
+					khugepaged_alloc_sleep_millisecs));
+		} else if (khugepaged_has_work())
+			wait_event_freezable_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(
+					khugepaged_scan_sleep_millisecs));
+		else
+			wait_event_freezable(khugepaged_wait,
+				khugepaged_has_work() ||
+				kthread_should_stop());
+	}
+
+	if (hpage)
+		put_page(hpage);
+
+	/* let __khugepaged_exit() free the slot of the mm we stopped at */
+	spin_lock(&khugepaged_mm_lock);
+	if (khugepaged_scan.mm_slot) {
+		collect_mm_slot(khugepaged_scan.mm_slot);
+		khugepaged_scan.mm_slot = NULL;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	return 0;
+}
+
+/* Start khugepaged if hugepages are enabled, stop it otherwise */
+static int start_khugepaged(void)
+{
+	int err = 0;
+
+	mutex_lock(&khugepaged_mutex);
+	if (khugepaged_enabled()) {
+		if (unlikely(!mm_slot_cache || !mm_slots_hash)) {
+			err = -ENOMEM;
+			goto out;
+		}
+		if (!khugepaged_thread) {
+			struct task_struct *thread;
+
+			thread = kthread_run(khugepaged, NULL, "khugepaged");
+			if (IS_ERR(thread)) {
+				printk(KERN_ERR "khugepaged: creating kthread "
+				       "failed\n");
+				err = PTR_ERR(thread);
+				goto out;
+			}
+			khugepaged_thread = thread;
+		}
+	} else if (khugepaged_thread) {
+		kthread_stop(khugepaged_thread);
+		khugepaged_thread = NULL;
+	}
+out:
+	mutex_unlock(&khugepaged_mutex);
+	return err;
+}
+
+#ifdef CONFIG_SYSFS
+#define HUGEPAGE_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define HUGEPAGE_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return sprintf(buf, "[always] madvise never\n");
+	else if (test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	else
+		return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int err;
+
+	if (!memcmp("always", buf, min(sizeof("always")-1, count))) {
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else if (!memcmp("madvise", buf, min(sizeof("madvise")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+	} else if (!memcmp("never", buf, min(sizeof("never")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	err = start_khugepaged();
+	if (err)
+		return err;
+
+	return count;
+}
+HUGEPAGE_ATTR(enabled);
+
+static ssize_t defrag_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", !!transparent_hugepage_defrag());
+}
+
+static ssize_t defrag_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	unsigned long value;
+	int err;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value > 1)
+		return -EINVAL;
+
+	if (value)
+		set_bit(TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+			&transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+			  &transparent_hugepage_flags);
+
+	return count;
+}
+HUGEPAGE_ATTR(defrag);
+
+static struct attribute *hugepage_attr[] = {
+	&enabled_attr.attr,
+	&defrag_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attr,
+};
+
+static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_scan_sleep_millisecs);
+}
+
+static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_scan_sleep_millisecs = msecs;
+
+	return count;
+}
+HUGEPAGE_ATTR(scan_sleep_millisecs);
+
+static ssize_t alloc_sleep_millisecs_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_alloc_sleep_millisecs);
+}
+
+static ssize_t alloc_sleep_millisecs_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_alloc_sleep_millisecs = msecs;
+
+	return count;
+}
+HUGEPAGE_ATTR(alloc_sleep_millisecs);
+
+static ssize_t pages_to_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_to_scan);
+}
+
+static ssize_t pages_to_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long pages;
+
+	err = strict_strtoul(buf, 10, &pages);
+	if (err || !pages || pages > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_pages_to_scan = pages;
+
+	return count;
+}
+HUGEPAGE_ATTR(pages_to_scan);
+
+static ssize_t max_ptes_none_show(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_ptes_none);
+}
+
+static ssize_t max_ptes_none_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long max_ptes_none;
+
+	err = strict_strtoul(buf, 10, &max_ptes_none);
+	if (err || max_ptes_none > HPAGE_PMD_NR-1)
+		return -EINVAL;
+
+	khugepaged_max_ptes_none = max_ptes_none;
+
+	return count;
+}
+HUGEPAGE_ATTR(max_ptes_none);
+
+static ssize_t pages_collapsed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+}
+HUGEPAGE_ATTR_RO(pages_collapsed);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_full_scans);
+}
+HUGEPAGE_ATTR_RO(full_scans);
+
+static struct attribute *khugepaged_attr[] = {
+	&scan_sleep_millisecs_attr.attr,
+	&alloc_sleep_millisecs_attr.attr,
+	&pages_to_scan_attr.attr,
+	&max_ptes_none_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attr,
+	.name = "khugepaged",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+	int err;
+#ifdef CONFIG_SYSFS
+	static struct kobject *hugepage_kobj;
+
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage",
+					       mm_kobj);
+	if (unlikely(!hugepage_kobj)) {
+		printk(KERN_ERR "hugepage: failed kobject create\n");
+		return -ENOMEM;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &hugepage_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register hugepage group\n");
+		goto out;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &khugepaged_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register khugepaged group\n");
+		goto out;
+	}
+#endif
+
+	err = khugepaged_slab_init();
+	if (err)
+		goto out;
+
+	err = mm_slots_hash_init();
+	if (err) {
+		kmem_cache_destroy(mm_slot_cache);
+		mm_slot_cache = NULL;
+		goto out;
+	}
+
+	start_khugepaged();
+	return 0;
+out:
+	/* the fault path keeps working, khugepaged stays off */
+	return err;
+}
+module_init(hugepage_init)
+
+static int __init setup_transparent_hugepage(char *str)
+{
+	int ret = 0;
+
+	if (!str)
+		goto out;
+	if (!strcmp(str, "always")) {
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			&transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+		ret = 1;
+	} else if (!strcmp(str, "madvise")) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+		ret = 1;
+	} else if (!strcmp(str, "never")) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+		ret = 1;
+	}
+out:
+	if (!ret)
+		printk(KERN_WARNING
+		       "transparent_hugepage= cannot parse, ignored\n");
+	return ret;
+}
+__setup("transparent_hugepage=", setup_transparent_hugepage);
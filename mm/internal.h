@@ -45,6 +45,12 @@ extern unsigned long highest_memmap_pfn;
 extern int isolate_lru_page(struct page *page);
 extern void putback_lru_page(struct page *page);
 
+/*
+ * in mm/rmap.c:
+ */
+extern unsigned long vma_address(struct page *page,
+				 struct vm_area_struct *vma);
+
 /*
  * in mm/page_alloc.c
  */
@@ -75,6 +75,17 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * Both trees are sorted by a checksum of the page contents first, and only
+ * pages with equal checksums are ordered by comparing their contents: so
+ * walking down a tree rarely has to look at any other page at all.
+ *
+ * Scanning is shared by several ksmd workers.  Each worker claims the next
+ * mm_slot from the list and walks its page tables and checksums its pages
+ * in batches without any global lock; only comparing against and updating
+ * the trees, and merging, is serialized by ksm_thread_mutex.  A full scan
+ * ends, and the unstable tree is flushed, once every mm_slot on the list
+ * has been claimed and all workers have finished with their slots.
  */
 
 /**
@@ -83,28 +94,54 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scanning: claimed by a ksmd worker (protected by ksm_mmlist_lock)
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	int scanning;
 };
 
 /**
  * struct ksm_scan - cursor for scanning
- * @mm_slot: the current mm_slot we are scanning
+ * @mm_slot: the mm_slot this worker is scanning, or NULL
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
- *
- * There is only the one ksm_scan instance of this cursor structure.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+};
+
+/* Pages a worker collects and checksums before taking ksm_thread_mutex */
+#define KSM_SCAN_BATCH	32
+
+/**
+ * struct ksm_worker - a ksmd scanning thread
+ * @task: the kthread
+ * @scan: its cursor into the mm_slot it has claimed
+ * @stale: rmap_items unlinked from that mm_slot, to be removed and freed
+ * @slot_done: the end of the mm_slot has been reached
+ * @free_slot: the mm_slot was found to have no more mergeable areas
+ * @nr_items: number of entries in @items
+ * @items: the batch of pages collected, with their checksums
+ */
+struct ksm_worker {
+	struct task_struct *task;
+	struct ksm_scan scan;
+	struct rmap_item *stale;
+	bool slot_done;
+	bool free_slot;
+	int nr_items;
+	struct ksm_scan_item {
+		struct rmap_item *rmap_item;
+		struct page *page;
+		u32 checksum;
+		bool has_checksum;
+	} items[KSM_SCAN_BATCH];
 };
 
 /**
@@ -112,11 +149,15 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @checksum: checksum of the ksm page, the first key of the stable tree
+ * @nid: index of the stable tree this node is in
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	u32 checksum;
+	int nid;
 };
 
 /**
@@ -125,7 +166,9 @@ struct stable_node {
  * @anon_vma: pointer to anon_vma for this mm,address, when in stable tree
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
- * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldchecksum: previous checksum of the page at that virtual address,
+ *	and its key in the unstable tree
+ * @nid: index of the unstable tree this rmap_item is in
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -136,6 +179,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	int nid;			/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -149,9 +193,16 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/*
+ * The stable and unstable tree heads: one pair per NUMA node when pages
+ * are only merged with pages on the same node, else just the first pair.
+ */
+static struct rb_root root_stable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
+static struct rb_root root_unstable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
 
 #define MM_SLOTS_HASH_HEADS 1024
 static struct hlist_head *mm_slots_hash;
@@ -159,9 +210,30 @@ static struct hlist_head *mm_slots_hash;
 static struct mm_slot ksm_mm_head = {
 	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
 };
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+
+/* The next mm_slot to be claimed by a worker, protected by ksm_mmlist_lock */
+static struct mm_slot *ksm_cursor = &ksm_mm_head;
+
+/* Number of mm_slots currently claimed by workers */
+static int ksm_nr_scanning;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
+
+/* Whether a full scan is in progress, and when it started */
+static bool ksm_scan_started;
+static unsigned long ksm_scan_start_jiffies;
+
+/* Duration of the last full scan */
+static unsigned int ksm_last_full_scan_msecs;
+
+/* Total number of pages scanned */
+static atomic_long_t ksm_pages_scanned = ATOMIC_LONG_INIT(0);
+
+#define KSM_MAX_WORKERS	64
+static struct ksm_worker *ksm_workers[KSM_MAX_WORKERS];
+static unsigned int ksm_nr_workers;
+static DEFINE_MUTEX(ksm_workers_mutex);
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
@@ -177,9 +249,9 @@ static unsigned long ksm_pages_sharing;
 static unsigned long ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items = ATOMIC_LONG_INIT(0);
 
-/* Number of pages ksmd should scan in one batch */
+/* Number of pages each ksmd worker should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
@@ -190,10 +262,24 @@ static unsigned int ksm_thread_sleep_millisecs = 20;
 #define KSM_RUN_UNMERGE	2
 static unsigned int ksm_run = KSM_RUN_STOP;
 
+#ifdef CONFIG_NUMA
+/* Zero to only merge pages with pages on the same NUMA node */
+static unsigned int ksm_merge_across_nodes = 1;
+#else
+#define ksm_merge_across_nodes	1U
+#endif
+
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
+/*
+ * Workers hold ksm_run_sem for read while scanning a batch; changing the
+ * run state, or anything else that must see all workers idle, takes it
+ * for write.
+ */
+static DECLARE_RWSEM(ksm_run_sem);
+
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
 		(__flags), NULL)
@@ -236,13 +322,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -314,18 +400,24 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 	return rmap_item->address & STABLE_FLAG;
 }
 
+/* Which pair of trees a page belongs in */
+static inline int ksm_page_nid(struct page *page)
+{
+	return ksm_merge_across_nodes ? 0 : page_to_nid(page);
+}
+
 static void hold_anon_vma(struct rmap_item *rmap_item,
 			  struct anon_vma *anon_vma)
 {
 	rmap_item->anon_vma = anon_vma;
-	atomic_inc(&anon_vma->ksm_refcount);
+	atomic_inc(&anon_vma->external_refcount);
 }
 
 static void drop_anon_vma(struct rmap_item *rmap_item)
 {
 	struct anon_vma *anon_vma = rmap_item->anon_vma;
 
-	if (atomic_dec_and_lock(&anon_vma->ksm_refcount, &anon_vma->lock)) {
+	if (atomic_dec_and_lock(&anon_vma->external_refcount, &anon_vma->lock)) {
 		int empty = list_empty(&anon_vma->head);
 		spin_unlock(&anon_vma->lock);
 		if (empty)
@@ -475,7 +567,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, &root_stable_tree[stable_node->nid]);
 	free_stable_node(stable_node);
 }
 
@@ -570,10 +662,11 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 &root_unstable_tree[rmap_item->nid]);
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -593,6 +686,54 @@ static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 	}
 }
 
+/*
+ * Claim the mm_slot at the cursor for a worker to scan, or return NULL
+ * if every mm_slot has been claimed in this full scan.
+ */
+static struct mm_slot *ksm_claim_slot(void)
+{
+	struct mm_slot *slot;
+
+	spin_lock(&ksm_mmlist_lock);
+	slot = ksm_cursor;
+	while (slot != &ksm_mm_head && slot->scanning)
+		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
+	if (slot != &ksm_mm_head) {
+		slot->scanning = 1;
+		ksm_nr_scanning++;
+		ksm_cursor = list_entry(slot->mm_list.next,
+					struct mm_slot, mm_list);
+	} else {
+		ksm_cursor = slot;
+		slot = NULL;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+	return slot;
+}
+
+/*
+ * Give up a worker's claim on its mm_slot.  If @requeue, the mm_slot was
+ * not finished: put it back at the cursor, so that all its rmap_items are
+ * still visited in this full scan.
+ */
+static void ksm_release_slot(struct ksm_worker *worker, bool requeue)
+{
+	struct mm_slot *slot = worker->scan.mm_slot;
+
+	spin_lock(&ksm_mmlist_lock);
+	slot->scanning = 0;
+	ksm_nr_scanning--;
+	if (requeue) {
+		list_move_tail(&slot->mm_list, &ksm_cursor->mm_list);
+		ksm_cursor = slot;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+
+	worker->scan.mm_slot = NULL;
+	worker->slot_done = false;
+	worker->free_slot = false;
+}
+
 /*
  * Though it's very tempting to unmerge in_stable_tree(rmap_item)s rather
  * than check every pte of a given vma, the locking doesn't quite work for
@@ -632,15 +773,22 @@ static int unmerge_and_remove_all_rmap_items(void)
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
+	unsigned int id;
 	int err = 0;
 
+	/* The workers are all between batches: forget their mm_slots */
+	for (id = 0; id < ksm_nr_workers; id++) {
+		if (ksm_workers[id]->scan.mm_slot)
+			ksm_release_slot(ksm_workers[id], false);
+	}
+
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	ksm_cursor = list_entry(ksm_mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = ksm_cursor;
+			mm_slot != &ksm_mm_head; mm_slot = ksm_cursor) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -657,7 +805,7 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		ksm_cursor = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hlist_del(&mm_slot->link);
@@ -674,13 +822,14 @@ static int unmerge_and_remove_all_rmap_items(void)
 		}
 	}
 
-	ksm_scan.seqnr = 0;
+	ksm_seqnr = 0;
+	ksm_scan_started = false;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	ksm_cursor = &ksm_mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
@@ -963,9 +1112,9 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, u32 checksum)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node = root_stable_tree[ksm_page_nid(page)].rb_node;
 	struct stable_node *stable_node;
 
 	stable_node = page_stable_node(page);
@@ -980,6 +1129,11 @@ static struct page *stable_tree_search(struct page *page)
 
 		cond_resched();
 		stable_node = rb_entry(node, struct stable_node, node);
+		if (checksum != stable_node->checksum) {
+			node = checksum < stable_node->checksum ?
+				node->rb_left : node->rb_right;
+			continue;
+		}
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
 			return NULL;
@@ -1008,7 +1162,9 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = ksm_page_nid(kpage);
+	u32 checksum = calc_checksum(kpage);
+	struct rb_node **new = &root_stable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
@@ -1018,6 +1174,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		if (checksum != stable_node->checksum) {
+			parent = *new;
+			new = checksum < stable_node->checksum ?
+				&parent->rb_left : &parent->rb_right;
+			continue;
+		}
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
 			return NULL;
@@ -1045,11 +1207,13 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, &root_stable_tree[nid]);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->checksum = checksum;
+	stable_node->nid = nid;
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1067,7 +1231,9 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  * to the currently scanned page, NULL otherwise.
  *
  * This function does both searching and inserting, because they share
- * the same walking algorithm in an rbtree.
+ * the same walking algorithm in an rbtree.  The tree is keyed by the
+ * oldchecksum of each rmap_item, which is the checksum of the page when
+ * it was inserted: only pages with the same checksum need be compared.
  */
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
@@ -1075,7 +1241,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	int nid = ksm_page_nid(page);
+	u32 checksum = rmap_item->oldchecksum;
+	struct rb_node **new = &root_unstable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1085,6 +1253,12 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		if (checksum != tree_rmap_item->oldchecksum) {
+			parent = *new;
+			new = checksum < tree_rmap_item->oldchecksum ?
+				&parent->rb_left : &parent->rb_right;
+			continue;
+		}
 		tree_page = get_mergeable_page(tree_rmap_item);
 		if (IS_ERR_OR_NULL(tree_page))
 			return NULL;
@@ -1113,9 +1287,10 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
+	rmap_item->nid = nid;
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &root_unstable_tree[nid]);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1147,20 +1322,21 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @checksum: checksum of the page, calculated by the scanning worker
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       u32 checksum)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, checksum);
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1182,7 +1358,6 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -1224,7 +1399,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	}
 }
 
-static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+static struct rmap_item *get_next_rmap_item(struct ksm_worker *worker,
+					    struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
 					    unsigned long addr)
 {
@@ -1236,9 +1412,10 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 			return rmap_item;
 		if (rmap_item->address > addr)
 			break;
+		/* Removed from the trees later, under ksm_thread_mutex */
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		rmap_item->rmap_list = worker->stale;
+		worker->stale = rmap_item;
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1252,27 +1429,81 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+static void unlink_trailing_rmap_items(struct ksm_worker *worker,
+				       struct rmap_item **rmap_list)
+{
+	while (*rmap_list) {
+		struct rmap_item *rmap_item = *rmap_list;
+		*rmap_list = rmap_item->rmap_list;
+		rmap_item->rmap_list = worker->stale;
+		worker->stale = rmap_item;
+	}
+}
+
+/*
+ * Called when there was no mm_slot left to claim: once the other workers
+ * have finished with theirs too, count the full scan and start another,
+ * with the unstable trees flushed.
+ */
+static void ksm_end_full_scan(void)
+{
+	bool flush = false;
+	int nid;
+
+	mutex_lock(&ksm_thread_mutex);
+	spin_lock(&ksm_mmlist_lock);
+	if (ksm_cursor == &ksm_mm_head && !ksm_nr_scanning) {
+		if (ksm_scan_started) {
+			ksm_seqnr++;
+			ksm_last_full_scan_msecs = jiffies_to_msecs(jiffies -
+						ksm_scan_start_jiffies);
+		}
+		ksm_cursor = list_entry(ksm_mm_head.mm_list.next,
+					struct mm_slot, mm_list);
+		ksm_scan_started = ksm_cursor != &ksm_mm_head;
+		ksm_scan_start_jiffies = jiffies;
+		flush = true;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+
+	if (flush) {
+		for (nid = 0; nid < nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+}
+
+/*
+ * scan_get_next_rmap_items - collect a batch of pages for a worker to merge.
+ *
+ * Walks the page tables of the worker's mm_slot, claiming a new one first
+ * if need be, and fills worker->items with up to @nr pages and their
+ * rmap_items, then checksums those pages.  No ksm lock is held: the
+ * mm_slot's rmap_list belongs to the worker which claimed it, and any
+ * rmap_items unlinked from it are left on worker->stale.
+ *
+ * Returns -ENOENT if there was no mm_slot to claim, -ENOMEM if an
+ * rmap_item could not be allocated, 0 otherwise.
+ */
+static int scan_get_next_rmap_items(struct ksm_worker *worker,
+				    unsigned int nr)
 {
+	struct ksm_scan *scan = &worker->scan;
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
-
-	if (list_empty(&ksm_mm_head.mm_list))
-		return NULL;
-
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		root_unstable_tree = RB_ROOT;
-
-		spin_lock(&ksm_mmlist_lock);
-		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
-		spin_unlock(&ksm_mmlist_lock);
-next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+	struct page *page;
+	int i, err = 0;
+
+	slot = scan->mm_slot;
+	if (!slot) {
+		slot = ksm_claim_slot();
+		if (!slot)
+			return -ENOENT;
+		scan->mm_slot = slot;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1280,55 +1511,62 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
-			if (!IS_ERR_OR_NULL(*page) && PageAnon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
-				flush_dcache_page(*page);
-				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
-				if (rmap_item) {
-					ksm_scan.rmap_list =
-							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
-				} else
-					put_page(*page);
-				up_read(&mm->mmap_sem);
-				return rmap_item;
+			page = follow_page(vma, scan->address, FOLL_GET);
+			if (!IS_ERR_OR_NULL(page) && PageAnon(page)) {
+				flush_anon_page(vma, page, scan->address);
+				flush_dcache_page(page);
+				rmap_item = get_next_rmap_item(worker, slot,
+					scan->rmap_list, scan->address);
+				if (!rmap_item) {
+					put_page(page);
+					err = -ENOMEM;
+					goto out;
+				}
+				scan->rmap_list = &rmap_item->rmap_list;
+				scan->address += PAGE_SIZE;
+				worker->items[worker->nr_items].rmap_item =
+								rmap_item;
+				worker->items[worker->nr_items].page = page;
+				if (++worker->nr_items == nr)
+					goto out;
+				continue;
 			}
-			if (!IS_ERR_OR_NULL(*page))
-				put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			if (!IS_ERR_OR_NULL(page))
+				put_page(page);
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		/* No point in merging any of its pages now */
+		for (i = 0; i < worker->nr_items; i++)
+			put_page(worker->items[i].page);
+		worker->nr_items = 0;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	unlink_trailing_rmap_items(worker, scan->rmap_list);
+	worker->slot_done = true;
 
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1337,46 +1575,103 @@ next_mm:
 		 * (but beware: we can reach here even before __ksm_exit),
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_sem then protects against race with MADV_MERGEABLE).
+		 * The mm_slot itself is freed once its stale rmap_items are.
 		 */
+		spin_lock(&ksm_mmlist_lock);
 		hlist_del(&slot->link);
 		list_del(&slot->mm_list);
 		spin_unlock(&ksm_mmlist_lock);
 
-		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
-		up_read(&mm->mmap_sem);
-		mmdrop(mm);
-	} else {
-		spin_unlock(&ksm_mmlist_lock);
-		up_read(&mm->mmap_sem);
+		worker->free_slot = true;
 	}
+out:
+	up_read(&mm->mmap_sem);
 
-	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
-		goto next_mm;
+	/* A ksm page's contents are only needed if it left the stable tree */
+	for (i = 0; i < worker->nr_items; i++) {
+		struct ksm_scan_item *item = &worker->items[i];
 
-	ksm_scan.seqnr++;
-	return NULL;
+		item->has_checksum = !PageKsm(item->page);
+		if (item->has_checksum)
+			item->checksum = calc_checksum(item->page);
+	}
+	return err;
+}
+
+/*
+ * merge_rmap_items - merge a worker's batch of pages, under ksm_thread_mutex.
+ */
+static void merge_rmap_items(struct ksm_worker *worker)
+{
+	struct mm_slot *slot = worker->scan.mm_slot;
+	int i;
+
+	mutex_lock(&ksm_thread_mutex);
+	for (i = 0; i < worker->nr_items; i++) {
+		struct ksm_scan_item *item = &worker->items[i];
+
+		if (!PageKsm(item->page) || !in_stable_tree(item->rmap_item)) {
+			if (!item->has_checksum)
+				item->checksum = calc_checksum(item->page);
+			cmp_and_merge_page(item->page, item->rmap_item,
+					   item->checksum);
+		}
+		put_page(item->page);
+	}
+	atomic_long_add(worker->nr_items, &ksm_pages_scanned);
+	worker->nr_items = 0;
+
+	while (worker->stale) {
+		struct rmap_item *rmap_item = worker->stale;
+		worker->stale = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	if (worker->slot_done) {
+		bool free_slot = worker->free_slot;
+
+		ksm_release_slot(worker, false);
+		if (free_slot) {
+			struct mm_struct *mm = slot->mm;
+
+			free_mm_slot(slot);
+			mmdrop(mm);
+		}
+	}
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @worker - the ksmd worker which is scanning.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_worker *worker, unsigned int scan_npages)
 {
-	struct rmap_item *rmap_item;
-	struct page *uninitialized_var(page);
+	while (scan_npages) {
+		unsigned int nr = min_t(unsigned int, scan_npages,
+					KSM_SCAN_BATCH);
+		int err;
 
-	while (scan_npages--) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
+		down_read(&ksm_run_sem);
+		if (!(ksm_run & KSM_RUN_MERGE)) {
+			up_read(&ksm_run_sem);
+			return;
+		}
+		err = scan_get_next_rmap_items(worker, nr);
+		if (err == -ENOENT) {
+			ksm_end_full_scan();
+			up_read(&ksm_run_sem);
+			return;
+		}
+		scan_npages -= worker->nr_items;
+		merge_rmap_items(worker);
+		up_read(&ksm_run_sem);
+		if (err)
 			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
-		put_page(page);
 	}
 }
 
@@ -1385,15 +1680,15 @@ static int ksmd_should_run(void)
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_worker *worker = data;
+
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
 		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+			ksm_do_scan(worker, ksm_thread_pages_to_scan);
 
 		if (ksmd_should_run()) {
 			schedule_timeout_interruptible(
@@ -1406,6 +1701,40 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+static int ksm_start_worker(unsigned int id)
+{
+	struct ksm_worker *worker;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return -ENOMEM;
+
+	if (id)
+		worker->task = kthread_run(ksm_scan_thread, worker,
+					   "ksmd/%u", id);
+	else
+		worker->task = kthread_run(ksm_scan_thread, worker, "ksmd");
+	if (IS_ERR(worker->task)) {
+		int err = PTR_ERR(worker->task);
+
+		kfree(worker);
+		return err;
+	}
+	ksm_workers[id] = worker;
+	return 0;
+}
+
+static void ksm_stop_worker(unsigned int id)
+{
+	struct ksm_worker *worker = ksm_workers[id];
+
+	kthread_stop(worker->task);
+	if (worker->scan.mm_slot)
+		ksm_release_slot(worker, true);
+	ksm_workers[id] = NULL;
+	kfree(worker);
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1468,7 +1797,7 @@ int __ksm_enter(struct mm_struct *mm)
 	 * down a little; when fork is followed by immediate exec, we don't
 	 * want ksmd to waste time setting up and tearing down an rmap_list.
 	 */
-	list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	list_add_tail(&mm_slot->mm_list, &ksm_cursor->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1488,22 +1817,24 @@ void __ksm_exit(struct mm_struct *mm)
 	/*
 	 * This process is exiting: if it's straightforward (as is the
 	 * case when ksmd was never running), free mm_slot immediately.
-	 * But if it's at the cursor or has rmap_items linked to it, use
-	 * mmap_sem to synchronize with any break_cows before pagetables
-	 * are freed, and leave the mm_slot on the list for ksmd to free.
+	 * But if it's being scanned, at the cursor, or has rmap_items linked
+	 * to it, use mmap_sem to synchronize with any break_cows before
+	 * pagetables are freed, and leave the mm_slot on the list for ksmd
+	 * to free: moving it to the cursor, so that it is claimed next.
 	 * Beware: ksm may already have noticed it exiting and freed the slot.
 	 */
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && ksm_cursor != mm_slot && !mm_slot->scanning) {
 		if (!mm_slot->rmap_list) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
 			easy_to_free = 1;
 		} else {
-			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+			list_move_tail(&mm_slot->mm_list,
+				       &ksm_cursor->mm_list);
+			ksm_cursor = mm_slot;
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1721,14 +2052,18 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	int nid;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		for (node = rb_first(&root_stable_tree[nid]); node;
+		     node = rb_next(node)) {
+			struct stable_node *stable_node;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1744,7 +2079,10 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/*
 		 * Keep it very simple for now: just lock out ksmd and
 		 * MADV_UNMERGEABLE while any memory is going offline.
+		 * Taking ksm_run_sem waits for the workers to put the
+		 * pages of their current batches.
 		 */
+		down_write(&ksm_run_sem);
 		mutex_lock(&ksm_thread_mutex);
 		break;
 
@@ -1761,6 +2099,7 @@ static int ksm_memory_callback(struct notifier_block *self,
 
 	case MEM_CANCEL_OFFLINE:
 		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_run_sem);
 		break;
 	}
 	return NOTIFY_OK;
@@ -1849,6 +2188,8 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
+	mutex_lock(&ksm_workers_mutex);
+	down_write(&ksm_run_sem);
 	mutex_lock(&ksm_thread_mutex);
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -1863,6 +2204,8 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 		}
 	}
 	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_run_sem);
+	mutex_unlock(&ksm_workers_mutex);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -1897,7 +2240,7 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items) - ksm_pages_shared
 				- ksm_pages_sharing - ksm_pages_unshared;
 	/*
 	 * It was not worth any locking to calculate that statistic,
@@ -1912,10 +2255,98 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", atomic_long_read(&ksm_pages_scanned));
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t last_full_scan_msecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_last_full_scan_msecs);
+}
+KSM_ATTR_RO(last_full_scan_msecs);
+
+static ssize_t nr_workers_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_workers);
+}
+
+static ssize_t nr_workers_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long nr;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err || nr < 1 || nr > KSM_MAX_WORKERS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_workers_mutex);
+	while (ksm_nr_workers < nr) {
+		err = ksm_start_worker(ksm_nr_workers);
+		if (err) {
+			count = err;
+			break;
+		}
+		ksm_nr_workers++;
+	}
+	while (ksm_nr_workers > nr)
+		ksm_stop_worker(--ksm_nr_workers);
+	mutex_unlock(&ksm_workers_mutex);
+
+	return count;
+}
+KSM_ATTR(nr_workers);
+
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	unsigned long knob;
+	int err;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	/*
+	 * The stable trees must be empty to switch between one of them
+	 * and one per node: unmerge everything first with run set to 2.
+	 * Any rmap_items left in the unstable trees remember their tree.
+	 */
+	down_write(&ksm_run_sem);
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		if (ksm_pages_shared)
+			count = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_run_sem);
+
+	return count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1925,6 +2356,12 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&last_full_scan_msecs_attr.attr,
+	&nr_workers_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
 	NULL,
 };
 
@@ -1936,7 +2373,6 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
 
 	err = ksm_slab_init();
@@ -1947,18 +2383,18 @@ static int __init ksm_init(void)
 	if (err)
 		goto out_free1;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	err = ksm_start_worker(0);
+	if (err) {
 		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
 		goto out_free2;
 	}
+	ksm_nr_workers = 1;
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		ksm_stop_worker(--ksm_nr_workers);
 		goto out_free2;
 	}
 #else
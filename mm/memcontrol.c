@@ -47,6 +47,7 @@
 #include <linux/mm_inline.h>
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
+#include <linux/huge_mm.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -517,9 +518,9 @@ static void mem_cgroup_swap_statistics(struct mem_cgroup *mem,
 
 static void mem_cgroup_charge_statistics(struct mem_cgroup *mem,
 					 struct page_cgroup *pc,
-					 bool charge)
+					 bool charge, int nr_pages)
 {
-	int val = (charge) ? 1 : -1;
+	int val = (charge) ? nr_pages : -nr_pages;
 
 	preempt_disable();
 
@@ -1508,15 +1509,17 @@ static int __cpuinit memcg_stock_cpu_callback(struct notifier_block *nb,
 
 /*
  * Unlike exported interface, "oom" parameter is added. if oom==true,
- * oom-killer can be invoked.
+ * oom-killer can be invoked.  @page_size is PAGE_SIZE, or the size of a
+ * transparent huge page, which is charged in one go.
  */
 static int __mem_cgroup_try_charge(struct mm_struct *mm,
-			gfp_t gfp_mask, struct mem_cgroup **memcg, bool oom)
+			gfp_t gfp_mask, struct mem_cgroup **memcg, bool oom,
+			int page_size)
 {
 	struct mem_cgroup *mem, *mem_over_limit;
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct res_counter *fail_res;
-	int csize = CHARGE_SIZE;
+	int csize = max_t(int, CHARGE_SIZE, page_size);
 
 	/*
 	 * Unlike gloval-vm's OOM-kill, we're not in memory shortage
@@ -1551,7 +1554,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 		int ret = 0;
 		unsigned long flags = 0;
 
-		if (consume_stock(mem))
+		if (page_size == PAGE_SIZE && consume_stock(mem))
 			goto done;
 
 		ret = res_counter_charge(&mem->res, csize, &fail_res);
@@ -1572,10 +1575,16 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 									res);
 
 		/* reduce request size and retry */
-		if (csize > PAGE_SIZE) {
-			csize = PAGE_SIZE;
+		if (csize > page_size) {
+			csize = page_size;
 			continue;
 		}
+		/*
+		 * Don't reclaim or oom for a huge page: the caller falls
+		 * back to small pages, which can be charged one by one.
+		 */
+		if (page_size > PAGE_SIZE)
+			goto nomem;
 		if (!(gfp_mask & __GFP_WAIT))
 			goto nomem;
 
@@ -1649,8 +1658,11 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 			goto bypass;
 		}
 	}
-	if (csize > PAGE_SIZE)
-		refill_stock(mem, csize - PAGE_SIZE);
+	if (csize > page_size)
+		refill_stock(mem, csize - page_size);
+	/* each page of the charge holds a reference, as uncharge drops one */
+	if (page_size > PAGE_SIZE)
+		__css_get(&mem->css, page_size / PAGE_SIZE - 1);
 done:
 	return 0;
 nomem:
@@ -1739,8 +1751,11 @@ struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
 
 static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 				     struct page_cgroup *pc,
-				     enum charge_type ctype)
+				     enum charge_type ctype,
+				     int page_size)
 {
+	int nr_pages = page_size >> PAGE_SHIFT;
+
 	/* try_charge() can return NULL to *memcg, taking care of it. */
 	if (!mem)
 		return;
@@ -1748,7 +1763,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 	lock_page_cgroup(pc);
 	if (unlikely(PageCgroupUsed(pc))) {
 		unlock_page_cgroup(pc);
-		mem_cgroup_cancel_charge(mem);
+		__mem_cgroup_cancel_charge(mem, nr_pages);
 		return;
 	}
 
@@ -1775,7 +1790,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 		break;
 	}
 
-	mem_cgroup_charge_statistics(mem, pc, true);
+	mem_cgroup_charge_statistics(mem, pc, true, nr_pages);
 
 	unlock_page_cgroup(pc);
 	/*
@@ -1819,14 +1834,14 @@ static void __mem_cgroup_move_account(struct page_cgroup *pc,
 		__this_cpu_inc(to->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
 		preempt_enable();
 	}
-	mem_cgroup_charge_statistics(from, pc, false);
+	mem_cgroup_charge_statistics(from, pc, false, 1);
 	if (uncharge)
 		/* This is not "cancel", but cancel_charge does all we need. */
 		mem_cgroup_cancel_charge(from);
 
 	/* caller should have done css_get */
 	pc->mem_cgroup = to;
-	mem_cgroup_charge_statistics(to, pc, true);
+	mem_cgroup_charge_statistics(to, pc, true, 1);
 	/*
 	 * We charges against "to" which may not have any tasks. Then, "to"
 	 * can be under rmdir(). But in current implementation, caller of
@@ -1883,7 +1898,8 @@ static int mem_cgroup_move_parent(struct page_cgroup *pc,
 		goto put;
 
 	parent = mem_cgroup_from_cont(pcg);
-	ret = __mem_cgroup_try_charge(NULL, gfp_mask, &parent, false);
+	ret = __mem_cgroup_try_charge(NULL, gfp_mask, &parent, false,
+				      PAGE_SIZE);
 	if (ret || !parent)
 		goto put_back;
 
@@ -1910,6 +1926,7 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 {
 	struct mem_cgroup *mem;
 	struct page_cgroup *pc;
+	int page_size = PAGE_SIZE << compound_order(page);
 	int ret;
 
 	pc = lookup_page_cgroup(page);
@@ -1919,11 +1936,11 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 	prefetchw(pc);
 
 	mem = memcg;
-	ret = __mem_cgroup_try_charge(mm, gfp_mask, &mem, true);
+	ret = __mem_cgroup_try_charge(mm, gfp_mask, &mem, true, page_size);
 	if (ret || !mem)
 		return ret;
 
-	__mem_cgroup_commit_charge(mem, pc, ctype);
+	__mem_cgroup_commit_charge(mem, pc, ctype, page_size);
 	return 0;
 }
 
@@ -1932,8 +1949,8 @@ int mem_cgroup_newpage_charge(struct page *page,
 {
 	if (mem_cgroup_disabled())
 		return 0;
-	if (PageCompound(page))
-		return 0;
+	/* a transparent huge page is charged as a whole, by its head */
+	VM_BUG_ON(PageTail(page));
 	/*
 	 * If already mapped, we don't have to account.
 	 * If page cache, page->mapping has address_space.
@@ -1949,6 +1966,62 @@ int mem_cgroup_newpage_charge(struct page *page,
 				MEM_CGROUP_CHARGE_TYPE_MAPPED, NULL);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A transparent huge page is split: its head page was charged for the
+ * whole huge page, hand one page worth of that charge to @tail.  Called
+ * before @tail is put on the LRU.
+ */
+void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail)
+{
+	struct page_cgroup *head_pc, *tail_pc;
+
+	if (mem_cgroup_disabled())
+		return;
+	head_pc = lookup_page_cgroup(head);
+	tail_pc = lookup_page_cgroup(tail);
+	if (unlikely(!head_pc || !tail_pc))
+		return;
+
+	lock_page_cgroup(head_pc);
+	if (PageCgroupUsed(head_pc)) {
+		tail_pc->mem_cgroup = head_pc->mem_cgroup;
+		/* see __mem_cgroup_commit_charge() */
+		smp_wmb();
+		ClearPageCgroupCache(tail_pc);
+		SetPageCgroupUsed(tail_pc);
+	}
+	unlock_page_cgroup(head_pc);
+}
+
+/*
+ * Whether @page is charged to @mem, or to a cgroup below it in the
+ * hierarchy.  Unlocked, for picking huge pages to split for reclaim.
+ */
+bool mem_cgroup_page_charged_to(struct page *page, struct mem_cgroup *mem)
+{
+	struct page_cgroup *pc;
+	struct mem_cgroup *curr;
+	bool ret = false;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc))
+		return false;
+
+	rcu_read_lock();
+	if (PageCgroupUsed(pc)) {
+		smp_rmb();
+		curr = pc->mem_cgroup;
+		if (curr == mem)
+			ret = true;
+		else if (mem->use_hierarchy)
+			ret = css_is_ancestor(&curr->css, &mem->css);
+	}
+	rcu_read_unlock();
+	return ret;
+}
+#endif
+
 static void
 __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 					enum charge_type ctype);
@@ -2039,14 +2112,14 @@ int mem_cgroup_try_charge_swapin(struct mm_struct *mm,
 	if (!mem)
 		goto charge_cur_mm;
 	*ptr = mem;
-	ret = __mem_cgroup_try_charge(NULL, mask, ptr, true);
+	ret = __mem_cgroup_try_charge(NULL, mask, ptr, true, PAGE_SIZE);
 	/* drop extra refcnt from tryget */
 	css_put(&mem->css);
 	return ret;
 charge_cur_mm:
 	if (unlikely(!mm))
 		mm = &init_mm;
-	return __mem_cgroup_try_charge(mm, mask, ptr, true);
+	return __mem_cgroup_try_charge(mm, mask, ptr, true, PAGE_SIZE);
 }
 
 static void
@@ -2062,7 +2135,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 	cgroup_exclude_rmdir(&ptr->css);
 	pc = lookup_page_cgroup(page);
 	mem_cgroup_lru_del_before_commit_swapcache(page);
-	__mem_cgroup_commit_charge(ptr, pc, ctype);
+	__mem_cgroup_commit_charge(ptr, pc, ctype, PAGE_SIZE);
 	mem_cgroup_lru_add_after_commit_swapcache(page);
 	/*
 	 * Now swap is on-memory. This means this page may be
@@ -2115,7 +2188,8 @@ void mem_cgroup_cancel_charge_swapin(struct mem_cgroup *mem)
 }
 
 static void
-__do_uncharge(struct mem_cgroup *mem, const enum charge_type ctype)
+__do_uncharge(struct mem_cgroup *mem, const enum charge_type ctype,
+	      int page_size)
 {
 	struct memcg_batch_info *batch = NULL;
 	bool uncharge_memsw = true;
@@ -2148,14 +2222,14 @@ __do_uncharge(struct mem_cgroup *mem, const enum charge_type ctype)
 	if (batch->memcg != mem)
 		goto direct_uncharge;
 	/* remember freed charge and uncharge it later */
-	batch->bytes += PAGE_SIZE;
+	batch->bytes += page_size;
 	if (uncharge_memsw)
-		batch->memsw_bytes += PAGE_SIZE;
+		batch->memsw_bytes += page_size;
 	return;
 direct_uncharge:
-	res_counter_uncharge(&mem->res, PAGE_SIZE);
+	res_counter_uncharge(&mem->res, page_size);
 	if (uncharge_memsw)
-		res_counter_uncharge(&mem->memsw, PAGE_SIZE);
+		res_counter_uncharge(&mem->memsw, page_size);
 	return;
 }
 
@@ -2168,6 +2242,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	struct page_cgroup *pc;
 	struct mem_cgroup *mem = NULL;
 	struct mem_cgroup_per_zone *mz;
+	int nr_pages = 1 << compound_order(page);
 
 	if (mem_cgroup_disabled())
 		return NULL;
@@ -2207,10 +2282,10 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	}
 
 	if (!mem_cgroup_is_root(mem))
-		__do_uncharge(mem, ctype);
+		__do_uncharge(mem, ctype, nr_pages * PAGE_SIZE);
 	if (ctype == MEM_CGROUP_CHARGE_TYPE_SWAPOUT)
 		mem_cgroup_swap_statistics(mem, true);
-	mem_cgroup_charge_statistics(mem, pc, false);
+	mem_cgroup_charge_statistics(mem, pc, false, nr_pages);
 
 	ClearPageCgroupUsed(pc);
 	/*
@@ -2225,8 +2300,9 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	memcg_check_events(mem, page);
 	/* at swapout, this memcg will be accessed to record to swap */
-	if (ctype != MEM_CGROUP_CHARGE_TYPE_SWAPOUT)
-		css_put(&mem->css);
+	if (ctype != MEM_CGROUP_CHARGE_TYPE_SWAPOUT &&
+	    !mem_cgroup_is_root(mem))
+		__css_put(&mem->css, nr_pages);
 
 	return mem;
 
@@ -2437,7 +2513,8 @@ int mem_cgroup_prepare_migration(struct page *page, struct mem_cgroup **ptr)
 
 	*ptr = mem;
 	if (mem) {
-		ret = __mem_cgroup_try_charge(NULL, GFP_KERNEL, ptr, false);
+		ret = __mem_cgroup_try_charge(NULL, GFP_KERNEL, ptr, false,
+					      PAGE_SIZE);
 		css_put(&mem->css);
 	}
 	return ret;
@@ -2479,7 +2556,7 @@ void mem_cgroup_end_migration(struct mem_cgroup *mem,
 	 * __mem_cgroup_commit_charge() check PCG_USED bit of page_cgroup.
 	 * So, double-counting is effectively avoided.
 	 */
-	__mem_cgroup_commit_charge(mem, pc, ctype);
+	__mem_cgroup_commit_charge(mem, pc, ctype, PAGE_SIZE);
 
 	/*
 	 * Both of oldpage and newpage are still under lock_page().
@@ -2797,6 +2874,7 @@ static int mem_cgroup_force_empty(struct mem_cgroup *mem, bool free_all)
 	int node, zid, shrink;
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct cgroup *cgrp = mem->css.cgroup;
+	struct zone *zone;
 
 	css_get(&mem->css);
 
@@ -2812,6 +2890,9 @@ move_account:
 		ret = -EINTR;
 		if (signal_pending(current))
 			goto out;
+		/* huge pages are not on the LRU: split them onto it */
+		for_each_populated_zone(zone)
+			split_huge_pages_zone(zone, ULONG_MAX, mem);
 		/* This is for making all *used* pages to be on LRU. */
 		lru_add_drain_all();
 		drain_all_stock_sync();
@@ -3946,7 +4027,8 @@ one_by_one:
 			batch_count = PRECHARGE_COUNT_AT_ONCE;
 			cond_resched();
 		}
-		ret = __mem_cgroup_try_charge(NULL, GFP_KERNEL, &mem, false);
+		ret = __mem_cgroup_try_charge(NULL, GFP_KERNEL, &mem, false,
+					      PAGE_SIZE);
 		if (ret || !mem)
 			/* mem_cgroup_clear_mc() will do uncharge later */
 			return -ENOMEM;
@@ -4066,6 +4148,9 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	/* huge pages are not charged: split, the small pages are */
+	split_huge_page_pmd(walk->mm, addr, pmd);
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
 		if (is_target_pte_for_mc(vma, addr, *pte, NULL))
@@ -4211,6 +4296,7 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_page_pmd(walk->mm, addr, pmd);
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
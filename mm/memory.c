@@ -57,6 +57,8 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/huge_mm.h>
+#include <linux/migrate.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -797,6 +799,18 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*src_pmd)) {
+			int err;
+
+			VM_BUG_ON(next - addr != HPAGE_PMD_SIZE);
+			err = copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd,
+					    addr, vma);
+			if (err == -ENOMEM)
+				return -ENOMEM;
+			if (!err)
+				continue;
+			/* fall through */
+		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -999,6 +1013,15 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				split_huge_page_pmd(vma->vm_mm, addr, pmd);
+			else if (zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= HPAGE_PMD_SIZE;
+				continue;
+			}
+			/* fall through */
+		}
 		if (pmd_none_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
@@ -1266,11 +1289,23 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
-	if (pmd_huge(*pmd)) {
+	if (pmd_huge(*pmd) && vma->vm_flags & VM_HUGETLB) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
 		goto out;
 	}
+	if (pmd_trans_huge(*pmd) && vma->vm_ops) {
+		/* page cache pages behind a huge pmd are small pages */
+		spin_lock(&mm->page_table_lock);
+		if (likely(pmd_trans_huge(*pmd))) {
+			page = follow_trans_huge_pmd(vma, address, pmd, flags);
+			spin_unlock(&mm->page_table_lock);
+			goto out;
+		}
+		spin_unlock(&mm->page_table_lock);
+	}
+	/* get_user_pages() and friends only deal with small pages */
+	split_huge_page_pmd(mm, address, pmd);
 	if (unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
 
@@ -1580,8 +1615,11 @@ pte_t *get_locked_pte(struct mm_struct *mm, unsigned long addr,
 	pud_t * pud = pud_alloc(mm, pgd, addr);
 	if (pud) {
 		pmd_t * pmd = pmd_alloc(mm, pud, addr);
-		if (pmd)
+		if (pmd) {
+			/* remap_file_pages() may find a huge pmd there */
+			split_huge_page_pmd(mm, addr, pmd);
 			return pte_alloc_map_lock(mm, pmd, addr, ptl);
+		}
 	}
 	return NULL;
 }
@@ -3038,6 +3076,55 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting fault on a pte made PROT_NONE by change_prot_numa():
+ * restore the mapping, and move the page to the node of the faulting cpu
+ * if this is the only mm mapping it.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pmd_t *pmd,
+		pte_t orig_pte)
+{
+	int page_nid, this_nid = numa_node_id(), migrated = 0;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t entry;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+
+	entry = pte_mkyoung(pte_modify(orig_pte, vma->vm_page_prot));
+	set_pte_at(mm, address, page_table, entry);
+	update_mmu_cache(vma, address, page_table);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page || PageKsm(page)) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+	get_page(page);
+	pte_unmap_unlock(page_table, ptl);
+
+	count_vm_event(NUMA_HINT_FAULTS);
+	page_nid = page_to_nid(page);
+	if (page_nid == this_nid) {
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+		put_page(page);
+	} else if (page_mapcount(page) == 1) {
+		migrated = migrate_misplaced_page(page, this_nid);
+	} else
+		put_page(page);
+
+	task_numa_fault(page_nid, this_nid, migrated);
+	return 0;
+}
+#endif
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3076,6 +3163,12 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+#ifdef CONFIG_NUMA_BALANCING
+	if (pte_protnone(entry) &&
+	    (vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+#endif
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3132,9 +3225,44 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+		int ret;
+
+		ret = do_huge_pmd_anonymous_page(mm, vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && vma->vm_ops && vma->vm_ops->pmd_fault) {
+		int ret;
+
+		ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else {
+		pmd_t orig_pmd = *pmd;
+
+		barrier();
+		if (pmd_trans_huge(orig_pmd)) {
+			/* retry the fault once the pmd is split */
+			if (unlikely(pmd_trans_splitting(orig_pmd))) {
+				wait_split_huge_page(mm, pmd);
+				return 0;
+			}
+			return do_huge_pmd_fault(mm, vma, address, pmd,
+						 orig_pmd, flags);
+		}
+	}
+
+	/*
+	 * Use __pte_alloc instead of pte_alloc_map, because we can't
+	 * run pte_offset_map on the pmd if a huge pmd could
+	 * materialize from under us from a different thread.
+	 */
+	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	/* a huge pmd was established by another thread: retry the fault */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
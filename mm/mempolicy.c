@@ -90,6 +90,8 @@
 #include <linux/syscalls.h>
 #include <linux/ctype.h>
 #include <linux/mm_inline.h>
+#include <linux/huge_mm.h>
+#include <linux/mmu_notifier.h>
 
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
@@ -445,6 +447,8 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* page migration and the node checks work on small pages */
+		split_huge_page_pmd(vma->vm_mm, addr, pmd);
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
@@ -540,6 +544,113 @@ check_range(struct mm_struct *mm, unsigned long start, unsigned long end,
 	return first;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Make the present ptes of a range PROT_NONE, so that the next access
+ * takes a NUMA hinting fault, see do_numa_page().  Huge pmds are left
+ * alone, pmd_none_or_clear_bad() skips them.
+ */
+static unsigned long change_prot_numa_pte_range(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long nr_updated = 0;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+
+	orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	do {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || pte_protnone(ptent))
+			continue;
+		page = vm_normal_page(vma, addr, ptent);
+		/* See check_pte_range() */
+		if (!page || PageReserved(page) || PageKsm(page))
+			continue;
+
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptent = pte_modify(ptent, PAGE_NONE);
+		ptep_modify_prot_commit(mm, addr, pte, ptent);
+		nr_updated++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(orig_pte, ptl);
+	return nr_updated;
+}
+
+static inline unsigned long change_prot_numa_pmd_range(
+		struct vm_area_struct *vma, pud_t *pud,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long next, nr_updated = 0;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		if (pmd_none_or_clear_bad(pmd))
+			continue;
+		nr_updated += change_prot_numa_pte_range(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+	return nr_updated;
+}
+
+static inline unsigned long change_prot_numa_pud_range(
+		struct vm_area_struct *vma, pgd_t *pgd,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long next, nr_updated = 0;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		nr_updated += change_prot_numa_pmd_range(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+	return nr_updated;
+}
+
+/**
+ * change_prot_numa - arm NUMA hinting faults on a range of a vma
+ * @vma: the vma, whose mm's mmap_sem is held
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Returns the number of ptes that were made inaccessible.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			       unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr = start, next, nr_updated = 0;
+	pgd_t *pgd;
+
+	if (start >= end)
+		return 0;
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+	flush_cache_range(vma, start, end);
+	pgd = pgd_offset(mm, addr);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		nr_updated += change_prot_numa_pud_range(vma, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+	if (nr_updated)
+		flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+
+	count_vm_events(NUMA_PTE_UPDATES, nr_updated);
+	return nr_updated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /* Apply policy to a single VMA */
 static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 {
@@ -100,7 +100,7 @@ static int remove_migration_pte(struct page *new, struct vm_area_struct *vma,
 		goto out;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
 	ptep = pte_offset_map(pmd, addr);
@@ -545,9 +545,11 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	int rc = 0;
 	int *result = NULL;
 	struct page *newpage = get_new_page(page, private, &result);
+	int remap_swapcache = 1;
 	int rcu_locked = 0;
 	int charge = 0;
 	struct mem_cgroup *mem = NULL;
+	struct anon_vma *anon_vma = NULL;
 
 	if (!newpage)
 		return -ENOMEM;
@@ -596,14 +598,42 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	/*
 	 * By try_to_unmap(), page->mapcount goes down to 0 here. In this case,
 	 * we cannot notice that anon_vma is freed while we migrates a page.
-	 * This rcu_read_lock() delays freeing anon_vma pointer until the end
-	 * of migration. File cache pages are no problem because of page_lock()
-	 * File Caches may use write_page() or lock_page() in migration, then,
-	 * just care Anon page here.
+	 * Taking the external_refcount of the anon_vma below delays freeing
+	 * it until the end of migration. File cache pages are no problem:
+	 * migration holds page_lock() on them and may use write_page() or
+	 * lock_page(), so only anon pages need care here.
 	 */
 	if (PageAnon(page)) {
 		rcu_read_lock();
 		rcu_locked = 1;
+
+		/* Determine how to safely use anon_vma */
+		if (!page_mapped(page)) {
+			if (!PageSwapCache(page))
+				goto rcu_unlock;
+
+			/*
+			 * We cannot be sure that the anon_vma of an unmapped
+			 * swapcache page is safe to use because we don't
+			 * know in advance if the VMA that this page belonged
+			 * to still exists. If the VMA and others sharing the
+			 * data have been freed, then the anon_vma could
+			 * already be invalid.
+			 *
+			 * To avoid this possibility, swapcache pages get
+			 * migrated but are not remapped when migration
+			 * completes
+			 */
+			remap_swapcache = 0;
+		} else {
+			/*
+			 * Take a reference count on the anon_vma if the
+			 * page is mapped so that it is guaranteed to
+			 * exist when the page is remapped later
+			 */
+			anon_vma = page_anon_vma(page);
+			atomic_inc(&anon_vma->external_refcount);
+		}
 	}
 
 	/*
@@ -640,9 +670,19 @@ skip_unmap:
 	if (!page_mapped(page))
 		rc = move_to_new_page(newpage, page);
 
-	if (rc)
+	if (rc && remap_swapcache)
 		remove_migration_ptes(page, page);
 rcu_unlock:
+
+	/* Drop an anon_vma reference if we took one */
+	if (anon_vma && atomic_dec_and_lock(&anon_vma->external_refcount,
+					    &anon_vma->lock)) {
+		int empty = list_empty(&anon_vma->head);
+		spin_unlock(&anon_vma->lock);
+		if (empty)
+			anon_vma_free(anon_vma);
+	}
+
 	if (rcu_locked)
 		rcu_read_unlock();
 uncharge:
@@ -1109,4 +1149,46 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long node, int **result)
+{
+	/* Not worth reclaiming on the target node for a hinting fault */
+	return alloc_pages_exact_node((int)node,
+		(GFP_HIGHUSER_MOVABLE | __GFP_THISNODE | __GFP_NOMEMALLOC |
+		 __GFP_NORETRY | __GFP_NOWARN) & ~__GFP_WAIT, 0);
+}
+
+/**
+ * migrate_misplaced_page - move a page to the node accessing it
+ * @page: the page, on which the caller holds a reference
+ * @node: the node of the cpu that took the NUMA hinting fault
+ *
+ * Consumes the caller's reference on @page.  Returns 1 if the page was
+ * migrated, 0 if it stays where it is.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	struct address_space *mapping = page_mapping(page);
+	LIST_HEAD(migratepages);
+
+	/* Without ->migratepage, the page would be written back first */
+	if ((mapping && !mapping->a_ops->migratepage) ||
+	    isolate_lru_page(page)) {
+		put_page(page);
+		return 0;
+	}
+	/* isolate_lru_page() took a reference of its own */
+	put_page(page);
+
+	list_add(&page->lru, &migratepages);
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	if (migrate_pages(&migratepages, alloc_misplaced_dst_page, node, 0))
+		return 0;
+
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return 1;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif
@@ -28,6 +28,7 @@
 #include <linux/rmap.h>
 #include <linux/mmu_notifier.h>
 #include <linux/perf_event.h>
+#include <linux/huge_mm.h>
 
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -553,6 +554,8 @@ again:			remove_next = 1 + (end > next->vm_end);
 		}
 	}
 
+	vma_adjust_trans_huge(vma, start, end, adjust_next);
+
 	if (file) {
 		mapping = file->f_mapping;
 		if (!(vma->vm_flags & VM_NONLINEAR))
@@ -1551,6 +1554,11 @@ get_unmapped_area(struct file *file, unsigned long addr, unsigned long len,
 	get_area = current->mm->get_unmapped_area;
 	if (file && file->f_op && file->f_op->get_unmapped_area)
 		get_area = file->f_op->get_unmapped_area;
+#if defined(CONFIG_SHMEM) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+	else if (!file && (flags & MAP_TYPE) == MAP_SHARED)
+		/* shared anonymous: shmem_zero_setup() will back it */
+		get_area = shmem_get_unmapped_area;
+#endif
 	addr = get_area(file, addr, len, pgoff, flags);
 	if (IS_ERR_VALUE(addr))
 		return addr;
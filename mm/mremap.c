@@ -19,6 +19,7 @@
 #include <linux/security.h>
 #include <linux/syscalls.h>
 #include <linux/mmu_notifier.h>
+#include <linux/huge_mm.h>
 
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -41,6 +42,8 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 		return NULL;
 
 	pmd = pmd_offset(pud, addr);
+	/* ptes are moved one by one: a huge pmd can't move as a whole */
+	split_huge_page_pmd(mm, addr, pmd);
 	if (pmd_none_or_clear_bad(pmd))
 		return NULL;
 
@@ -18,6 +18,9 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -291,6 +294,80 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * Ramp up a stream's window, unless its device is already saturated with
+ * reads: then larger windows would only add to the latency of every read
+ * queued behind them, so hold the window size until the queue drains.
+ */
+static unsigned long get_next_ra_size_bdi(struct address_space *mapping,
+					  struct file_ra_state *ra,
+					  unsigned long max)
+{
+	if (bdi_read_congested(mapping->backing_dev_info))
+		return min_t(unsigned long, ra->size, max);
+	return get_next_ra_size(ra, max);
+}
+
+/*
+ * After RA_RANDOM_MISSES random reads in a row, context readahead wants
+ * RA_RANDOM_HISTORY cached pages before the read to start a stream.
+ */
+#define RA_RANDOM_MISSES	8
+#define RA_RANDOM_HISTORY	16
+
+static inline int ra_stream_expects(pgoff_t start, unsigned int size,
+				    unsigned int async_size, pgoff_t offset)
+{
+	return size && (offset == start + size - async_size ||
+			offset == start + size);
+}
+
+/*
+ * Look for an interleaved stream whose window expects @offset, and make
+ * it the current window, remembering the current one in its place.
+ */
+static int ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct ra_stream cur = {
+		.start		= ra->start,
+		.size		= ra->size,
+		.async_size	= ra->async_size,
+	};
+	int i;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		struct ra_stream *stream = &ra->streams[i];
+
+		if (!ra_stream_expects(stream->start, stream->size,
+				       stream->async_size, offset))
+			continue;
+
+		ra->start = stream->start;
+		ra->size = stream->size;
+		ra->async_size = stream->async_size;
+		/* Keep the most recently used streams first */
+		memmove(&ra->streams[1], &ra->streams[0], i * sizeof(cur));
+		ra->streams[0] = cur;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * A new window is about to replace the current one: remember the current
+ * window as the most recent other stream, forgetting the least recent.
+ */
+static void ra_save_stream(struct file_ra_state *ra)
+{
+	if (!ra->size)
+		return;
+	memmove(&ra->streams[1], &ra->streams[0],
+		(RA_STREAMS - 1) * sizeof(struct ra_stream));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+}
+
 /*
  * On-demand readahead design.
  *
@@ -321,6 +398,19 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * for sequential patterns. Hence interleaved reads might be served as
  * sequential ones.
  *
+ * Besides the current window, file_ra_state remembers the windows of the
+ * RA_STREAMS most recent other streams. When a new window replaces the
+ * current one, the current one is kept in streams[]; and a read at the
+ * expected offset of one of those switches back to it and carries on
+ * ramping it up. So several scans interleaved on one fd each keep their
+ * own readahead, without having to be rediscovered from PG_readahead or
+ * from the page cache on every switch.
+ *
+ * random_miss counts the reads in a row which found no stream. Once a
+ * file looks randomly read, context readahead needs a longer history of
+ * cached pages before it believes in a new stream: otherwise reads which
+ * happen to land just after cached pages would each trigger readahead.
+ *
  * There is a special-case: if the first page which the application tries to
  * read happens to be the first page of the file, it is assumed that a linear
  * read is about to happen and the window is immediately set to the initial size
@@ -369,6 +459,16 @@ static int try_context_readahead(struct address_space *mapping,
 	if (!size)
 		return 0;
 
+	/*
+	 * A file being read randomly has cached pages all over it: don't
+	 * take a few of them before this read for a stream, unless there
+	 * are enough of them to look like one.
+	 */
+	if (ra->random_miss >= RA_RANDOM_MISSES && size < RA_RANDOM_HISTORY)
+		return 0;
+
+	ra_save_stream(ra);
+
 	/*
 	 * starts from beginning of file:
 	 * it is a strong indication of long-run stream (or whole-file-read)
@@ -393,12 +493,16 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long actual;
+	int pattern;
 
 	/*
 	 * start of file
 	 */
-	if (!offset)
+	if (!offset) {
+		pattern = RA_PATTERN_INITIAL;
 		goto initial_readahead;
+	}
 
 	/*
 	 * It's the expected callback offset, assume sequential access.
@@ -406,10 +510,17 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
-		ra->start += ra->size;
-		ra->size = get_next_ra_size(ra, max);
-		ra->async_size = ra->size;
-		goto readit;
+		pattern = RA_PATTERN_SEQUENTIAL;
+		goto sequential;
+	}
+
+	/*
+	 * It's the expected offset of another stream interleaved with the
+	 * current one on this file: switch to that stream's window.
+	 */
+	if (ra_switch_stream(ra, offset)) {
+		pattern = RA_PATTERN_STREAM;
+		goto sequential;
 	}
 
 	/*
@@ -428,45 +539,67 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_save_stream(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
-		ra->size = get_next_ra_size(ra, max);
+		ra->size = get_next_ra_size_bdi(mapping, ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_MARKER;
 		goto readit;
 	}
 
 	/*
 	 * oversize read
 	 */
-	if (req_size > max)
+	if (req_size > max) {
+		pattern = RA_PATTERN_OVERSIZE;
 		goto initial_readahead;
+	}
 
 	/*
 	 * sequential cache miss
 	 */
-	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
+	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL) {
+		pattern = RA_PATTERN_INITIAL;
 		goto initial_readahead;
+	}
 
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	if (ra->random_miss < RA_RANDOM_MISSES)
+		ra->random_miss++;
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	trace_readahead(mapping, offset, req_size, RA_PATTERN_RANDOM,
+			ra, actual);
+	return actual;
+
+sequential:
+	ra->start += ra->size;
+	ra->size = get_next_ra_size_bdi(mapping, ra, max);
+	ra->async_size = ra->size;
+	goto readit;
 
 initial_readahead:
+	ra_save_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
+	ra->random_miss = 0;
+
 	/*
 	 * Will this read hit the readahead marker made by itself?
 	 * If so, trigger the readahead marker hit now, and merge
@@ -477,7 +610,9 @@ readit:
 		ra->size += ra->async_size;
 	}
 
-	return ra_submit(ra, mapping, filp);
+	actual = ra_submit(ra, mapping, filp);
+	trace_readahead(mapping, offset, req_size, pattern, ra, actual);
+	return actual;
 }
 
 /**
@@ -31,11 +31,12 @@
  *             swap_lock (in swap_duplicate, swap_info_get)
  *               mmlist_lock (in mmput, drain_mmlist and others)
  *               mapping->private_lock (in __set_page_dirty_buffers)
- *               inode_lock (in set_page_dirty's __mark_inode_dirty)
- *                 sb_lock (within inode_lock in fs/fs-writeback.c)
+ *               inode_wb_list_lock (in set_page_dirty's __mark_inode_dirty)
+ *                 inode->i_lock (in set_page_dirty's __mark_inode_dirty)
+ *                 sb_lock (within inode_wb_list_lock in fs/fs-writeback.c)
  *                 mapping->tree_lock (widely used, in set_page_dirty,
  *                           in arch-dependent flush_dcache_mmap_lock,
- *                           within inode_lock in __sync_single_inode)
+ *                           within inode_wb_list_lock in __sync_single_inode)
  *
  * (code doesn't rely on that order so it could be switched around)
  * ->tasklist_lock
@@ -56,6 +57,7 @@
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
 #include <linux/migrate.h>
+#include <linux/huge_mm.h>
 
 #include <asm/tlbflush.h>
 
@@ -250,7 +252,7 @@ static void anon_vma_unlink(struct anon_vma_chain *anon_vma_chain)
 	list_del(&anon_vma_chain->same_anon_vma);
 
 	/* We must garbage collect the anon_vma if it's empty */
-	empty = list_empty(&anon_vma->head) && !ksm_refcount(anon_vma);
+	empty = list_empty(&anon_vma->head) && !anonvma_external_refcount(anon_vma);
 	spin_unlock(&anon_vma->lock);
 
 	if (empty)
@@ -274,7 +276,7 @@ static void anon_vma_ctor(void *data)
 	struct anon_vma *anon_vma = data;
 
 	spin_lock_init(&anon_vma->lock);
-	ksm_refcount_init(anon_vma);
+	anonvma_external_refcount_init(anon_vma);
 	INIT_LIST_HEAD(&anon_vma->head);
 }
 
@@ -320,7 +322,7 @@ void page_unlock_anon_vma(struct anon_vma *anon_vma)
  * Returns virtual address or -EFAULT if page's index/offset is not
  * within the range mapped the @vma.
  */
-static inline unsigned long
+unsigned long
 vma_address(struct page *page, struct vm_area_struct *vma)
 {
 	pgoff_t pgoff = page->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
@@ -381,6 +383,16 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	/*
+	 * A huge anonymous pmd maps no small page.  A huge pmd mapping
+	 * page cache maps small pages, which reclaim and migration deal
+	 * with one by one: split it.
+	 */
+	if (pmd_trans_huge(*pmd)) {
+		if (PageAnon(page))
+			return NULL;
+		split_huge_page_pmd(mm, address, pmd);
+	}
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -837,6 +849,50 @@ void page_add_new_anon_rmap(struct page *page,
 		add_page_to_unevictable_list(page);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/**
+ * page_add_huge_anon_rmap - add huge pmd mapping to a new huge page
+ * @page:	the head page of the huge page
+ * @vma:	the vm area in which the mapping is added
+ * @address:	the user virtual address mapped, huge page aligned
+ *
+ * A transparent huge page is not put on the LRU.  The mapcount of its
+ * head page counts the huge pmds mapping it: fork() adds more with
+ * page_dup_rmap().  The caller needs to hold the page_table_lock.
+ */
+void page_add_huge_anon_rmap(struct page *page,
+	struct vm_area_struct *vma, unsigned long address)
+{
+	VM_BUG_ON(address < vma->vm_start ||
+		  address + HPAGE_PMD_SIZE > vma->vm_end);
+	VM_BUG_ON(!PageHead(page));
+	atomic_set(&page->_mapcount, 0);
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, HPAGE_PMD_NR);
+	__inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	__page_set_anon_rmap(page, vma, address, 1);
+}
+
+/**
+ * page_remove_huge_anon_rmap - take down a huge pmd mapping of a page
+ * @page:	the head page of the huge page
+ *
+ * Returns 1 if that was the last mapping of the page.  The caller needs
+ * to hold the page_table_lock.
+ */
+int page_remove_huge_anon_rmap(struct page *page)
+{
+	VM_BUG_ON(!PageHead(page));
+	if (!atomic_add_negative(-1, &page->_mapcount))
+		return 0;
+	mem_cgroup_uncharge_page(page);
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, -HPAGE_PMD_NR);
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	/* a compound page is freed without going through free_hot_cold_page */
+	page->mapping = NULL;
+	return 1;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /**
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
@@ -59,6 +59,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/huge_mm.h>
 
 #include <asm/uaccess.h>
 #include <asm/div64.h>
@@ -1493,6 +1494,203 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret | VM_FAULT_LOCKED;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Huge pages, with the huge=always mount option.
+ *
+ * The first fault through a shared mapping on an aligned block of
+ * HPAGE_PMD_NR pages of a file, none of which is in the page cache yet,
+ * allocates the whole block as one physically contiguous huge page.
+ * That is split into small pages right away, which are added to the
+ * page cache like any other tmpfs page: swap, truncation and block
+ * accounting all keep working on small pages.  As long as the block
+ * stays in the page cache in one piece it is mapped by a huge pmd.
+ * Reclaim, swap out and migration deal with the pages one by one, and
+ * split the pmd into ptes when they find it, see page_check_address().
+ */
+
+/* huge= of the internal mount, for SysV and shared anonymous memory */
+static int shmem_huge __read_mostly;
+
+static int __init setup_shmem_huge(char *str)
+{
+	if (!strcmp(str, "always"))
+		shmem_huge = 1;
+	else if (!strcmp(str, "never"))
+		shmem_huge = 0;
+	else
+		return 0;
+	return 1;
+}
+__setup("shmem_huge=", setup_shmem_huge);
+
+/* Is the block of pages at @index entirely within i_size? */
+static inline int shmem_huge_within_size(struct inode *inode, pgoff_t index)
+{
+	loff_t size = i_size_read(inode) + PAGE_CACHE_SIZE - 1;
+
+	return index + HPAGE_PMD_NR <= (size >> PAGE_CACHE_SHIFT);
+}
+
+/*
+ * Instantiate the aligned block of pages at @index with a huge page, if
+ * none of it is in the page cache.  Any failure is left to the small
+ * page fault to find out about and report.
+ */
+static void shmem_alloc_huge_block(struct inode *inode, pgoff_t index)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct page *page, *subpage;
+	int i;
+
+	if (find_get_pages(mapping, index, 1, &page)) {
+		pgoff_t found = page->index;
+
+		page_cache_release(page);
+		if (found < index + HPAGE_PMD_NR)
+			return;
+	}
+
+	page = alloc_pages(mapping_gfp_mask(mapping) | __GFP_NOWARN |
+			   __GFP_NORETRY, HPAGE_PMD_ORDER);
+	if (!page) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return;
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		subpage = page + i;
+		SetPageSwapBacked(subpage);
+		if (add_to_page_cache_lru(subpage, mapping, index + i,
+					  GFP_KERNEL))
+			break;
+		/*
+		 * shmem_getpage() accounts the page it is passed, and clears
+		 * it, or reads it in if that part of the file was on swap.
+		 */
+		if (shmem_getpage(inode, index + i, &subpage, SGP_CACHE, NULL)) {
+			remove_from_page_cache(subpage);
+			unlock_page(subpage);
+			page_cache_release(subpage);
+			break;
+		}
+		unlock_page(subpage);
+		page_cache_release(subpage);
+	}
+	/* someone else instantiated part of the block meanwhile */
+	for (; i < HPAGE_PMD_NR; i++)
+		page_cache_release(page + i);
+}
+
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page, *subpage;
+	pgoff_t index;
+	int i, ret = VM_FAULT_FALLBACK;
+
+	if (!SHMEM_SB(inode->i_sb)->huge)
+		return VM_FAULT_FALLBACK;
+	/* private mappings COW small pages, nonlinear ones need ptes */
+	if ((vma->vm_flags & (VM_SHARED | VM_NONLINEAR)) != VM_SHARED)
+		return VM_FAULT_FALLBACK;
+	if ((flags & FAULT_FLAG_WRITE) && !(vma->vm_flags & VM_WRITE))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	index = vma->vm_pgoff + ((haddr - vma->vm_start) >> PAGE_SHIFT);
+	if ((index & (HPAGE_PMD_NR - 1)) ||
+	    !shmem_huge_within_size(inode, index))
+		return VM_FAULT_FALLBACK;
+
+	page = find_get_page(mapping, index);
+	if (!page) {
+		shmem_alloc_huge_block(inode, index);
+		page = find_get_page(mapping, index);
+		if (!page)
+			return VM_FAULT_FALLBACK;
+	}
+	if (page_to_pfn(page) & (HPAGE_PMD_NR - 1)) {
+		page_cache_release(page);
+		return VM_FAULT_FALLBACK;
+	}
+
+	/*
+	 * Lock the whole block, as the small page fault locks its page,
+	 * so that none of it can be truncated before it is mapped.
+	 * trylock, as there is no order in which to wait for them all.
+	 */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		subpage = i ? find_get_page(mapping, index + i) : page;
+		if (subpage != page + i)
+			goto out_put;
+		if (!trylock_page(subpage))
+			goto out_put;
+		if (subpage->mapping != mapping || !PageUptodate(subpage)) {
+			unlock_page(subpage);
+			goto out_put;
+		}
+	}
+	if (shmem_huge_within_size(inode, index))
+		ret = do_huge_pmd_file_page(vma, address, pmd, page, flags);
+	goto out;
+
+out_put:
+	if (subpage)
+		page_cache_release(subpage);
+out:
+	/* the references of a mapped block now belong to the pmd */
+	while (i--) {
+		unlock_page(page + i);
+		if (ret)
+			page_cache_release(page + i);
+	}
+	return ret;
+}
+
+/*
+ * Place mappings of huge=always files at an address where the huge pmds
+ * will line up with the aligned blocks of the file.  A shared anonymous
+ * mapping comes here without a file: shmem_zero_setup() will give it one
+ * on the internal mount, starting at offset 0.
+ */
+unsigned long shmem_get_unmapped_area(struct file *file,
+		unsigned long addr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	struct super_block *sb;
+	unsigned long offset, area;
+
+	if (file)
+		sb = file->f_path.dentry->d_inode->i_sb;
+	else {
+		if (IS_ERR(shm_mnt))
+			return current->mm->get_unmapped_area(file, addr, len,
+							      pgoff, flags);
+		sb = shm_mnt->mnt_sb;
+		pgoff = 0;
+	}
+
+	if (!SHMEM_SB(sb)->huge || addr || (flags & MAP_FIXED) ||
+	    len < HPAGE_PMD_SIZE || len > TASK_SIZE - HPAGE_PMD_SIZE)
+		return current->mm->get_unmapped_area(file, addr, len,
+						      pgoff, flags);
+
+	area = current->mm->get_unmapped_area(file, 0,
+				len + HPAGE_PMD_SIZE - PAGE_SIZE, pgoff, flags);
+	if (IS_ERR_VALUE(area))
+		return current->mm->get_unmapped_area(file, addr, len,
+						      pgoff, flags);
+	offset = (pgoff << PAGE_SHIFT) & ~HPAGE_PMD_MASK;
+	return area + ((offset - area) & ~HPAGE_PMD_MASK);
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *new)
 {
@@ -2231,6 +2429,15 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+		} else if (!strcmp(this_char,"huge")) {
+			if (!strcmp(value, "never"))
+				sbinfo->huge = 0;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+			else if (!strcmp(value, "always"))
+				sbinfo->huge = 1;
+#endif
+			else
+				goto bad_val;
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2281,6 +2488,8 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
 
+	sbinfo->huge        = config.huge;
+
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
 out:
@@ -2303,6 +2512,8 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=always");
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2351,6 +2562,11 @@ int shmem_fill_super(struct super_block *sb, void *data, int silent)
 	sb->s_flags |= MS_NOUSER;
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (sb->s_flags & MS_NOUSER)
+		sbinfo->huge = shmem_huge;
+#endif
+
 	spin_lock_init(&sbinfo->stat_lock);
 	sbinfo->free_blocks = sbinfo->max_blocks;
 	sbinfo->free_inodes = sbinfo->max_inodes;
@@ -2395,13 +2611,20 @@ static struct inode *shmem_alloc_inode(struct super_block *sb)
 	return &p->vfs_inode;
 }
 
+static void shmem_i_callback(struct rcu_head *head)
+{
+	struct inode *inode = container_of(head, struct inode, i_rcu);
+	INIT_LIST_HEAD(&inode->i_dentry);
+	kmem_cache_free(shmem_inode_cachep, SHMEM_I(inode));
+}
+
 static void shmem_destroy_inode(struct inode *inode)
 {
 	if ((inode->i_mode & S_IFMT) == S_IFREG) {
 		/* only struct inode is valid if it's an inline symlink */
 		mpol_free_shared_policy(&SHMEM_I(inode)->policy);
 	}
-	kmem_cache_free(shmem_inode_cachep, SHMEM_I(inode));
+	call_rcu(&inode->i_rcu, shmem_i_callback);
 }
 
 static void init_once(void *foo)
@@ -2438,6 +2661,9 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2512,6 +2738,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2530,6 +2759,7 @@ static struct file_system_type tmpfs_fs_type = {
 	.name		= "tmpfs",
 	.get_sb		= shmem_get_sb,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_RCU_INODES,
 };
 
 int __init init_tmpfs(void)
@@ -0,0 +1,228 @@
+/*
+ * mm/slab_bench.c - slab allocator microbenchmark
+ *
+ * Times kmalloc and kfree on one cpu, and with objects allocated on one
+ * cpu being freed on another, as happens when network buffers are
+ * received on one cpu and consumed on another.  Results are printed in
+ * cycles per operation.  Loading the module runs the tests; it then
+ * fails to load, so that it can simply be loaded again:
+ *
+ *	modprobe slab_bench nr_objs=10000
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+#include <asm/timex.h>
+
+static unsigned int nr_objs = 10000;
+module_param(nr_objs, uint, 0444);
+MODULE_PARM_DESC(nr_objs, "Number of objects allocated in each test");
+
+static const unsigned int sizes[] = {
+	8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+};
+
+static void **objs;
+
+static unsigned long long per_obj(cycles_t cycles)
+{
+	return div_u64(cycles, nr_objs);
+}
+
+/*
+ * Allocate nr_objs objects and then free them all, on this cpu.
+ */
+static void bench_local(unsigned int size)
+{
+	cycles_t t1, t2, t3;
+	unsigned int i;
+
+	t1 = get_cycles();
+	for (i = 0; i < nr_objs; i++)
+		objs[i] = kmalloc(size, GFP_KERNEL);
+	t2 = get_cycles();
+	for (i = 0; i < nr_objs; i++)
+		kfree(objs[i]);
+	t3 = get_cycles();
+
+	printk(KERN_INFO "slab_bench: %u times kmalloc(%u) -> %llu cycles"
+	       " kfree -> %llu cycles\n", nr_objs, size,
+	       per_obj(t2 - t1), per_obj(t3 - t2));
+}
+
+/*
+ * Allocate and immediately free an object, nr_objs times.
+ */
+static void bench_pair(unsigned int size)
+{
+	cycles_t t1, t2;
+	unsigned int i;
+
+	t1 = get_cycles();
+	for (i = 0; i < nr_objs; i++)
+		kfree(kmalloc(size, GFP_KERNEL));
+	t2 = get_cycles();
+
+	printk(KERN_INFO "slab_bench: %u times kmalloc(%u)/kfree -> %llu"
+	       " cycles\n", nr_objs, size, per_obj(t2 - t1));
+}
+
+/*
+ * The remote test runs a thread on each online cpu.  Each one allocates
+ * nr_objs objects, waits for the others to do the same, and then frees
+ * the objects allocated by the thread on the next cpu.
+ */
+struct bench_thread {
+	struct task_struct *task;
+	void **objs;
+	struct bench_thread *next;
+	cycles_t alloc_cycles;
+	cycles_t free_cycles;
+};
+
+static unsigned int bench_size;
+static atomic_t bench_allocating;
+static atomic_t bench_running;
+static DECLARE_COMPLETION(bench_done);
+
+static int bench_remote_thread(void *data)
+{
+	struct bench_thread *bt = data;
+	cycles_t t1, t2;
+	unsigned int i;
+
+	t1 = get_cycles();
+	for (i = 0; i < nr_objs; i++)
+		bt->objs[i] = kmalloc(bench_size, GFP_KERNEL);
+	t2 = get_cycles();
+	bt->alloc_cycles = t2 - t1;
+
+	atomic_dec(&bench_allocating);
+	while (atomic_read(&bench_allocating))
+		cpu_relax();
+
+	t1 = get_cycles();
+	for (i = 0; i < nr_objs; i++)
+		kfree(bt->next->objs[i]);
+	t2 = get_cycles();
+	bt->free_cycles = t2 - t1;
+
+	if (atomic_dec_and_test(&bench_running))
+		complete(&bench_done);
+	return 0;
+}
+
+static void bench_remote(unsigned int size, struct bench_thread *threads,
+			 int nr_threads)
+{
+	cycles_t alloc_cycles = 0, free_cycles = 0;
+	int cpu, i = 0;
+
+	bench_size = size;
+	atomic_set(&bench_allocating, nr_threads);
+	atomic_set(&bench_running, nr_threads);
+	INIT_COMPLETION(bench_done);
+
+	for_each_online_cpu(cpu) {
+		struct bench_thread *bt = &threads[i];
+
+		bt->next = &threads[(i + 1) % nr_threads];
+		bt->task = kthread_create(bench_remote_thread, bt,
+					  "slab_bench/%d", cpu);
+		if (IS_ERR(bt->task)) {
+			/* Nothing has started yet: just give up */
+			while (--i >= 0)
+				kthread_stop(threads[i].task);
+			printk(KERN_ERR "slab_bench: cannot create thread\n");
+			return;
+		}
+		kthread_bind(bt->task, cpu);
+		i++;
+	}
+	for (i = 0; i < nr_threads; i++)
+		wake_up_process(threads[i].task);
+	wait_for_completion(&bench_done);
+
+	for (i = 0; i < nr_threads; i++) {
+		alloc_cycles += threads[i].alloc_cycles;
+		free_cycles += threads[i].free_cycles;
+	}
+	printk(KERN_INFO "slab_bench: %d cpus %u times kmalloc(%u) -> %llu"
+	       " cycles remote kfree -> %llu cycles\n", nr_threads, nr_objs,
+	       size, div_u64(alloc_cycles, nr_objs * nr_threads),
+	       div_u64(free_cycles, nr_objs * nr_threads));
+}
+
+static void bench_remote_all(void)
+{
+	struct bench_thread *threads;
+	int nr_threads, i, s;
+
+	get_online_cpus();
+	nr_threads = num_online_cpus();
+	if (nr_threads < 2) {
+		printk(KERN_INFO "slab_bench: remote test needs two cpus\n");
+		goto out;
+	}
+
+	threads = kcalloc(nr_threads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		goto out;
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].objs = vmalloc(nr_objs * sizeof(void *));
+		if (!threads[i].objs)
+			goto free;
+	}
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++)
+		bench_remote(sizes[s], threads, nr_threads);
+free:
+	for (i = 0; i < nr_threads; i++)
+		vfree(threads[i].objs);
+	kfree(threads);
+out:
+	put_online_cpus();
+}
+
+static int __init slab_bench_init(void)
+{
+	int s;
+
+	if (!nr_objs)
+		return -EINVAL;
+	objs = vmalloc(nr_objs * sizeof(void *));
+	if (!objs)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slab_bench: single cpu, allocate then free\n");
+	for (s = 0; s < ARRAY_SIZE(sizes); s++)
+		bench_local(sizes[s]);
+
+	printk(KERN_INFO "slab_bench: single cpu, allocate and free\n");
+	for (s = 0; s < ARRAY_SIZE(sizes); s++)
+		bench_pair(sizes[s]);
+
+	vfree(objs);
+
+	printk(KERN_INFO "slab_bench: each cpu frees the next one's objects\n");
+	bench_remote_all();
+
+	/* Fail, so that the benchmark can be run again by reloading */
+	return -EAGAIN;
+}
+module_init(slab_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab allocator microbenchmark");
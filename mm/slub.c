@@ -105,6 +105,15 @@
  * PageError		Slab requires special handling due to debug
  * 			options set. This moves	slab handling out of
  * 			the fast path and disables lockless freelists.
+ *
+ * Objects freed to a slab other than the cpu slab (typically objects
+ * allocated on another processor) are not returned to their slab one by
+ * one. Each processor queues them while they keep going to the same slab
+ * and then returns the whole chain under a single slab_lock. The queued
+ * objects are still counted in page->inuse, so the slab cannot go away
+ * under the queue. The queue is returned when the processor runs out of
+ * slabs to allocate from, every few seconds from a per cpu work item and
+ * by flush_all().
  */
 
 #ifdef CONFIG_SLUB_DEBUG
@@ -137,6 +146,18 @@
  */
 #define MAX_PARTIAL 10
 
+/*
+ * Maximum number of objects queued by a processor for a slab that is
+ * not its cpu slab before they are returned to the slab.
+ */
+#define REMOTE_FREE_BATCH 32
+
+/*
+ * Interval at which each processor returns the objects it still has
+ * queued, so that a queue does not pin objects while no more frees come.
+ */
+#define REMOTE_FREE_TIMEOUT (2 * HZ)
+
 #define DEBUG_DEFAULT_FLAGS (SLAB_DEBUG_FREE | SLAB_RED_ZONE | \
 				SLAB_POISON | SLAB_STORE_USER)
 
@@ -1487,8 +1508,10 @@ static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	deactivate_slab(s, c);
 }
 
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c);
+
 /*
- * Flush cpu slab.
+ * Flush cpu slab and the queue of remotely freed objects.
  *
  * Called from IPI handler with interrupts disabled.
  */
@@ -1496,8 +1519,12 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+	if (likely(c->page))
 		flush_slab(s, c);
+	if (c->remote_page)
+		flush_remote_frees(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1644,6 +1671,9 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	/* our queued objects may be just what a partial slab is missing */
+	if (c->remote_page)
+		flush_remote_frees(s, c);
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1775,11 +1805,14 @@ EXPORT_SYMBOL(kmem_cache_alloc_node_notrace);
  * have a longer lifetime than the cpu slabs in most processing loads.
  *
  * So we still attempt to reduce cache line usage. Just take the slab
- * lock and free the item. If there is no additional partial page
+ * lock and free the items. If there is no additional partial page
  * handling required then we can return immediately.
+ *
+ * The @cnt objects from @x to @tail are chained through their free
+ * pointers. Only a single object is passed for a slab with debugging on.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
-			void *x, unsigned long addr)
+			void *x, void *tail, int cnt, unsigned long addr)
 {
 	void *prior;
 	void **object = (void *)x;
@@ -1792,9 +1825,9 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 checks_ok:
 	prior = page->freelist;
-	set_freepointer(s, object, prior);
+	set_freepointer(s, tail, prior);
 	page->freelist = object;
-	page->inuse--;
+	page->inuse -= cnt;
 
 	if (unlikely(PageSlubFrozen(page))) {
 		stat(s, FREE_FROZEN);
@@ -1831,11 +1864,96 @@ slab_empty:
 	return;
 
 debug:
+	VM_BUG_ON(cnt != 1);
 	if (!free_debug_processing(s, page, x, addr))
 		goto out_unlock;
 	goto checks_ok;
 }
 
+/*
+ * Return the objects queued by this processor to their slab.
+ *
+ * Interrupts are disabled.
+ */
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	stat(s, FREE_REMOTE_FLUSH);
+	__slab_free(s, c->remote_page, c->remote_freelist, c->remote_tail,
+		    c->remote_count, _RET_IP_);
+	c->remote_page = NULL;
+	c->remote_freelist = NULL;
+	c->remote_tail = NULL;
+	c->remote_count = 0;
+}
+
+/*
+ * Free an object to a slab which is not the cpu slab.
+ *
+ * Consecutive frees to the same slab are chained up on the processor and
+ * returned together, so that a stream of objects allocated elsewhere
+ * takes the slab lock (and possibly the list_lock) once per batch rather
+ * than once per object.
+ *
+ * Interrupts are disabled.
+ */
+static void slab_free_remote(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			     struct page *page, void *x, unsigned long addr)
+{
+	if (unlikely(SLABDEBUG && PageSlubDebug(page))) {
+		__slab_free(s, page, x, x, 1, addr);
+		return;
+	}
+
+	if (c->remote_page != page) {
+		if (c->remote_page)
+			flush_remote_frees(s, c);
+		c->remote_page = page;
+		c->remote_tail = x;
+	}
+	set_freepointer(s, x, c->remote_freelist);
+	c->remote_freelist = x;
+	stat(s, FREE_REMOTE_QUEUED);
+
+	if (++c->remote_count >= REMOTE_FREE_BATCH)
+		flush_remote_frees(s, c);
+}
+
+static DEFINE_PER_CPU(struct delayed_work, slab_drain_work);
+
+/*
+ * Return the objects this processor has queued in any cache.  If a cache
+ * is being created or destroyed just try again next time.
+ */
+static void drain_remote_frees(struct work_struct *w)
+{
+	struct kmem_cache *s;
+	struct kmem_cache_cpu *c;
+
+	if (down_read_trylock(&slub_lock)) {
+		list_for_each_entry(s, &slab_caches, list) {
+			local_irq_disable();
+			c = __this_cpu_ptr(s->cpu_slab);
+			if (c->remote_page)
+				flush_remote_frees(s, c);
+			local_irq_enable();
+		}
+		up_read(&slub_lock);
+	}
+	schedule_delayed_work(to_delayed_work(w),
+			      round_jiffies_relative(REMOTE_FREE_TIMEOUT));
+}
+
+static void __cpuinit start_drain_work(int cpu)
+{
+	struct delayed_work *work = &per_cpu(slab_drain_work, cpu);
+
+	if (keventd_up() && work->work.func == NULL) {
+		INIT_DELAYED_WORK(work, drain_remote_frees);
+		schedule_delayed_work_on(cpu, work,
+				__round_jiffies_relative(REMOTE_FREE_TIMEOUT, cpu));
+	}
+}
+
 /*
  * Fastpath with forced inlining to produce a kfree and kmem_cache_free that
  * can perform fastpath freeing without additional function calls.
@@ -1844,8 +1962,9 @@ debug:
  * of this processor. This typically the case if we have just allocated
  * the item before.
  *
- * If fastpath is not possible then fall back to __slab_free where we deal
- * with all sorts of special processing.
+ * If fastpath is not possible then fall back to slab_free_remote which
+ * queues the object for its slab, or to __slab_free where we deal with
+ * all sorts of special processing.
  */
 static __always_inline void slab_free(struct kmem_cache *s,
 			struct page *page, void *x, unsigned long addr)
@@ -1865,8 +1984,10 @@ static __always_inline void slab_free(struct kmem_cache *s,
 		set_freepointer(s, object, c->freelist);
 		c->freelist = object;
 		stat(s, FREE_FASTPATH);
-	} else
-		__slab_free(s, page, x, addr);
+	} else if (page != c->page)
+		slab_free_remote(s, c, page, x, addr);
+	else
+		__slab_free(s, page, x, x, 1, addr);
 
 	local_irq_restore(flags);
 }
@@ -3156,6 +3277,16 @@ void __init kmem_cache_init_late(void)
 {
 }
 
+static int __init slab_drain_init(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		start_drain_work(cpu);
+	return 0;
+}
+__initcall(slab_drain_init);
+
 /*
  * Find a mergeable slab cache
  */
@@ -3287,6 +3418,17 @@ static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
 	unsigned long flags;
 
 	switch (action) {
+	case CPU_ONLINE:
+	case CPU_ONLINE_FROZEN:
+	case CPU_DOWN_FAILED:
+	case CPU_DOWN_FAILED_FROZEN:
+		start_drain_work(cpu);
+		break;
+	case CPU_DOWN_PREPARE:
+	case CPU_DOWN_PREPARE_FROZEN:
+		cancel_rearming_delayed_work(&per_cpu(slab_drain_work, cpu));
+		per_cpu(slab_drain_work, cpu).work.func = NULL;
+		break;
 	case CPU_UP_CANCELED:
 	case CPU_UP_CANCELED_FROZEN:
 	case CPU_DEAD:
@@ -4282,6 +4424,8 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(FREE_REMOTE_QUEUED, free_remote_queued);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4336,6 +4480,8 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&free_remote_queued_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -23,7 +23,6 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/mm_inline.h>
-#include <linux/buffer_head.h>	/* for try_to_release_page() */
 #include <linux/percpu_counter.h>
 #include <linux/percpu.h>
 #include <linux/cpu.h>
@@ -37,8 +36,54 @@
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster;
 
-static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
-static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
+/*
+ * Pages are added to the LRU lists and rotated to the tail of the inactive
+ * list in per-cpu batches, to amortise zone->lru_lock.  A batch is flushed
+ * once it holds PAGEVEC_SIZE + extra pages: extra grows whenever a flush
+ * finds the lru_lock contended and decays while it is not, so that under
+ * heavy page cache churn on many CPUs every lock round trip moves more
+ * pages, while an idle system keeps pages off the LRU no longer than
+ * before.
+ */
+#define LRU_BATCH_MAX	(PAGEVEC_SIZE * 8)
+
+struct lru_batch {
+	unsigned int nr;
+	unsigned int extra;
+	struct page *pages[LRU_BATCH_MAX];
+};
+
+static DEFINE_PER_CPU(struct lru_batch[NR_LRU_LISTS], lru_add_batches);
+static DEFINE_PER_CPU(struct lru_batch, lru_rotate_batch);
+
+/* Returns true if the batch has to be flushed after adding @page */
+static inline bool lru_batch_add(struct lru_batch *batch, struct page *page)
+{
+	batch->pages[batch->nr++] = page;
+	return batch->nr >= PAGEVEC_SIZE + batch->extra;
+}
+
+static void lru_batch_adapt(struct lru_batch *batch, bool contended)
+{
+	if (contended)
+		batch->extra = min_t(unsigned int,
+				     2 * (PAGEVEC_SIZE + batch->extra),
+				     LRU_BATCH_MAX) - PAGEVEC_SIZE;
+	else
+		batch->extra = batch->extra * 7 / 8;
+}
+
+/*
+ * Take @zone's lru_lock with interrupts already disabled, noting in
+ * @contended whether we had to wait for it.
+ */
+static inline void lru_lock_note_contention(struct zone *zone, bool *contended)
+{
+	if (!spin_trylock(&zone->lru_lock)) {
+		*contended = true;
+		spin_lock(&zone->lru_lock);
+	}
+}
 
 /*
  * This path almost never happens for VM activity - pages are normally
@@ -99,24 +144,25 @@ void put_pages_list(struct list_head *pages)
 EXPORT_SYMBOL(put_pages_list);
 
 /*
- * pagevec_move_tail() must be called with IRQ disabled.
+ * lru_batch_move_tail() must be called with IRQ disabled.
  * Otherwise this may cause nasty races.
  */
-static void pagevec_move_tail(struct pagevec *pvec)
+static void lru_batch_move_tail(struct lru_batch *batch)
 {
 	int i;
 	int pgmoved = 0;
 	struct zone *zone = NULL;
+	bool contended = false;
 
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
+	for (i = 0; i < batch->nr; i++) {
+		struct page *page = batch->pages[i];
 		struct zone *pagezone = page_zone(page);
 
 		if (pagezone != zone) {
 			if (zone)
 				spin_unlock(&zone->lru_lock);
 			zone = pagezone;
-			spin_lock(&zone->lru_lock);
+			lru_lock_note_contention(zone, &contended);
 		}
 		if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 			int lru = page_lru_base_type(page);
@@ -127,8 +173,9 @@ static void pagevec_move_tail(struct pagevec *pvec)
 	if (zone)
 		spin_unlock(&zone->lru_lock);
 	__count_vm_events(PGROTATED, pgmoved);
-	release_pages(pvec->pages, pvec->nr, pvec->cold);
-	pagevec_reinit(pvec);
+	release_pages(batch->pages, batch->nr, 0);
+	batch->nr = 0;
+	lru_batch_adapt(batch, contended);
 }
 
 /*
@@ -140,14 +187,14 @@ void  rotate_reclaimable_page(struct page *page)
 {
 	if (!PageLocked(page) && !PageDirty(page) && !PageActive(page) &&
 	    !PageUnevictable(page) && PageLRU(page)) {
-		struct pagevec *pvec;
+		struct lru_batch *batch;
 		unsigned long flags;
 
 		page_cache_get(page);
 		local_irq_save(flags);
-		pvec = &__get_cpu_var(lru_rotate_pvecs);
-		if (!pagevec_add(pvec, page))
-			pagevec_move_tail(pvec);
+		batch = &__get_cpu_var(lru_rotate_batch);
+		if (lru_batch_add(batch, page))
+			lru_batch_move_tail(batch);
 		local_irq_restore(flags);
 	}
 }
@@ -215,14 +262,67 @@ void mark_page_accessed(struct page *page)
 
 EXPORT_SYMBOL(mark_page_accessed);
 
+/*
+ * Add @nr pages to the @lru list of their zones.  Returns true if some
+ * zone's lru_lock was contended.
+ */
+static bool __lru_add_pages(struct page **pages, int nr, enum lru_list lru)
+{
+	int i;
+	struct zone *zone = NULL;
+	bool contended = false;
+
+	VM_BUG_ON(is_unevictable_lru(lru));
+
+	local_irq_disable();
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		struct zone *pagezone = page_zone(page);
+		int file;
+		int active;
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock(&zone->lru_lock);
+			zone = pagezone;
+			lru_lock_note_contention(zone, &contended);
+		}
+		VM_BUG_ON(PageActive(page));
+		VM_BUG_ON(PageUnevictable(page));
+		VM_BUG_ON(PageLRU(page));
+		SetPageLRU(page);
+		active = is_active_lru(lru);
+		file = is_file_lru(lru);
+		if (active)
+			SetPageActive(page);
+		update_page_reclaim_stat(zone, page, file, active);
+		add_page_to_lru_list(zone, page, lru);
+	}
+	if (zone)
+		spin_unlock(&zone->lru_lock);
+	local_irq_enable();
+
+	return contended;
+}
+
+static void lru_batch_add_flush(struct lru_batch *batch, enum lru_list lru)
+{
+	bool contended;
+
+	contended = __lru_add_pages(batch->pages, batch->nr, lru);
+	release_pages(batch->pages, batch->nr, 0);
+	batch->nr = 0;
+	lru_batch_adapt(batch, contended);
+}
+
 void __lru_cache_add(struct page *page, enum lru_list lru)
 {
-	struct pagevec *pvec = &get_cpu_var(lru_add_pvecs)[lru];
+	struct lru_batch *batch = &get_cpu_var(lru_add_batches)[lru];
 
 	page_cache_get(page);
-	if (!pagevec_add(pvec, page))
-		____pagevec_lru_add(pvec, lru);
-	put_cpu_var(lru_add_pvecs);
+	if (lru_batch_add(batch, page))
+		lru_batch_add_flush(batch, lru);
+	put_cpu_var(lru_add_batches);
 }
 
 /**
@@ -266,36 +366,36 @@ void add_page_to_unevictable_list(struct page *page)
 }
 
 /*
- * Drain pages out of the cpu's pagevecs.
+ * Drain pages out of the cpu's LRU batches.
  * Either "cpu" is the current CPU, and preemption has already been
  * disabled; or "cpu" is being hot-unplugged, and is already dead.
  */
-static void drain_cpu_pagevecs(int cpu)
+static void drain_cpu_lru_batches(int cpu)
 {
-	struct pagevec *pvecs = per_cpu(lru_add_pvecs, cpu);
-	struct pagevec *pvec;
+	struct lru_batch *batches = per_cpu(lru_add_batches, cpu);
+	struct lru_batch *batch;
 	int lru;
 
 	for_each_lru(lru) {
-		pvec = &pvecs[lru - LRU_BASE];
-		if (pagevec_count(pvec))
-			____pagevec_lru_add(pvec, lru);
+		batch = &batches[lru - LRU_BASE];
+		if (batch->nr)
+			lru_batch_add_flush(batch, lru);
 	}
 
-	pvec = &per_cpu(lru_rotate_pvecs, cpu);
-	if (pagevec_count(pvec)) {
+	batch = &per_cpu(lru_rotate_batch, cpu);
+	if (batch->nr) {
 		unsigned long flags;
 
 		/* No harm done if a racing interrupt already did this */
 		local_irq_save(flags);
-		pagevec_move_tail(pvec);
+		lru_batch_move_tail(batch);
 		local_irq_restore(flags);
 	}
 }
 
 void lru_add_drain(void)
 {
-	drain_cpu_pagevecs(get_cpu());
+	drain_cpu_lru_batches(get_cpu());
 	put_cpu();
 }
 
@@ -403,60 +503,13 @@ EXPORT_SYMBOL(__pagevec_release);
  */
 void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 {
-	int i;
-	struct zone *zone = NULL;
-
-	VM_BUG_ON(is_unevictable_lru(lru));
-
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
-		int file;
-		int active;
-
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		VM_BUG_ON(PageActive(page));
-		VM_BUG_ON(PageUnevictable(page));
-		VM_BUG_ON(PageLRU(page));
-		SetPageLRU(page);
-		active = is_active_lru(lru);
-		file = is_file_lru(lru);
-		if (active)
-			SetPageActive(page);
-		update_page_reclaim_stat(zone, page, file, active);
-		add_page_to_lru_list(zone, page, lru);
-	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+	__lru_add_pages(pvec->pages, pagevec_count(pvec), lru);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
 }
 
 EXPORT_SYMBOL(____pagevec_lru_add);
 
-/*
- * Try to drop buffers from the pages in a pagevec
- */
-void pagevec_strip(struct pagevec *pvec)
-{
-	int i;
-
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
-
-		if (page_has_private(page) && trylock_page(page)) {
-			if (page_has_private(page))
-				try_to_release_page(page, 0);
-			unlock_page(page);
-		}
-	}
-}
-
 /**
  * pagevec_lookup - gang pagecache lookup
  * @pvec:	Where the resulting pages are placed
@@ -45,6 +45,7 @@
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
+#include <linux/huge_mm.h>
 
 #include "internal.h"
 
@@ -839,11 +840,6 @@ keep:
 	return nr_reclaimed;
 }
 
-/* LRU Isolation modes. */
-#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
-#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
-#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
-
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -1117,6 +1113,42 @@ static int too_many_isolated(struct zone *zone, int file,
 	return isolated > inactive;
 }
 
+/*
+ * Drop the isolation reference on a page that has just been put back on
+ * @lru, with zone->lru_lock held.  Should that have been the last
+ * reference, the page is taken off the LRU again and queued on
+ * @pages_to_free, to be freed by free_page_list() once the lock is
+ * released.  This lets reclaim put back a whole detached batch in one
+ * lock hold, instead of dropping the lock every few pages to release them.
+ */
+static void release_isolated_page_locked(struct zone *zone, struct page *page,
+				enum lru_list lru, struct list_head *pages_to_free)
+{
+	if (!put_page_testzero(page))
+		return;
+
+	__ClearPageLRU(page);
+	__ClearPageActive(page);
+	del_page_from_lru_list(zone, page, lru);
+
+	if (unlikely(PageCompound(page))) {
+		spin_unlock_irq(&zone->lru_lock);
+		(*get_compound_page_dtor(page))(page);
+		spin_lock_irq(&zone->lru_lock);
+	} else
+		list_add(&page->lru, pages_to_free);
+}
+
+static void free_page_list(struct list_head *pages_to_free)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, pages_to_free, lru) {
+		list_del(&page->lru);
+		free_hot_cold_page(page, 1);
+	}
+}
+
 /*
  * shrink_inactive_list() is a helper for shrink_zone().  It returns the number
  * of reclaimed pages
@@ -1126,7 +1158,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			int priority, int file)
 {
 	LIST_HEAD(page_list);
-	struct pagevec pvec;
+	LIST_HEAD(pages_to_free);
 	unsigned long nr_scanned = 0;
 	unsigned long nr_reclaimed = 0;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
@@ -1152,8 +1184,6 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 	else if (sc->order && priority < DEF_PRIORITY - 2)
 		lumpy_reclaim = 1;
 
-	pagevec_init(&pvec, 1);
-
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
 	do {
@@ -1259,11 +1289,8 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 				int file = is_file_lru(lru);
 				reclaim_stat->recent_rotated[file]++;
 			}
-			if (!pagevec_add(&pvec, page)) {
-				spin_unlock_irq(&zone->lru_lock);
-				__pagevec_release(&pvec);
-				spin_lock_irq(&zone->lru_lock);
-			}
+			release_isolated_page_locked(zone, page, lru,
+						     &pages_to_free);
 		}
 		__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 		__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
@@ -1272,7 +1299,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 
 done:
 	spin_unlock_irq(&zone->lru_lock);
-	pagevec_release(&pvec);
+	free_page_list(&pages_to_free);
 	return nr_reclaimed;
 }
 
@@ -1310,14 +1337,12 @@ static inline void note_zone_scanning_priority(struct zone *zone, int priority)
 
 static void move_active_pages_to_lru(struct zone *zone,
 				     struct list_head *list,
+				     struct list_head *pages_to_free,
 				     enum lru_list lru)
 {
 	unsigned long pgmoved = 0;
-	struct pagevec pvec;
 	struct page *page;
 
-	pagevec_init(&pvec, 1);
-
 	while (!list_empty(list)) {
 		page = lru_to_page(list);
 
@@ -1328,13 +1353,7 @@ static void move_active_pages_to_lru(struct zone *zone,
 		mem_cgroup_add_lru_list(page, lru);
 		pgmoved++;
 
-		if (!pagevec_add(&pvec, page) || list_empty(list)) {
-			spin_unlock_irq(&zone->lru_lock);
-			if (buffer_heads_over_limit)
-				pagevec_strip(&pvec);
-			__pagevec_release(&pvec);
-			spin_lock_irq(&zone->lru_lock);
-		}
+		release_isolated_page_locked(zone, page, lru, pages_to_free);
 	}
 	__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 	if (!is_active_lru(lru))
@@ -1350,6 +1369,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	LIST_HEAD(l_hold);	/* The pages which were snipped off */
 	LIST_HEAD(l_active);
 	LIST_HEAD(l_inactive);
+	LIST_HEAD(pages_to_free);
 	struct page *page;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
 	unsigned long nr_rotated = 0;
@@ -1405,6 +1425,14 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 
 		ClearPageActive(page);	/* we are de-activating */
 		list_add(&page->lru, &l_inactive);
+
+		/* Strip buffers while the page is still off the LRU */
+		if (buffer_heads_over_limit && page_has_private(page) &&
+		    trylock_page(page)) {
+			if (page_has_private(page))
+				try_to_release_page(page, 0);
+			unlock_page(page);
+		}
 	}
 
 	/*
@@ -1419,12 +1447,14 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	 */
 	reclaim_stat->recent_rotated[file] += nr_rotated;
 
-	move_active_pages_to_lru(zone, &l_active,
+	move_active_pages_to_lru(zone, &l_active, &pages_to_free,
 						LRU_ACTIVE + file * LRU_FILE);
-	move_active_pages_to_lru(zone, &l_inactive,
+	move_active_pages_to_lru(zone, &l_inactive, &pages_to_free,
 						LRU_BASE   + file * LRU_FILE);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
 	spin_unlock_irq(&zone->lru_lock);
+
+	free_page_list(&pages_to_free);
 }
 
 static int inactive_anon_is_low_global(struct zone *zone)
@@ -1655,6 +1685,26 @@ static void shrink_zone(int priority, struct zone *zone,
 					  &reclaim_stat->nr_saved_scan[l]);
 	}
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/*
+	 * Transparent huge pages are not on the LRU.  Put the same
+	 * pressure on them as on the anon LRU by splitting them, so
+	 * that the small pages can be aged and swapped.  Cgroup reclaim
+	 * only splits the huge pages charged to the cgroup, of which
+	 * the zone count is an upper bound.
+	 */
+	if (!noswap) {
+		unsigned long huge = zone_page_state(zone,
+					NR_ANON_TRANSPARENT_HUGEPAGES) *
+					HPAGE_PMD_NR;
+
+		huge = ((huge >> priority) * percent[0]) / 100;
+		if (huge >= HPAGE_PMD_NR)
+			split_huge_pages_zone(zone, huge / HPAGE_PMD_NR,
+					      sc->mem_cgroup);
+	}
+#endif
+
 	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
 					nr[LRU_INACTIVE_FILE]) {
 		for_each_evictable_lru(l) {
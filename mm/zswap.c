@@ -0,0 +1,559 @@
+/*
+ * zswap - compressed cache for swap pages
+ *
+ * Pages on their way out to swap are compressed with LZO and kept in a
+ * RAM pool instead of being written to the swap device.  Swap-in of such
+ * a page decompresses it from the pool, so for compressible workloads
+ * most swap I/O disappears.  The pool is bounded (max_pool_percent of
+ * RAM); when it fills up, the least recently used compressed pages are
+ * decompressed into the swap cache and written to the real swap device,
+ * and only if that fails is the new page sent to disk directly.
+ *
+ * Compressed pages live in a per swap device rbtree indexed by swap
+ * offset, and on a per device LRU list.  An entry stays in the pool for
+ * as long as its swap slot is in use, so that a clean swap cache page
+ * can be dropped by reclaim without any further I/O; it is freed when
+ * the swap slot is freed.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <linux/zswap.h>
+
+/*
+ * Compressed pages are allocated from size classes 1/16th of a page
+ * apart, which wastes far less than rounding up to a power of two.
+ * Pages that do not compress to 3/4 of a page or less go to disk.
+ */
+#define ZSWAP_CLASS_SHIFT	(PAGE_SHIFT - 4)
+#define ZSWAP_NR_CLASSES	12
+#define ZSWAP_MAX_COMPRESSED	(ZSWAP_NR_CLASSES << ZSWAP_CLASS_SHIFT)
+
+/* How many LRU entries one store may write back to make room */
+#define ZSWAP_WRITEBACK_BATCH	16
+
+/* Allocations are made from reclaim context: do not sleep or dip into reserves */
+#define ZSWAP_GFP	(__GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
+
+/* Enable/disable storing new pages in zswap */
+static int zswap_enabled = 1;
+module_param_named(enabled, zswap_enabled, bool, 0644);
+
+/* The maximum percentage of memory the compressed pool may use */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;	/* compressed length */
+	u8 class;		/* index into zswap_class_cache */
+	u8 *data;
+};
+
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;	/* least recently used first */
+	spinlock_t lock;
+	unsigned type;
+};
+
+static struct zswap_tree zswap_trees[MAX_SWAPFILES];
+
+static struct kmem_cache *zswap_entry_cache;
+static struct kmem_cache *zswap_class_cache[ZSWAP_NR_CLASSES];
+static char zswap_class_name[ZSWAP_NR_CLASSES][16];
+
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+
+/* Pool size, in pages stored and in bytes of size class objects used */
+static atomic_long_t zswap_stored_pages = ATOMIC_LONG_INIT(0);
+static atomic_long_t zswap_pool_total_size = ATOMIC_LONG_INIT(0);
+
+/*
+ * Statistics, exported through debugfs.  These are updated without
+ * locking and may be slightly off.
+ */
+static u64 zswap_load_hits;
+static u64 zswap_load_misses;
+static u64 zswap_pool_limit_hit;
+static u64 zswap_written_back_pages;
+static u64 zswap_writeback_skipped;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_duplicate_entry;
+
+/*
+ * rbtree and refcount helpers, called with tree->lock held.  The tree
+ * holds one reference on each entry it contains; lookups that drop the
+ * lock take another so the entry survives a concurrent invalidate.
+ */
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Insert @entry, returning -EEXIST and the entry already at that
+ * offset in @dupentry if there is one.
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	kmem_cache_free(zswap_class_cache[entry->class], entry->data);
+	atomic_long_sub((long)(entry->class + 1) << ZSWAP_CLASS_SHIFT,
+			&zswap_pool_total_size);
+	atomic_long_dec(&zswap_stored_pages);
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+static void zswap_entry_put(struct zswap_entry *entry)
+{
+	VM_BUG_ON(entry->refcount <= 0);
+	if (--entry->refcount == 0)
+		zswap_free_entry(entry);
+}
+
+/* Remove @entry from its tree and LRU and drop the tree's reference */
+static void zswap_erase(struct zswap_tree *tree, struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	RB_CLEAR_NODE(&entry->rbnode);
+	list_del_init(&entry->lru);
+	zswap_entry_put(entry);
+}
+
+static bool zswap_is_full(void)
+{
+	unsigned long limit = totalram_pages * zswap_max_pool_percent / 100;
+
+	return (atomic_long_read(&zswap_pool_total_size) >> PAGE_SHIFT) > limit;
+}
+
+/*
+ * Write the compressed page of @entry back to the swap device: bring it
+ * into the swap cache (zswap_load() decompresses it there), drop it from
+ * the pool and start the write.  The entry must hold a reference taken
+ * by the caller.
+ */
+static int zswap_writeback_entry(struct zswap_tree *tree,
+				struct zswap_entry *entry)
+{
+	swp_entry_t swpentry = swp_entry(tree->type, entry->offset);
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct page *page;
+	int ret = -EBUSY;
+
+	/*
+	 * A page already in the swap cache is either in use or about to be
+	 * stored again by reclaim: leave it alone.
+	 */
+	page = find_get_page(&swapper_space, swpentry.val);
+	if (page) {
+		page_cache_release(page);
+		return -EEXIST;
+	}
+
+	page = read_swap_cache_async(swpentry, GFP_NOIO | ZSWAP_GFP, NULL, 0);
+	if (!page)
+		return -ENOMEM;
+
+	/*
+	 * Only trylock: our caller holds the lock on the page it is storing,
+	 * and another storer may hold this one while waiting for ours.
+	 */
+	if (!trylock_page(page))
+		goto out;
+
+	if (!PageSwapCache(page) || page_private(page) != swpentry.val ||
+	    !PageUptodate(page) || PageWriteback(page)) {
+		unlock_page(page);
+		goto out;
+	}
+
+	/* The entry may have been invalidated or replaced meanwhile */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, entry->offset) == entry) {
+		zswap_erase(tree, entry);
+		ret = 0;
+	}
+	spin_unlock(&tree->lock);
+
+	if (ret) {
+		unlock_page(page);
+		goto out;
+	}
+
+	/* Have the page rotated for reclaim once the write completes */
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);
+	zswap_written_back_pages++;
+out:
+	page_cache_release(page);
+	return ret;
+}
+
+/* Write back the least recently used entry of @tree */
+static int zswap_writeback_lru(struct zswap_tree *tree)
+{
+	struct zswap_entry *entry;
+	int ret;
+
+	spin_lock(&tree->lock);
+	if (list_empty(&tree->lru)) {
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	entry = list_first_entry(&tree->lru, struct zswap_entry, lru);
+	/* Take it off the LRU while we work on it, so nobody else picks it */
+	list_del_init(&entry->lru);
+	entry->refcount++;
+	spin_unlock(&tree->lock);
+
+	ret = zswap_writeback_entry(tree, entry);
+
+	spin_lock(&tree->lock);
+	if (ret) {
+		zswap_writeback_skipped++;
+		/* Still in the tree? Put it back as most recently used. */
+		if (!RB_EMPTY_NODE(&entry->rbnode) && list_empty(&entry->lru))
+			list_add_tail(&entry->lru, &tree->lru);
+	}
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * zswap_store - compress a page into the pool instead of writing it
+ * @page: locked swap cache page about to be written out
+ *
+ * Returns 0 if the page was stored, in which case the caller must not
+ * write it to the swap device, or a negative errno if it has to go to
+ * disk as usual.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swpentry = { .val = page_private(page) };
+	struct zswap_tree *tree = &zswap_trees[swp_type(swpentry)];
+	struct zswap_entry *entry, *dupentry;
+	size_t dlen;
+	u8 *src, *dst;
+	int class, ret, i;
+
+	if (!zswap_enabled) {
+		ret = -EPERM;
+		goto reject;
+	}
+
+	/* Make room by writing back the oldest compressed pages */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		for (i = 0; i < ZSWAP_WRITEBACK_BATCH && zswap_is_full(); i++)
+			if (zswap_writeback_lru(tree) == -ENOENT)
+				break;
+		if (zswap_is_full()) {
+			ret = -ENOMEM;
+			goto reject;
+		}
+	}
+
+	entry = kmem_cache_alloc(zswap_entry_cache, ZSWAP_GFP);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	/* Compress into the per-cpu buffer */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+				__get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+
+	if (ret != LZO_E_OK || dlen > ZSWAP_MAX_COMPRESSED) {
+		zswap_reject_compress_poor++;
+		ret = -EINVAL;
+		goto put_dstmem;
+	}
+
+	/* Copy it into the pool */
+	class = (dlen - 1) >> ZSWAP_CLASS_SHIFT;
+	entry->data = kmem_cache_alloc(zswap_class_cache[class], ZSWAP_GFP);
+	if (!entry->data) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto put_dstmem;
+	}
+	memcpy(entry->data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	entry->offset = swp_offset(swpentry);
+	entry->length = dlen;
+	entry->class = class;
+	entry->refcount = 1;
+	atomic_long_inc(&zswap_stored_pages);
+	atomic_long_add((long)(class + 1) << ZSWAP_CLASS_SHIFT,
+			&zswap_pool_total_size);
+
+	/*
+	 * A page that was loaded and dirtied again is stored under the same
+	 * offset: the old copy is stale.
+	 */
+	spin_lock(&tree->lock);
+	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		zswap_erase(tree, dupentry);
+	}
+	list_add_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+put_dstmem:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+reject:
+	/*
+	 * The page goes to disk: a copy stored before it was loaded and
+	 * dirtied again would be stale now.
+	 */
+	zswap_invalidate_page(swp_type(swpentry), swp_offset(swpentry));
+	return ret;
+}
+
+/**
+ * zswap_load - fill a page from the pool
+ * @page: locked swap cache page to be read
+ *
+ * Returns 0 if the page was found in the pool and decompressed into
+ * @page, or -ENOENT if it must be read from the swap device.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swpentry = { .val = page_private(page) };
+	struct zswap_tree *tree = &zswap_trees[swp_type(swpentry)];
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, swp_offset(swpentry));
+	if (!entry) {
+		spin_unlock(&tree->lock);
+		zswap_load_misses++;
+		return -ENOENT;
+	}
+	entry->refcount++;
+	/* Count the access: it is now the most recently used entry */
+	if (!list_empty(&entry->lru))
+		list_move_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	zswap_load_hits++;
+	return 0;
+}
+
+/**
+ * zswap_invalidate_page - drop the compressed copy of a freed swap slot
+ * @type: swap device
+ * @offset: swap slot offset
+ */
+void zswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = &zswap_trees[type];
+	struct zswap_entry *entry;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		zswap_erase(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/**
+ * zswap_invalidate_area - drop all compressed pages of a swap device
+ * @type: swap device being switched off
+ */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = &zswap_trees[type];
+	struct rb_node *node;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot)))
+		zswap_erase(tree, rb_entry(node, struct zswap_entry, rbnode));
+	spin_unlock(&tree->lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_pool_total_size_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_total_size);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_total_size_fops, zswap_pool_total_size_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("zswap", NULL);
+	if (!root)
+		return -ENOMEM;
+
+	debugfs_create_file("stored_pages", S_IRUGO, root, NULL,
+			&zswap_stored_pages_fops);
+	debugfs_create_file("pool_total_size", S_IRUGO, root, NULL,
+			&zswap_pool_total_size_fops);
+	debugfs_create_u64("load_hits", S_IRUGO, root, &zswap_load_hits);
+	debugfs_create_u64("load_misses", S_IRUGO, root, &zswap_load_misses);
+	debugfs_create_u64("pool_limit_hit", S_IRUGO, root,
+			&zswap_pool_limit_hit);
+	debugfs_create_u64("written_back_pages", S_IRUGO, root,
+			&zswap_written_back_pages);
+	debugfs_create_u64("writeback_skipped", S_IRUGO, root,
+			&zswap_writeback_skipped);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO, root,
+			&zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO, root,
+			&zswap_reject_alloc_fail);
+	debugfs_create_u64("duplicate_entry", S_IRUGO, root,
+			&zswap_duplicate_entry);
+	return 0;
+}
+#else
+static inline int zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif /* CONFIG_DEBUG_FS */
+
+static int __init zswap_init(void)
+{
+	int cpu, i;
+
+	for (i = 0; i < MAX_SWAPFILES; i++) {
+		zswap_trees[i].rbroot = RB_ROOT;
+		INIT_LIST_HEAD(&zswap_trees[i].lru);
+		spin_lock_init(&zswap_trees[i].lock);
+		zswap_trees[i].type = i;
+	}
+
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache)
+		goto fail;
+
+	for (i = 0; i < ZSWAP_NR_CLASSES; i++) {
+		snprintf(zswap_class_name[i], sizeof(zswap_class_name[i]),
+			 "zswap-%lu", (unsigned long)(i + 1) << ZSWAP_CLASS_SHIFT);
+		zswap_class_cache[i] = kmem_cache_create(zswap_class_name[i],
+				(i + 1) << ZSWAP_CLASS_SHIFT, 0, 0, NULL);
+		if (!zswap_class_cache[i])
+			goto fail;
+	}
+
+	for_each_possible_cpu(cpu) {
+		u8 *dst = kmalloc_node(PAGE_SIZE * 2, GFP_KERNEL,
+					cpu_to_node(cpu));
+		void *wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_wrkmem, cpu) = wrkmem;
+		if (!dst || !wrkmem)
+			goto fail;
+	}
+
+	zswap_debugfs_init();
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_dstmem, cpu));
+		vfree(per_cpu(zswap_wrkmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+	}
+	for (i = 0; i < ZSWAP_NR_CLASSES; i++)
+		if (zswap_class_cache[i])
+			kmem_cache_destroy(zswap_class_cache[i]);
+	if (zswap_entry_cache)
+		kmem_cache_destroy(zswap_entry_cache);
+	zswap_enabled = 0;
+	printk(KERN_ERR "zswap: initialization failed, disabled\n");
+	return -ENOMEM;
+}
+late_initcall(zswap_init);
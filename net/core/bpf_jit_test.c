@@ -0,0 +1,474 @@
+/*
+ * BPF JIT self test module
+ *
+ * Runs a corpus of socket filters over a crafted TCP/IPv4 packet, both
+ * through sk_run_filter() and through the code generated by the JIT, and
+ * checks that the two agree with each other and with the expected result.
+ * Filters are compiled only when net.core.bpf_jit_enable is set, so set it
+ * before loading the module.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#define MAX_INSNS	80
+
+/* ethernet + ipv4 + tcp, 10.0.0.1:4660 -> 10.0.0.2:22, SYN */
+static const u8 test_packet[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+	/* ip, offset 14 */
+	0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00,
+	0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+	0x0a, 0x00, 0x00, 0x02,
+	/* tcp, offset 34 */
+	0x12, 0x34, 0x00, 0x16, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x20, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+#define TEST_MARK	0x1234
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	unsigned int len;
+	/* bytes of the packet in the linear area, 0 for all of them */
+	unsigned int headlen;
+	unsigned int result;
+	/* builds insns at run time when set */
+	void (*fill)(struct bpf_test *test);
+};
+
+/* ld #0; jeq #0 over a run of "add #1" : needs 32bit jump offsets */
+static void bpf_fill_far_jump(struct bpf_test *test)
+{
+	struct sock_filter *insn = test->insns;
+	int i;
+
+	*insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_IMM, 0);
+	*insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0,
+					       0, MAX_INSNS - 4);
+	for (i = 0; i < MAX_INSNS - 5; i++)
+		*insn++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1);
+	*insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	*insn++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1000);
+	*insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	test->len = insn - test->insns;
+}
+
+/* tcpdump -d "tcp dst port 22" */
+#define TCP_DST_PORT_22 {					\
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),			\
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),	\
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),			\
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 6),		\
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),			\
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),	\
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),		\
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),			\
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 22, 0, 1),		\
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),			\
+	BPF_STMT(BPF_RET | BPF_K, 0),				\
+}
+
+static struct bpf_test tests[] = {
+	{
+		.descr = "RET_K",
+		.insns = {
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		},
+		.len = 1,
+		.result = 0xffff,
+	},
+	{
+		.descr = "LD_LEN",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 2,
+		.result = sizeof(test_packet),
+	},
+	{
+		.descr = "LDX_LEN TXA",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 3,
+		.result = sizeof(test_packet),
+	},
+	{
+		.descr = "tcpdump ip",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.len = 4,
+		.result = 0xffff,
+	},
+	{
+		.descr = "tcpdump tcp dst port 22",
+		.insns = TCP_DST_PORT_22,
+		.len = 11,
+		.result = 0xffff,
+	},
+	{
+		.descr = "tcpdump tcp dst port 22, nonlinear",
+		.insns = TCP_DST_PORT_22,
+		.len = 11,
+		.headlen = 20,
+		.result = 0xffff,
+	},
+	{
+		.descr = "ALU",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 5),
+			BPF_STMT(BPF_LDX | BPF_IMM, 3),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 1),
+			BPF_STMT(BPF_LDX | BPF_IMM, 4),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xff),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0x100),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+			BPF_STMT(BPF_ALU | BPF_NEG, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 13,
+		.result = 0xfffffdea,
+	},
+	{
+		.descr = "ALU with X and large constants",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0x12345678),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0x1000),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x10001),
+			BPF_STMT(BPF_LDX | BPF_IMM, 4),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffffff0f),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 0x10000),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 13,
+		.result = 0xffff0004,
+	},
+	{
+		.descr = "DIV_X by zero",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.len = 4,
+		.result = 0,
+	},
+	{
+		.descr = "scratch memory",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0x11),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0x22),
+			BPF_STMT(BPF_ST, 15),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_STX, 7),
+			BPF_STMT(BPF_LD | BPF_MEM, 15),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_MEM, 7),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 11,
+		.result = 0x44,
+	},
+	{
+		.descr = "conditional jumps",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 20),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 10, 0, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 20, 0, 4),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 4, 0, 3),
+			BPF_STMT(BPF_LDX | BPF_IMM, 20),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.len = 8,
+		.result = 1,
+	},
+	{
+		.descr = "conditional jumps on X",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0x300),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x200),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, 3),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 0, 2),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x10000, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.len = 9,
+		.result = 2,
+	},
+	{
+		.descr = "JA",
+		.insns = {
+			BPF_STMT(BPF_JMP | BPF_JA, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+		},
+		.len = 3,
+		.result = 2,
+	},
+	{
+		.descr = "far jumps",
+		.fill = bpf_fill_far_jump,
+		.result = MAX_INSNS - 5,
+	},
+	{
+		.descr = "load beyond the packet",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(test_packet) - 2),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.len = 2,
+		.result = 0,
+	},
+	{
+		.descr = "load beyond the packet, nonlinear",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, sizeof(test_packet)),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.len = 2,
+		.headlen = 20,
+		.result = 0,
+	},
+	{
+		.descr = "indirect loads from frags",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 40),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 7),
+			BPF_STMT(BPF_ST, 1),
+			BPF_STMT(BPF_LD | BPF_W | BPF_IND, -2),
+			BPF_STMT(BPF_LDX | BPF_MEM, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 7,
+		.headlen = 40,
+		.result = 3,
+	},
+	{
+		.descr = "SKF_AD_PROTOCOL",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 2,
+		.result = ETH_P_IP,
+	},
+	{
+		.descr = "SKF_AD_MARK",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_MARK),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 2,
+		.result = TEST_MARK,
+	},
+	{
+		.descr = "SKF_AD_PKTTYPE (interpreter)",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 3,
+		.result = PACKET_HOST + 1,
+	},
+	{
+		.descr = "unknown ancillary offset",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_MAX),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.len = 2,
+		.result = 0,
+	},
+	{
+		.descr = "ancillary data through X",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, SKF_AD_OFF),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 3,
+		.result = ETH_P_IP,
+	},
+	{
+		.descr = "SKF_NET_OFF",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+			BPF_STMT(BPF_LDX | BPF_IMM, 16),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_LL_OFF + 12),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 7,
+		.result = 0x00060800,
+	},
+	{
+		.descr = "SKF_NET_OFF ldxb",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.len = 3,
+		.result = 20,
+	},
+};
+
+static struct sk_buff *populate_skb(const struct bpf_test *test)
+{
+	unsigned int headlen = test->headlen ? : sizeof(test_packet);
+	unsigned int rest = sizeof(test_packet) - headlen;
+	struct sk_buff *skb;
+	struct page *page;
+
+	skb = alloc_skb(sizeof(test_packet), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	memcpy(skb_put(skb, headlen), test_packet, headlen);
+	if (rest) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), test_packet + headlen, rest);
+		skb_fill_page_desc(skb, 0, page, 0, rest);
+		skb->len += rest;
+		skb->data_len += rest;
+		skb->truesize += rest;
+	}
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = PACKET_HOST;
+	skb->mark = TEST_MARK;
+	return skb;
+}
+
+static int run_one(struct bpf_test *test, int *jited)
+{
+	struct sk_filter *fp;
+	struct sk_buff *skb;
+	unsigned int ret, jit_ret;
+	int err;
+
+	if (test->fill)
+		test->fill(test);
+
+	fp = kzalloc(sizeof(*fp) + test->len * sizeof(struct sock_filter),
+		     GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	atomic_set(&fp->refcnt, 1);
+	fp->len = test->len;
+	memcpy(fp->insns, test->insns, test->len * sizeof(struct sock_filter));
+
+	err = sk_chk_filter(fp->insns, fp->len);
+	if (err) {
+		pr_err("bpf_jit_test: %s: filter rejected (%d)\n",
+		       test->descr, err);
+		goto out_filter;
+	}
+
+	skb = populate_skb(test);
+	if (!skb) {
+		err = -ENOMEM;
+		goto out_filter;
+	}
+
+	bpf_jit_compile(fp);
+	*jited = fp->bpf_func != NULL;
+
+	ret = sk_run_filter(skb, fp->insns, fp->len);
+	jit_ret = SK_RUN_FILTER(fp, skb);
+
+	if (ret != test->result) {
+		pr_err("bpf_jit_test: %s: interpreter returned %#x, expected %#x\n",
+		       test->descr, ret, test->result);
+		err = -EINVAL;
+	}
+	if (jit_ret != ret) {
+		pr_err("bpf_jit_test: %s: jit returned %#x, interpreter %#x\n",
+		       test->descr, jit_ret, ret);
+		err = -EINVAL;
+	}
+
+	kfree_skb(skb);
+	bpf_jit_free(fp);
+out_filter:
+	kfree(fp);
+	return err;
+}
+
+static int __init bpf_jit_test_init(void)
+{
+	int i, jited, nr_jited = 0, failed = 0;
+
+	if (!bpf_jit_enable)
+		pr_info("bpf_jit_test: net.core.bpf_jit_enable is off, "
+			"only checking the interpreter\n");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		jited = 0;
+		if (run_one(&tests[i], &jited))
+			failed++;
+		nr_jited += jited;
+	}
+
+	pr_info("bpf_jit_test: %d tests, %d compiled, %d failed\n",
+		(int)ARRAY_SIZE(tests), nr_jited, failed);
+
+	return failed ? -EINVAL : 0;
+}
+
+static void __exit bpf_jit_test_exit(void)
+{
+}
+
+module_init(bpf_jit_test_init);
+module_exit(bpf_jit_test_exit);
+MODULE_LICENSE("GPL");
@@ -53,6 +53,21 @@ static void *__load_pointer(struct sk_buff *skb, int k)
 	return NULL;
 }
 
+#ifdef CONFIG_BPF_JIT
+/*
+ * Negative offsets seen by the JIT load helpers. Ancillary data never gets
+ * here, the JIT either handles it inline or hands the packet back to
+ * sk_run_filter().
+ */
+void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+					  int k, unsigned int size)
+{
+	if (k >= SKF_AD_OFF)
+		return NULL;
+	return __load_pointer((struct sk_buff *)skb, k);
+}
+#endif
+
 static inline void *load_pointer(struct sk_buff *skb, int k,
 				 unsigned int size, void *buffer)
 {
@@ -89,8 +104,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -514,6 +528,9 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+#ifdef CONFIG_BPF_JIT
+	fp->bpf_func = NULL;
+#endif
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -521,6 +538,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference_bh(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -550,6 +550,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
 	new->skb_iif		= old->skb_iif;
+#ifdef CONFIG_RPS
+	new->rxhash		= old->rxhash;
+#endif
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
     defined(CONFIG_NETFILTER_XT_TARGET_TRACE_MODULE)
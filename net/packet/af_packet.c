@@ -158,9 +158,41 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+/*
+ * Kernel side state of a TPACKET_V3 receive ring. Packets are packed
+ * into the active block until it is full or the retire timer fires,
+ * then the whole block is handed to user space at once.
+ */
+struct tpacket_kbdq_core {
+	struct timer_list	retire_blk_timer;
+
+	char			*nxt_offset;	/* where the next packet goes */
+	char			*prev;		/* last packet in active block */
+
+	unsigned int		kactive_blk_num;
+	unsigned int		knum_blocks;
+	unsigned int		kblk_size;
+	unsigned int		max_frame_len;
+	unsigned int		blk_sizeof_priv;
+
+	unsigned int		retire_blk_tov;	/* msecs */
+	unsigned long		tov_in_jiffies;
+
+	u64			knxt_seq_num;
+
+	unsigned int		blk_open:1,	/* active block can be filled */
+				delete_blk_timer:1;
+};
+
+/* block retire timeout when user space does not ask for one, in msecs */
+#define PRB_DEFAULT_RETIRE_TOV	8
+
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(TPACKET3_BLKHDRLEN + TPACKET_ALIGN(sz_of_priv))
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -172,6 +204,8 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
+
 	atomic_t		pending;
 };
 
@@ -183,7 +217,7 @@ static void packet_flush_mclist(struct sock *sk);
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -308,6 +342,222 @@ static inline void packet_increment_head(struct packet_ring_buffer *buff)
 	buff->head = buff->head != buff->frame_max ? buff->head+1 : 0;
 }
 
+static void packet_flush_range(void *start, unsigned int len)
+{
+	struct page *p_start, *p_end;
+
+	p_start = virt_to_page(start);
+	p_end = virt_to_page(start + len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+}
+
+static inline struct tpacket_block_desc *prb_block(
+		struct packet_ring_buffer *rb, unsigned int n)
+{
+	return (struct tpacket_block_desc *)rb->pg_vec[n];
+}
+
+static inline struct tpacket_block_desc *prb_active_block(
+		struct packet_ring_buffer *rb)
+{
+	return prb_block(rb, rb->prb_bdqc.kactive_blk_num);
+}
+
+static void prb_open_block(struct packet_ring_buffer *rb,
+			   struct tpacket_block_desc *pbd)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = TPACKET3_BLKHDRLEN;
+
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->seq_num = pkc->knxt_seq_num++;
+	memset(&h1->ts_first_pkt, 0, sizeof(h1->ts_first_pkt));
+	memset(&h1->ts_last_pkt, 0, sizeof(h1->ts_last_pkt));
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = NULL;
+	pkc->blk_open = 1;
+
+	/* a block lives for at least one full timeout */
+	if (!pkc->delete_blk_timer)
+		mod_timer(&pkc->retire_blk_timer,
+			  jiffies + pkc->tov_in_jiffies);
+}
+
+/*
+ * Hand the active block over to user space and move on to the next one.
+ * Called with the receive queue lock held.
+ */
+static void prb_close_block(struct packet_ring_buffer *rb,
+			    struct tpacket_block_desc *pbd, int status)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	if (pkc->prev)
+		((struct tpacket3_hdr *)pkc->prev)->tp_next_offset = 0;
+
+	/* the packets have to be visible before the block status is */
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	packet_flush_range(pbd, h1->blk_len);
+
+	pkc->blk_open = 0;
+	pkc->kactive_blk_num = pkc->kactive_blk_num + 1 < pkc->knum_blocks ?
+			       pkc->kactive_blk_num + 1 : 0;
+}
+
+/*
+ * Open the block at kactive_blk_num unless user space still owns it, in
+ * which case the queue stays frozen and packets are dropped until it is
+ * handed back. Called with the receive queue lock held.
+ */
+static int prb_try_open_block(struct packet_ring_buffer *rb)
+{
+	struct tpacket_block_desc *pbd = prb_active_block(rb);
+
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	if (pbd->hdr.bh1.block_status & TP_STATUS_USER)
+		return 0;
+
+	prb_open_block(rb, pbd);
+	return 1;
+}
+
+/*
+ * Reserve @len bytes for a packet in the active block, retiring it first
+ * if the packet does not fit. *retired is set when a block was handed to
+ * user space, so the caller knows to wake up readers.
+ */
+static void *prb_lookup_frame(struct packet_sock *po, unsigned int len,
+			      int *retired)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	struct tpacket_block_desc *pbd;
+	char *curr;
+
+	len = TPACKET_ALIGN(len);
+
+	if (!pkc->blk_open && !prb_try_open_block(rb))
+		return NULL;
+
+	pbd = prb_active_block(rb);
+	if (pkc->nxt_offset + len > (char *)pbd + pkc->kblk_size) {
+		prb_close_block(rb, pbd, 0);
+		*retired = 1;
+		if (!prb_try_open_block(rb)) {
+			po->stats.tp_freeze_q_cnt++;
+			return NULL;
+		}
+		pbd = prb_active_block(rb);
+	}
+
+	curr = pkc->nxt_offset;
+	((struct tpacket3_hdr *)curr)->tp_next_offset = len;
+	pkc->nxt_offset += len;
+	pkc->prev = curr;
+	pbd->hdr.bh1.num_pkts++;
+	pbd->hdr.bh1.blk_len += len;
+
+	return curr;
+}
+
+/*
+ * Retire the active block if anything was put in it since it was opened,
+ * so that a slow trickle of packets still reaches user space in bounded
+ * time. Also reopens a frozen queue once user space returned the block.
+ */
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	struct sock *sk = &po->sk;
+	struct tpacket_block_desc *pbd;
+	int retired = 0;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	if (pkc->blk_open) {
+		pbd = prb_active_block(rb);
+		if (pbd->hdr.bh1.num_pkts) {
+			prb_close_block(rb, pbd, TP_STATUS_BLK_TMO);
+			retired = 1;
+			if (!prb_try_open_block(rb))
+				po->stats.tp_freeze_q_cnt++;
+		}
+	} else
+		prb_try_open_block(rb);
+
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+out:
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	if (retired)
+		sk->sk_data_ready(sk, 0);
+}
+
+static void prb_init_ring(struct packet_sock *po, struct tpacket_req3 *req3)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->knum_blocks = rb->pg_vec_len;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->max_frame_len = pkc->kblk_size -
+			     BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	pkc->retire_blk_tov = req3->tp_retire_blk_tov ?:
+			      PRB_DEFAULT_RETIRE_TOV;
+	pkc->tov_in_jiffies = msecs_to_jiffies(pkc->retire_blk_tov) ?: 1;
+	pkc->knxt_seq_num = 1;
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+
+	prb_open_block(rb, prb_block(rb, 0));
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	spin_lock_bh(&po->sk.sk_receive_queue.lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&po->sk.sk_receive_queue.lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
+/*
+ * Whether user space has a block to read: either the one before the
+ * active block, or, if the queue is frozen, the active block itself.
+ */
+static int prb_user_has_block(struct packet_ring_buffer *rb)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	unsigned int prev;
+
+	if (!pkc->blk_open)
+		return 1;
+
+	prev = pkc->kactive_blk_num ? pkc->kactive_blk_num - 1 :
+				      pkc->knum_blocks - 1;
+	return prb_block(rb, prev)->hdr.bh1.block_status & TP_STATUS_USER;
+}
+
 static inline struct packet_sock *pkt_sk(struct sock *sk)
 {
 	return (struct packet_sock *)sk;
@@ -503,7 +753,7 @@ static inline unsigned int run_filter(struct sk_buff *skb, struct sock *sk,
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter != NULL)
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = SK_RUN_FILTER(filter, skb);
 	rcu_read_unlock_bh();
 
 	return res;
@@ -640,16 +890,18 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
 	int skb_len = skb->len;
-	unsigned int snaplen, res;
+	unsigned int snaplen, res, frame_len;
 	unsigned long status = TP_STATUS_LOSING|TP_STATUS_USER;
 	unsigned short macoff, netoff, hdrlen;
 	struct sk_buff *copy_skb = NULL;
 	struct timeval tv;
 	struct timespec ts;
+	int retired = 0;
 
 	if (skb->pkt_type == PACKET_LOOPBACK)
 		goto drop;
@@ -691,8 +943,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		macoff = netoff - maclen;
 	}
 
-	if (macoff + snaplen > po->rx_ring.frame_size) {
-		if (po->copy_thresh &&
+	if (po->tp_version == TPACKET_V3)
+		frame_len = po->rx_ring.prb_bdqc.max_frame_len;
+	else
+		frame_len = po->rx_ring.frame_size;
+
+	if (macoff + snaplen > frame_len) {
+		if (po->copy_thresh && po->tp_version != TPACKET_V3 &&
 		    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
 		    (unsigned)sk->sk_rcvbuf) {
 			if (skb_shared(skb)) {
@@ -704,16 +961,23 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 			if (copy_skb)
 				skb_set_owner_r(copy_skb, sk);
 		}
-		snaplen = po->rx_ring.frame_size - macoff;
+		snaplen = frame_len - macoff;
 		if ((int)snaplen < 0)
 			snaplen = 0;
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
-	if (!h.raw)
-		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version == TPACKET_V3) {
+		h.raw = prb_lookup_frame(po, macoff + snaplen, &retired);
+		if (!h.raw)
+			goto ring_is_full;
+	} else {
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
+		if (!h.raw)
+			goto ring_is_full;
+		packet_increment_head(&po->rx_ring);
+	}
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -721,7 +985,12 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 	if (!po->stats.tp_drops)
 		status &= ~TP_STATUS_LOSING;
-	spin_unlock(&sk->sk_receive_queue.lock);
+	/*
+	 * A V3 block may be retired by the next packet or the timer as soon
+	 * as we let go of the lock, so the packet is filled in under it.
+	 */
+	if (po->tp_version != TPACKET_V3)
+		spin_unlock(&sk->sk_receive_queue.lock);
 
 	skb_copy_bits(skb, 0, h.raw + macoff, snaplen);
 
@@ -753,6 +1022,34 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = vlan_tx_tag_get(skb);
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+	{
+		struct tpacket_hdr_v1 *bh1;
+
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		h.h3->tp_vlan_tci = vlan_tx_tag_get(skb);
+		h.h3->tp_padding = 0;
+		hdrlen = sizeof(*h.h3);
+
+		bh1 = &prb_active_block(&po->rx_ring)->hdr.bh1;
+		if (bh1->num_pkts == 1) {
+			bh1->ts_first_pkt.ts_sec = ts.tv_sec;
+			bh1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+		}
+		bh1->ts_last_pkt.ts_sec = ts.tv_sec;
+		bh1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+		break;
+	}
 	default:
 		BUG();
 	}
@@ -768,19 +1065,18 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
+	if (po->tp_version == TPACKET_V3) {
+		/* readers are only woken up once a whole block is done */
+		packet_flush_range(h.raw, macoff + snaplen);
+		spin_unlock(&sk->sk_receive_queue.lock);
+		if (retired)
+			sk->sk_data_ready(sk, 0);
+		goto drop_n_restore;
+	}
+
 	__packet_set_status(po, h.raw, status);
 	smp_mb();
-	{
-		struct page *p_start, *p_end;
-		u8 *h_end = h.raw + macoff + snaplen - 1;
-
-		p_start = virt_to_page(h.raw);
-		p_end = virt_to_page(h_end);
-		while (p_start <= p_end) {
-			flush_dcache_page(p_start);
-			p_start++;
-		}
-	}
+	packet_flush_range(h.raw, macoff + snaplen);
 
 	sk->sk_data_ready(sk, 0);
 
@@ -1255,7 +1551,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1282,13 +1578,13 @@ static int packet_release(struct socket *sock)
 
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 
 	synchronize_net();
 	/*
@@ -1861,15 +2157,27 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u.req, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1896,6 +2204,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -1981,7 +2290,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	struct tpacket_stats_v3 st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1994,7 +2303,10 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else if (len > sizeof(struct tpacket_stats))
 			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
@@ -2043,6 +2355,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2187,7 +2502,11 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (po->tp_version == TPACKET_V3) {
+			if (prb_user_has_block(&po->rx_ring))
+				mask |= POLLIN | POLLRDNORM;
+		} else if (!packet_previous_frame(po, &po->rx_ring,
+						  TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2273,9 +2592,10 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
+	struct tpacket_req *req = &req_u->req;
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
@@ -2308,9 +2628,28 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* blocks are only used for receiving */
+			if (unlikely(tx_ring))
+				goto out;
+			if (unlikely(req3->tp_feature_req_word))
+				goto out;
+			if (unlikely(req3->tp_sizeof_priv >=
+				     req3->tp_block_size))
+				goto out;
+			if (unlikely(BLK_PLUS_PRIV(req3->tp_sizeof_priv) +
+				     po->tp_hdrlen + po->tp_reserve >
+				     req3->tp_block_size))
+				goto out;
+		}
 		if (unlikely((int)req->tp_block_size <= 0))
 			goto out;
 		if (unlikely(req->tp_block_size & (PAGE_SIZE - 1)))
@@ -2361,6 +2700,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			prb_shutdown_retire_blk_timer(po);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
@@ -2373,6 +2714,11 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		req->tp_block_nr = XC(rb->pg_vec_len, req->tp_block_nr);
 
 		rb->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3) {
+			spin_lock_bh(&rb_queue->lock);
+			prb_init_ring(po, &req_u->req3);
+			spin_unlock_bh(&rb_queue->lock);
+		}
 		po->prot_hook.func = (po->rx_ring.pg_vec) ?
 						tpacket_rcv : packet_rcv;
 		skb_queue_purge(rb_queue);
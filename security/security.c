@@ -565,6 +565,22 @@ int security_inode_permission(struct inode *inode, int mask)
 	return security_ops->inode_permission(inode, mask);
 }
 
+/*
+ * Permission check from the RCU path walk, where we must not sleep and
+ * hold no reference on @inode.  Only the default (capability) hook is
+ * known to be safe there; for any other module return -ECHILD and let the
+ * caller redo the walk with references held.
+ */
+int security_inode_permission_rcu(struct inode *inode, int mask)
+{
+	if (unlikely(IS_PRIVATE(inode)))
+		return 0;
+	if (security_ops->inode_permission !=
+	    default_security_ops.inode_permission)
+		return -ECHILD;
+	return security_ops->inode_permission(inode, mask);
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	if (unlikely(IS_PRIVATE(dentry->d_inode)))
@@ -13,6 +13,7 @@
 #include "../perf.h"
 #include "../util/util.h"
 #include "../util/parse-options.h"
+#include "../util/debugfs.h"
 #include "../builtin.h"
 #include "bench.h"
 
@@ -30,10 +31,16 @@
 
 #define LOOPS_DEFAULT 1000000
 static int loops = LOOPS_DEFAULT;
+static int nr_pairs = 1;
+static const char *feature;
 
 static const struct option options[] = {
 	OPT_INTEGER('l', "loop", &loops,
 		    "Specify number of loops"),
+	OPT_INTEGER('p', "pairs", &nr_pairs,
+		    "Specify number of task pairs"),
+	OPT_STRING('f', "feature", &feature, "FEATURE",
+		   "Compare runs with and without a scheduler feature"),
 	OPT_END()
 };
 
@@ -42,13 +49,14 @@ static const char * const bench_sched_pipe_usage[] = {
 	NULL
 };
 
-int bench_sched_pipe(int argc, const char **argv,
-		     const char *prefix __used)
+/*
+ * Two tasks passing an int back and forth through a pair of pipes:
+ * every operation is a wakeup of the other task.
+ */
+static void pipe_pair(void)
 {
 	int pipe_1[2], pipe_2[2];
 	int m = 0, i;
-	struct timeval start, stop, diff;
-	unsigned long long result_usec = 0;
 
 	/*
 	 * why does "ret" exist?
@@ -58,62 +66,118 @@ int bench_sched_pipe(int argc, const char **argv,
 	int ret, wait_stat;
 	pid_t pid, retpid;
 
-	argc = parse_options(argc, argv, options,
-			     bench_sched_pipe_usage, 0);
-
 	assert(!pipe(pipe_1));
 	assert(!pipe(pipe_2));
 
 	pid = fork();
 	assert(pid >= 0);
 
-	gettimeofday(&start, NULL);
-
 	if (!pid) {
 		for (i = 0; i < loops; i++) {
 			ret = read(pipe_1[0], &m, sizeof(int));
 			ret = write(pipe_2[1], &m, sizeof(int));
 		}
-	} else {
-		for (i = 0; i < loops; i++) {
-			ret = write(pipe_1[1], &m, sizeof(int));
-			ret = read(pipe_2[0], &m, sizeof(int));
+		exit(0);
+	}
+
+	for (i = 0; i < loops; i++) {
+		ret = write(pipe_1[1], &m, sizeof(int));
+		ret = read(pipe_2[0], &m, sizeof(int));
+	}
+
+	retpid = waitpid(pid, &wait_stat, 0);
+	assert((retpid == pid) && WIFEXITED(wait_stat));
+}
+
+static void run_pairs(struct timeval *diff)
+{
+	struct timeval start, stop;
+	int i, wait_stat;
+	pid_t *pids;
+
+	pids = calloc(nr_pairs, sizeof(pid_t));
+	assert(pids);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_pairs; i++) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (!pids[i]) {
+			pipe_pair();
+			exit(0);
 		}
 	}
+	for (i = 0; i < nr_pairs; i++) {
+		assert(waitpid(pids[i], &wait_stat, 0) == pids[i]);
+		assert(WIFEXITED(wait_stat));
+	}
 
 	gettimeofday(&stop, NULL);
-	timersub(&stop, &start, &diff);
+	timersub(&stop, &start, diff);
 
-	if (pid) {
-		retpid = waitpid(pid, &wait_stat, 0);
-		assert((retpid == pid) && WIFEXITED(wait_stat));
-	} else {
-		exit(0);
+	free(pids);
+}
+
+/*
+ * Scheduler features are listed in debugfs as NAME when set and as
+ * NO_NAME when not.  Returns 1 or 0 for those, -1 for no such feature.
+ */
+static int sched_feature_get(const char *name)
+{
+	char buf[BUFSIZ], *tok;
+
+	if (debugfs_read("sched_features", buf, sizeof(buf) - 1) <= 0)
+		return -1;
+
+	for (tok = strtok(buf, " \n"); tok; tok = strtok(NULL, " \n")) {
+		if (!strcmp(tok, name))
+			return 1;
+		if (!strncmp(tok, "NO_", 3) && !strcmp(tok + 3, name))
+			return 0;
 	}
+	return -1;
+}
+
+static int sched_feature_set(const char *name, int on)
+{
+	char buf[BUFSIZ];
+
+	snprintf(buf, sizeof(buf), "%s%s", on ? "" : "NO_", name);
+	return debugfs_write("sched_features", buf);
+}
+
+static void print_result(const char *title, struct timeval *diff)
+{
+	unsigned long long result_usec = 0;
 
 	switch (bench_format) {
 	case BENCH_FORMAT_DEFAULT:
-		printf("# Extecuted %d pipe operations between two tasks\n\n",
-			loops);
+		if (title)
+			printf(" %s:\n", title);
 
-		result_usec = diff.tv_sec * 1000000;
-		result_usec += diff.tv_usec;
+		result_usec = diff->tv_sec * 1000000;
+		result_usec += diff->tv_usec;
 
 		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
-		       diff.tv_sec,
-		       (unsigned long) (diff.tv_usec/1000));
+		       diff->tv_sec,
+		       (unsigned long) (diff->tv_usec/1000));
 
 		printf(" %14lf usecs/op\n",
 		       (double)result_usec / (double)loops);
 		printf(" %14d ops/sec\n",
-		       (int)((double)loops /
+		       (int)((double)loops * nr_pairs /
 			     ((double)result_usec / (double)1000000)));
+		if (title)
+			printf("\n");
 		break;
 
 	case BENCH_FORMAT_SIMPLE:
+		if (title)
+			printf("%s ", title);
 		printf("%lu.%03lu\n",
-		       diff.tv_sec,
-		       (unsigned long) (diff.tv_usec / 1000));
+		       diff->tv_sec,
+		       (unsigned long) (diff->tv_usec / 1000));
 		break;
 
 	default:
@@ -122,6 +186,59 @@ int bench_sched_pipe(int argc, const char **argv,
 		exit(1);
 		break;
 	}
+}
+
+int bench_sched_pipe(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval diff;
+	char no_feature[BUFSIZ];
+	int was_set, on;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_pipe_usage, 0);
+
+	if (loops <= 0 || nr_pairs <= 0)
+		usage_with_options(bench_sched_pipe_usage, options);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		if (nr_pairs == 1)
+			printf("# Extecuted %d pipe operations between two"
+			       " tasks\n\n", loops);
+		else
+			printf("# Extecuted %d pipe operations between two"
+			       " tasks, %d pairs\n\n", loops, nr_pairs);
+	}
+
+	if (!feature) {
+		run_pairs(&diff);
+		print_result(NULL, &diff);
+		return 0;
+	}
+
+	/*
+	 * Run once with the feature set and once without, to compare
+	 * wakeup placement policies, then put it back the way it was.
+	 */
+	was_set = sched_feature_get(feature);
+	if (was_set < 0) {
+		fprintf(stderr, "Unknown scheduler feature %s: is debugfs"
+			" mounted and CONFIG_SCHED_DEBUG enabled?\n", feature);
+		return 1;
+	}
+	snprintf(no_feature, sizeof(no_feature), "NO_%s", feature);
+
+	for (on = 1; on >= 0; on--) {
+		if (sched_feature_set(feature, on)) {
+			fprintf(stderr, "Cannot change scheduler feature %s:"
+				" %s\n", feature, strerror(errno));
+			sched_feature_set(feature, was_set);
+			return 1;
+		}
+		run_pairs(&diff);
+		print_result(on ? feature : no_feature, &diff);
+	}
+	sched_feature_set(feature, was_set);
 
 	return 0;
 }